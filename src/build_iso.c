@@ -152,9 +152,9 @@ int build_tonarchy_static(const Build_Config *config) {
                  "sudo podman run --rm "
                  "-v '%s:/src' "
                  "docker.io/archlinux:latest "
-                 "sh -c 'pacman -Sy --noconfirm musl gcc && "
-                 "cd /src && rm -f tonarchy tonarchy-static && "
-                 "musl-gcc -std=c23 -Wall -Wextra -O2 -static src/tonarchy.c -o tonarchy-static'",
+                 "sh -c 'pacman -Sy --noconfirm musl gcc make && "
+                 "cd /src && rm -f tonarchy tonarchy-static pack_assets src/assets_bundle.h && "
+                 "make static CC=musl-gcc'",
                  config->tonarchy_src);
         if (!run_command(cmd)) {
             log_error("Failed to build tonarchy-static in podman");
@@ -292,6 +292,372 @@ int prepare_airootfs(const Build_Config *config) {
     return 1;
 }
 
+static const Git_Source GIT_SOURCES[] = {
+    { "nvim", "https://github.com/tonybanters/nvim", "HEAD" },
+    { "oxwm", "https://github.com/tonybanters/oxwm", "HEAD" },
+};
+
+static int resolve_git_commit(const char *repo, const char *ref, char *out, size_t out_size) {
+    char cmd[CMD_MAX_LEN];
+    snprintf(cmd, sizeof(cmd), "git -C '%s' rev-parse --verify '%s^{commit}'", repo, ref);
+
+    FILE *fp = popen(cmd, "r");
+    if (!fp) {
+        return 0;
+    }
+    out[0] = '\0';
+    if (fgets(out, (int)out_size, fp)) {
+        out[strcspn(out, "\n")] = '\0';
+    }
+    return pclose(fp) == 0 && out[0] != '\0';
+}
+
+int build_git_bundles(const Build_Config *config) {
+    log_info("Bundling git sources...");
+
+    char cmd[CMD_MAX_LEN];
+    char bundle_dir[PATH_MAX_LEN];
+    snprintf(bundle_dir, sizeof(bundle_dir), "%s/airootfs%s", config->iso_profile, GIT_BUNDLE_DIR);
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s' && mkdir -p '%s' '%s'", GIT_SOURCE_WORK_DIR, GIT_SOURCE_WORK_DIR, bundle_dir);
+    if (!run_command(cmd)) {
+        log_error("Failed to prepare git bundle directories");
+        return 0;
+    }
+
+    int bundled = 0;
+    for (size_t i = 0; i < sizeof(GIT_SOURCES) / sizeof(GIT_SOURCES[0]); i++) {
+        const Git_Source *src = &GIT_SOURCES[i];
+        char repo[PATH_MAX_LEN];
+        char commit[128];
+        snprintf(repo, sizeof(repo), "%s/%s.git", GIT_SOURCE_WORK_DIR, src->name);
+
+        snprintf(cmd, sizeof(cmd), "git clone -q --bare --single-branch '%s' '%s'", src->url, repo);
+        if (!run_command(cmd) || !resolve_git_commit(repo, src->ref, commit, sizeof(commit))) {
+            log_warn("Failed to fetch %s, the installer will clone it from the network", src->url);
+            continue;
+        }
+
+        snprintf(cmd, sizeof(cmd),
+                 "git -C '%s' update-ref HEAD '%s' && "
+                 "git -C '%s' bundle create -q '%s/%s.bundle' --all && "
+                 "echo '%s' > '%s/%s.commit'",
+                 repo, commit, repo, bundle_dir, src->name, commit, bundle_dir, src->name);
+        if (!run_command(cmd)) {
+            log_warn("Failed to bundle %s", src->name);
+            continue;
+        }
+        log_info("Bundled %s at %s", src->name, commit);
+        bundled++;
+    }
+
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", GIT_SOURCE_WORK_DIR);
+    run_command(cmd);
+    return bundled > 0;
+}
+
+int build_oxwm_artifact(const Build_Config *config) {
+    log_info("Building OXWM artifact...");
+
+    if (!config->use_container) {
+        log_error("The OXWM artifact is only built inside a build container, pass --container");
+        return 0;
+    }
+
+    char cmd[CMD_MAX_LEN];
+    char bundle[PATH_MAX_LEN];
+    char commit_path[PATH_MAX_LEN];
+    char commit[128] = "";
+    snprintf(bundle, sizeof(bundle), "%s/airootfs%s/oxwm.bundle", config->iso_profile, GIT_BUNDLE_DIR);
+    snprintf(commit_path, sizeof(commit_path), "%s/airootfs%s/oxwm.commit", config->iso_profile, GIT_BUNDLE_DIR);
+    FILE *fp = fopen(commit_path, "r");
+    if (fp) {
+        if (fgets(commit, sizeof(commit), fp)) commit[strcspn(commit, "\n")] = '\0';
+        fclose(fp);
+    }
+    if (commit[0] == '\0' || access(bundle, R_OK) != 0) {
+        log_warn("No oxwm source bundle available");
+        return 0;
+    }
+
+    const bool in_podman = config->use_container && config->container_type == CONTAINER_PODMAN;
+    char build_dir[PATH_MAX_LEN];
+    char artifact_dir[PATH_MAX_LEN];
+    snprintf(build_dir, sizeof(build_dir), "%s/oxwm-build", config->work_dir);
+    snprintf(artifact_dir, sizeof(artifact_dir), "%s/airootfs%s", config->iso_profile, OXWM_ARTIFACT_DIR);
+
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s' && git clone -q '%s' '%s'", build_dir, bundle, build_dir);
+    if (!run_command(cmd)) {
+        log_warn("Failed to check out oxwm %s", commit);
+        return 0;
+    }
+
+    snprintf(cmd, sizeof(cmd),
+             "%spacman -Syu --noconfirm --needed %s && "
+             "cd %s && zig build -Doptimize=ReleaseSmall && zig version > zig-out/zig-version",
+             in_podman ? "" : "sudo ", OXWM_BUILD_PACKAGES,
+             in_podman ? "/work/oxwm-build" : build_dir);
+    int built = run_command_in_container(cmd, config);
+
+    if (built) {
+        snprintf(cmd, sizeof(cmd),
+                 "mkdir -p '%s' && "
+                 "install -m 755 '%s/zig-out/bin/oxwm' '%s/oxwm' && "
+                 "cp -r '%s/templates' '%s/' && "
+                 "printf 'commit=%%s\\nzig=%%s\\n' '%s' \"$(cat '%s/zig-out/zig-version')\" > '%s/version'",
+                 artifact_dir, build_dir, artifact_dir, build_dir, artifact_dir, commit, build_dir, artifact_dir);
+        built = run_command(cmd);
+    }
+
+    snprintf(cmd, sizeof(cmd), "sudo rm -rf '%s'", build_dir);
+    run_command(cmd);
+
+    if (!built) {
+        log_warn("Failed to build oxwm %s", commit);
+        return 0;
+    }
+    log_info("Built OXWM artifact at %s", commit);
+    return 1;
+}
+
+int load_profile_packages(const Build_Config *config, Profile_Packages *profiles, int max) {
+    char cmd[CMD_MAX_LEN];
+    snprintf(cmd, sizeof(cmd), "'%s/tonarchy-static' --profile-packages", config->tonarchy_src);
+
+    FILE *fp = popen(cmd, "r");
+    if (!fp) {
+        log_error("Failed to query install profiles from tonarchy-static");
+        return 0;
+    }
+
+    int count = 0;
+    char line[CMD_MAX_LEN + 128];
+    while (count < max && fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+
+        char *packages = strchr(line, ' ');
+        if (!packages) {
+            continue;
+        }
+        *packages++ = '\0';
+
+        snprintf(profiles[count].name, sizeof(profiles[count].name), "%s", line);
+        snprintf(profiles[count].packages, sizeof(profiles[count].packages), "%s", packages);
+        count++;
+    }
+
+    if (pclose(fp) != 0 || count == 0) {
+        log_error("tonarchy-static did not report any install profiles");
+        return 0;
+    }
+
+    return count;
+}
+
+static int write_offline_repo_script(const Build_Config *config, const char *script_path) {
+    const bool in_podman = config->use_container && config->container_type == CONTAINER_PODMAN;
+    const char *profile_root = in_podman ? "/profile" : config->iso_profile;
+    const char *work_root = in_podman ? "/work" : config->work_dir;
+
+    static Profile_Packages profiles[MAX_INSTALL_PROFILES];
+    int profile_count = load_profile_packages(config, profiles, MAX_INSTALL_PROFILES);
+    if (profile_count == 0) {
+        return 0;
+    }
+
+    FILE *script = fopen(script_path, "w");
+    if (!script) {
+        log_error("Failed to write offline repo script: %s", script_path);
+        return 0;
+    }
+
+    fprintf(script,
+            "set -e\n"
+            "repo='%s/airootfs%s'\n"
+            "db='%s/offline-db'\n"
+            "conf='%s/pacman.conf'\n"
+            "rm -rf \"$repo\" \"$db\"\n"
+            "mkdir -p \"$repo\" \"$db\"\n"
+            "pacman -Syw --noconfirm --config \"$conf\" --dbpath \"$db\" --cachedir \"$repo\" %s\n",
+            profile_root, OFFLINE_REPO_DIR, work_root, profile_root, OFFLINE_EXTRA_PACKAGES);
+
+    for (int i = 0; i < profile_count; i++) {
+        log_info("Offline repo profile: %s", profiles[i].name);
+        fprintf(script,
+                "pacman -Sw --noconfirm --config \"$conf\" --dbpath \"$db\" --cachedir \"$repo\" %s\n"
+                "echo '%s' >> \"$repo/profiles\"\n",
+                profiles[i].packages, profiles[i].name);
+    }
+
+    if (config->sign_key[0] != '\0' && !in_podman) {
+        fprintf(script,
+                "repo-add --sign --key '%s' \"$repo/%s.db.tar.zst\" \"$repo\"/*.pkg.tar.zst\n"
+                "gpg --export --armor '%s' > \"$repo/%s.key\"\n"
+                "echo '%s' > \"$repo/%s.keyid\"\n",
+                config->sign_key, OFFLINE_REPO_NAME,
+                config->sign_key, OFFLINE_REPO_NAME,
+                config->sign_key, OFFLINE_REPO_NAME);
+    } else {
+        if (config->sign_key[0] != '\0') {
+            log_warn("Signing keys are not available inside podman, offline repo database left unsigned");
+        }
+        fprintf(script,
+                "repo-add \"$repo/%s.db.tar.zst\" \"$repo\"/*.pkg.tar.zst\n",
+                OFFLINE_REPO_NAME);
+    }
+
+    fprintf(script, "rm -rf \"$db\"\n");
+    fclose(script);
+    return 1;
+}
+
+int build_offline_repo(const Build_Config *config) {
+    log_info("Building offline package repository...");
+
+    if (!create_directory(config->work_dir, 0755)) {
+        return 0;
+    }
+
+    char script_path[PATH_MAX_LEN];
+    snprintf(script_path, sizeof(script_path), "%s/offline-repo.sh", config->work_dir);
+
+    if (!write_offline_repo_script(config, script_path)) {
+        return 0;
+    }
+
+    char cmd[CMD_MAX_LEN];
+    if (config->use_container && config->container_type == CONTAINER_PODMAN) {
+        snprintf(cmd, sizeof(cmd),
+                 "sudo podman run --rm --privileged "
+                 "-v '%s:/profile' "
+                 "-v '%s:/work' "
+                 "docker.io/archlinux:latest "
+                 "sh -c 'pacman -Sy --noconfirm archlinux-keyring && sh /work/offline-repo.sh'",
+                 config->iso_profile,
+                 config->work_dir);
+        if (!run_command(cmd)) {
+            log_error("Offline repo build in container failed");
+            return 0;
+        }
+    } else {
+        snprintf(cmd, sizeof(cmd), "sudo sh '%s'", script_path);
+        if (!run_command_in_container(cmd, config)) {
+            log_error("Offline repo build failed");
+            return 0;
+        }
+    }
+
+    log_info("Offline repository written to %s/airootfs%s", config->iso_profile, OFFLINE_REPO_DIR);
+    return 1;
+}
+
+static int write_rootfs_image_script(const Build_Config *config, const char *script_path) {
+    const bool in_podman = config->use_container && config->container_type == CONTAINER_PODMAN;
+    const char *profile_root = in_podman ? "/profile" : config->iso_profile;
+    const char *work_root = in_podman ? "/work" : config->work_dir;
+
+    static Profile_Packages profiles[MAX_INSTALL_PROFILES];
+    int profile_count = load_profile_packages(config, profiles, MAX_INSTALL_PROFILES);
+    if (profile_count == 0) {
+        return 0;
+    }
+
+    FILE *script = fopen(script_path, "w");
+    if (!script) {
+        log_error("Failed to write rootfs image script: %s", script_path);
+        return 0;
+    }
+
+    fprintf(script,
+            "set -e\n"
+            "work='%s/rootfs'\n"
+            "images='%s/airootfs%s'\n"
+            "rm -rf \"$work\" \"$images\"\n"
+            "mkdir -p \"$work\" \"$images\"\n"
+            "\n"
+            "chunk() {\n"
+            "    name=$1; shift\n"
+            "    tar -C \"$root\" --numeric-owner --xattrs --xattrs-include='*' --acls -cpf - \"$@\" |\n"
+            "        zstd -q -T0 -19 -o \"$out/$name.tar.zst\"\n"
+            "}\n"
+            "\n"
+            "pack() {\n"
+            "    chunk boot boot\n"
+            "    chunk etc etc\n"
+            "    chunk usr-lib-firmware usr/lib/firmware\n"
+            "    chunk usr-lib-modules usr/lib/modules\n"
+            "    chunk usr-lib --anchored --exclude=usr/lib/firmware --exclude=usr/lib/modules usr/lib\n"
+            "    chunk usr-share usr/share\n"
+            "    chunk usr --anchored --exclude=usr/lib --exclude=usr/share usr\n"
+            "    chunk var var\n"
+            "    chunk rootfs $(cd \"$root\" && ls -A | grep -vxE 'boot|etc|usr|var')\n"
+            "    (cd \"$root\" && find . -path ./boot -prune -o -type d -print0) |\n"
+            "        tar -C \"$root\" --numeric-owner --xattrs --xattrs-include='*' --acls --no-recursion --null -T - -cpf - |\n"
+            "        zstd -q -T0 -19 -o \"$out/%s\"\n"
+            "}\n",
+            work_root, profile_root, ROOTFS_IMAGE_DIR, ROOTFS_DIRS_CHUNK);
+
+    for (int i = 0; i < profile_count; i++) {
+        log_info("Rootfs image profile: %s", profiles[i].name);
+        fprintf(script,
+                "\n"
+                "root=\"$work/%s\"\n"
+                "out=\"$images/%s\"\n"
+                "mkdir -p \"$root\" \"$out\"\n"
+                "pacstrap -c -G -M \"$root\" %s %s\n"
+                "rm -rf \"$root\"/var/cache/pacman/pkg/* \"$root\"/etc/pacman.d/gnupg \"$root\"/boot/initramfs-*.img\n"
+                ": > \"$root/etc/machine-id\"\n"
+                "pack\n"
+                "printf 'profile=%%s\\npackages=%%s\\ncreated=%%s\\n' '%s' '%s %s' \"$(date -u +%%Y-%%m-%%dT%%H:%%M:%%SZ)\" > \"$out/image.conf\"\n"
+                "rm -rf \"$root\"\n",
+                profiles[i].name, profiles[i].name,
+                profiles[i].packages, OFFLINE_EXTRA_PACKAGES,
+                profiles[i].name, profiles[i].packages, OFFLINE_EXTRA_PACKAGES);
+    }
+
+    fclose(script);
+    return 1;
+}
+
+int build_rootfs_images(const Build_Config *config) {
+    log_info("Building per-profile root filesystem images...");
+
+    if (!create_directory(config->work_dir, 0755)) {
+        return 0;
+    }
+
+    char script_path[PATH_MAX_LEN];
+    snprintf(script_path, sizeof(script_path), "%s/rootfs-images.sh", config->work_dir);
+
+    if (!write_rootfs_image_script(config, script_path)) {
+        return 0;
+    }
+
+    char cmd[CMD_MAX_LEN];
+    if (config->use_container && config->container_type == CONTAINER_PODMAN) {
+        snprintf(cmd, sizeof(cmd),
+                 "sudo podman run --rm --privileged "
+                 "-v '%s:/profile' "
+                 "-v '%s:/work' "
+                 "docker.io/archlinux:latest "
+                 "sh -c 'pacman -Sy --noconfirm archlinux-keyring arch-install-scripts zstd && sh /work/rootfs-images.sh'",
+                 config->iso_profile,
+                 config->work_dir);
+        if (!run_command(cmd)) {
+            log_error("Rootfs image build in container failed");
+            return 0;
+        }
+    } else {
+        snprintf(cmd, sizeof(cmd), "sudo sh '%s'", script_path);
+        if (!run_command_in_container(cmd, config)) {
+            log_error("Rootfs image build failed");
+            return 0;
+        }
+    }
+
+    log_info("Rootfs images written to %s/airootfs%s", config->iso_profile, ROOTFS_IMAGE_DIR);
+    return 1;
+}
+
 int run_mkarchiso(const Build_Config *config) {
     log_info("Building ISO with mkarchiso...");
 
@@ -379,6 +745,11 @@ static void print_usage(const char *prog_name) {
     printf("  --out-dir PATH        Output directory for ISO (default: ./out)\n");
     printf("  --container [TYPE]    Build using container (podman or distrobox)\n");
     printf("  --distrobox NAME      Distrobox container name (default: arch)\n");
+    printf("  --offline-repo        Bake a local package repository for every install profile\n");
+    printf("  --sign-key KEYID      Sign the offline repository database with this GPG key\n");
+    printf("  --rootfs-images       Bake a compressed root filesystem image for every install profile\n");
+    printf("  --git-bundles         Bundle the nvim and oxwm git sources into the ISO\n");
+    printf("  --oxwm-artifact       Prebuild OXWM in the build container (implies --git-bundles)\n");
     printf("  -h, --help            Show this help message\n");
 }
 
@@ -407,6 +778,17 @@ static int parse_args(int argc, char *argv[], Build_Config *config) {
             snprintf(config->distrobox_name, sizeof(config->distrobox_name), "%s", argv[++i]);
             config->use_container = true;
             config->container_type = CONTAINER_DISTROBOX;
+        } else if (strcmp(argv[i], "--offline-repo") == 0) {
+            config->offline_repo = true;
+        } else if (strcmp(argv[i], "--rootfs-images") == 0) {
+            config->rootfs_images = true;
+        } else if (strcmp(argv[i], "--git-bundles") == 0) {
+            config->git_bundles = true;
+        } else if (strcmp(argv[i], "--oxwm-artifact") == 0) {
+            config->oxwm_artifact = true;
+            config->git_bundles = true;
+        } else if (strcmp(argv[i], "--sign-key") == 0 && i + 1 < argc) {
+            snprintf(config->sign_key, sizeof(config->sign_key), "%s", argv[++i]);
         } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             print_usage(argv[0]);
             exit(0);
@@ -428,7 +810,11 @@ int main(int argc, char *argv[]) {
         .work_dir = "/tmp/tonarchy_iso_work",
         .distrobox_name = "arch",
         .container_type = CONTAINER_NONE,
-        .use_container = false
+        .use_container = false,
+        .offline_repo = false,
+        .rootfs_images = false,
+        .git_bundles = false,
+        .oxwm_artifact = false
     };
 
     if (getcwd(config.tonarchy_src, sizeof(config.tonarchy_src)) == NULL) {
@@ -444,10 +830,28 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (config.oxwm_artifact && !config.use_container) {
+        log_error("--oxwm-artifact requires --container");
+        logger_close();
+        return 1;
+    }
+
     log_info("Tonarchy source: %s", config.tonarchy_src);
     log_info("ISO profile: %s", config.iso_profile);
     log_info("Work directory: %s", config.work_dir);
     log_info("Output directory: %s", config.out_dir);
+    if (config.offline_repo) {
+        log_info("Offline repository: enabled");
+    }
+    if (config.rootfs_images) {
+        log_info("Rootfs images: enabled");
+    }
+    if (config.git_bundles) {
+        log_info("Git bundles: enabled");
+    }
+    if (config.oxwm_artifact) {
+        log_info("OXWM artifact: enabled");
+    }
 
     if (config.use_container) {
         log_info("Container mode: %s",
@@ -481,6 +885,28 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (config.git_bundles && !build_git_bundles(&config)) {
+        log_warn("No git sources bundled, the installer will clone from the network");
+    }
+
+    if (config.oxwm_artifact && !build_oxwm_artifact(&config)) {
+        log_error("Failed to build OXWM artifact");
+        logger_close();
+        return 1;
+    }
+
+    if (config.offline_repo && !build_offline_repo(&config)) {
+        log_error("Failed to build offline repository");
+        logger_close();
+        return 1;
+    }
+
+    if (config.rootfs_images && !build_rootfs_images(&config)) {
+        log_error("Failed to build rootfs images");
+        logger_close();
+        return 1;
+    }
+
     int build_result;
     if (config.use_container && config.container_type == CONTAINER_PODMAN) {
         build_result = run_mkarchiso_in_container(&config);
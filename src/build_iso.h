@@ -15,6 +15,17 @@
 #define PATH_MAX_LEN 1024
 #define CMD_MAX_LEN 4096
 
+#define OFFLINE_REPO_DIR "/usr/share/tonarchy/repo"
+#define OFFLINE_REPO_NAME "tonarchy-offline"
+#define OFFLINE_EXTRA_PACKAGES "grub e2fsprogs btrfs-progs xfsprogs f2fs-tools zram-generator intel-ucode amd-ucode"
+#define ROOTFS_IMAGE_DIR "/usr/share/tonarchy/images"
+#define ROOTFS_DIRS_CHUNK "dirs.tar.zst"
+#define MAX_INSTALL_PROFILES 8
+#define GIT_BUNDLE_DIR "/usr/share/tonarchy/git"
+#define GIT_SOURCE_WORK_DIR "/tmp/tonarchy_git_sources"
+#define OXWM_ARTIFACT_DIR "/usr/share/tonarchy/oxwm"
+#define OXWM_BUILD_PACKAGES "zig git libx11 libxft libxinerama freetype2 fontconfig lua pkgconf"
+
 typedef enum {
     CONTAINER_NONE,
     CONTAINER_PODMAN,
@@ -27,10 +38,26 @@ typedef struct {
     char out_dir[PATH_MAX_LEN];
     char work_dir[PATH_MAX_LEN];
     char distrobox_name[128];
+    char sign_key[128];
     Container_Type container_type;
     bool use_container;
+    bool offline_repo;
+    bool rootfs_images;
+    bool git_bundles;
+    bool oxwm_artifact;
 } Build_Config;
 
+typedef struct {
+    char name[128];
+    char packages[CMD_MAX_LEN];
+} Profile_Packages;
+
+typedef struct {
+    const char *name;
+    const char *url;
+    const char *ref;
+} Git_Source;
+
 void logger_init(const char *log_path);
 void logger_close(void);
 
@@ -46,6 +73,11 @@ int build_tonarchy_static(const Build_Config *config);
 int clean_airootfs(const Build_Config *config);
 int clean_work_dir(const Build_Config *config);
 int prepare_airootfs(const Build_Config *config);
+int load_profile_packages(const Build_Config *config, Profile_Packages *profiles, int max);
+int build_offline_repo(const Build_Config *config);
+int build_rootfs_images(const Build_Config *config);
+int build_git_bundles(const Build_Config *config);
+int build_oxwm_artifact(const Build_Config *config);
 int run_mkarchiso(const Build_Config *config);
 int run_mkarchiso_in_container(const Build_Config *config);
 
@@ -0,0 +1,267 @@
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Packs the configs listed in the asset manifest into one LZ-compressed
+ * stream and writes it out as a C header for tonarchy to embed.
+ *
+ * Stream: "TAB1", then one record per entry:
+ *   u8 type ('d', 'f', 'l'), u16 mode, u8 group_len, u8 owner_len,
+ *   u16 path_len, u32 size, group, owner, target path, data
+ * Integers are little-endian. Symlink data is the link target.
+ *
+ * Compression is LZ4-style sequences: a token byte with the literal length
+ * in the high nibble and match length - 4 in the low nibble (15 extends with
+ * 255-run bytes), the literals, then a u16 match offset. The final sequence
+ * carries literals only.
+ */
+
+#define BUNDLE_MAGIC "TAB1"
+#define LZ_HASH_BITS 16
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} Buffer;
+
+static int entry_count = 0;
+static Buffer deps = {0};
+static int want_deps = 0;
+
+static void die(const char *fmt, const char *arg) {
+    fprintf(stderr, "pack_assets: ");
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static void buffer_put(Buffer *buf, const void *data, size_t len) {
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 65536;
+        while (cap < buf->len + len) cap *= 2;
+        buf->data = realloc(buf->data, cap);
+        if (!buf->data) die("%s", "out of memory");
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static void put_u8(Buffer *buf, unsigned v) {
+    unsigned char b = (unsigned char)v;
+    buffer_put(buf, &b, 1);
+}
+
+static void put_u16(Buffer *buf, unsigned v) {
+    unsigned char b[2] = { (unsigned char)v, (unsigned char)(v >> 8) };
+    buffer_put(buf, b, 2);
+}
+
+static void put_u32(Buffer *buf, uint32_t v) {
+    unsigned char b[4] = { (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24) };
+    buffer_put(buf, b, 4);
+}
+
+static void put_record(Buffer *buf, char type, mode_t mode, const char *group, const char *owner,
+                       const char *path, const void *data, size_t size) {
+    put_u8(buf, (unsigned char)type);
+    put_u16(buf, mode & 07777);
+    put_u8(buf, (unsigned)strlen(group));
+    put_u8(buf, (unsigned)strlen(owner));
+    put_u16(buf, (unsigned)strlen(path));
+    put_u32(buf, (uint32_t)size);
+    buffer_put(buf, group, strlen(group));
+    buffer_put(buf, owner, strlen(owner));
+    buffer_put(buf, path, strlen(path));
+    if (size) buffer_put(buf, data, size);
+    entry_count++;
+}
+
+static void add_dep(const char *path) {
+    if (!want_deps) return;
+    for (const char *p = path; *p; p++) {
+        if (strchr(":%\\\t\n", *p)) die("unsupported character in asset path: %s", path);
+        if (strchr(" #*?[]", *p)) put_u8(&deps, '\\');
+        if (*p == '$') put_u8(&deps, '$');
+        put_u8(&deps, (unsigned char)*p);
+    }
+    put_u8(&deps, '\n');
+}
+
+/* Make rule for output plus an empty rule per input, so deleted assets don't break the build. */
+static void write_depfile(const char *path, const char *target) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) die("cannot write %s", path);
+
+    fprintf(fp, "%s:", target);
+    for (size_t start = 0, i = 0; i < deps.len; i++) {
+        if (deps.data[i] != '\n') continue;
+        fprintf(fp, " \\\n  %.*s", (int)(i - start), (const char *)deps.data + start);
+        start = i + 1;
+    }
+    fprintf(fp, "\n");
+    for (size_t start = 0, i = 0; i < deps.len; i++) {
+        if (deps.data[i] != '\n') continue;
+        fprintf(fp, "\n%.*s:\n", (int)(i - start), (const char *)deps.data + start);
+        start = i + 1;
+    }
+    if (fclose(fp) != 0) die("cannot write %s", path);
+}
+
+static void read_whole_file(const char *path, Buffer *out) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) die("cannot open %s", path);
+    unsigned char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        buffer_put(out, chunk, n);
+    }
+    fclose(fp);
+}
+
+static void pack_path(Buffer *buf, const char *source, const char *target, const char *owner, const char *group) {
+    struct stat st;
+    if (lstat(source, &st) != 0) die("cannot stat %s", source);
+    add_dep(source);
+
+    if (S_ISDIR(st.st_mode)) {
+        put_record(buf, 'd', st.st_mode, group, owner, target, NULL, 0);
+        struct dirent **names;
+        int n = scandir(source, &names, NULL, alphasort);
+        if (n < 0) die("cannot read %s", source);
+        for (int i = 0; i < n; i++) {
+            if (strcmp(names[i]->d_name, ".") != 0 && strcmp(names[i]->d_name, "..") != 0) {
+                char child_source[4096];
+                char child_target[4096];
+                snprintf(child_source, sizeof(child_source), "%s/%s", source, names[i]->d_name);
+                snprintf(child_target, sizeof(child_target), "%s/%s", target, names[i]->d_name);
+                pack_path(buf, child_source, child_target, owner, group);
+            }
+            free(names[i]);
+        }
+        free(names);
+    } else if (S_ISLNK(st.st_mode)) {
+        char link[4096];
+        ssize_t len = readlink(source, link, sizeof(link));
+        if (len < 0) die("cannot read link %s", source);
+        put_record(buf, 'l', 0777, group, owner, target, link, (size_t)len);
+    } else if (S_ISREG(st.st_mode)) {
+        Buffer data = {0};
+        read_whole_file(source, &data);
+        put_record(buf, 'f', st.st_mode, group, owner, target, data.data, data.len);
+        free(data.data);
+    } else {
+        die("unsupported file type: %s", source);
+    }
+}
+
+static void lz_length(Buffer *out, size_t len) {
+    while (len >= 255) {
+        put_u8(out, 255);
+        len -= 255;
+    }
+    put_u8(out, (unsigned)len);
+}
+
+static void lz_sequence(Buffer *out, const unsigned char *literals, size_t lit_len, size_t offset, size_t match_len) {
+    size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+    put_u8(out, (unsigned)((lit_len < 15 ? lit_len : 15) << 4 | (match_code < 15 ? match_code : 15)));
+    if (lit_len >= 15) lz_length(out, lit_len - 15);
+    buffer_put(out, literals, lit_len);
+    if (!match_len) return;
+    put_u16(out, (unsigned)offset);
+    if (match_code >= 15) lz_length(out, match_code - 15);
+}
+
+static void lz_compress(const unsigned char *in, size_t len, Buffer *out) {
+    static uint32_t table[1 << LZ_HASH_BITS];
+    size_t ip = 0;
+    size_t anchor = 0;
+
+    while (ip + LZ_MIN_MATCH <= len) {
+        uint32_t seq;
+        memcpy(&seq, in + ip, sizeof(seq));
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)(ip + 1);
+
+        if (candidate && ip - (candidate - 1) <= LZ_MAX_OFFSET &&
+            memcmp(in + candidate - 1, in + ip, LZ_MIN_MATCH) == 0) {
+            size_t ref = candidate - 1;
+            size_t match = LZ_MIN_MATCH;
+            while (ip + match < len && in[ref + match] == in[ip + match]) match++;
+            lz_sequence(out, in + anchor, ip - anchor, ip - ref, match);
+            ip += match;
+            anchor = ip;
+        } else {
+            ip++;
+        }
+    }
+    lz_sequence(out, in + anchor, len - anchor, 0, 0);
+}
+
+static void write_header(const char *path, const char *manifest, const Buffer *raw, const Buffer *packed) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) die("cannot write %s", path);
+
+    fprintf(fp, "/* Generated by pack_assets from %s - do not edit. */\n", manifest);
+    fprintf(fp, "#define ASSET_BUNDLE_RAW_SIZE %zuu\n", raw->len);
+    fprintf(fp, "#define ASSET_BUNDLE_ENTRIES %d\n\n", entry_count);
+    fprintf(fp, "static const unsigned char ASSET_BUNDLE[] = {\n");
+    for (size_t i = 0; i < packed->len; i++) {
+        fprintf(fp, "%s0x%02x,%s", i % 16 == 0 ? "    " : "", packed->data[i],
+                i % 16 == 15 || i + 1 == packed->len ? "\n" : " ");
+    }
+    fprintf(fp, "};\n");
+    if (fclose(fp) != 0) die("cannot write %s", path);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4 && argc != 5) {
+        fprintf(stderr, "Usage: %s <manifest> <assets-dir> <output.h> [output.d]\n", argv[0]);
+        return 1;
+    }
+    want_deps = argc == 5;
+
+    FILE *fp = fopen(argv[1], "r");
+    if (!fp) die("cannot open %s", argv[1]);
+
+    Buffer raw = {0};
+    buffer_put(&raw, BUNDLE_MAGIC, 4);
+
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        char source[512], target[512], owner[64], group[64];
+        if (line[0] == '#' || sscanf(line, "%511s %511s %63s %63s", source, target, owner, group) != 4) {
+            continue;
+        }
+        char source_path[1024];
+        snprintf(source_path, sizeof(source_path), "%s/%s", argv[2], source);
+        pack_path(&raw, source_path, target, owner, group);
+    }
+    fclose(fp);
+
+    Buffer packed = {0};
+    lz_compress(raw.data, raw.len, &packed);
+    write_header(argv[3], argv[1], &raw, &packed);
+    if (want_deps) {
+        write_depfile(argv[4], argv[3]);
+    }
+
+    printf("pack_assets: %d entries, %zu bytes packed to %zu\n", entry_count, raw.len, packed.len);
+    free(raw.data);
+    free(packed.data);
+    free(deps.data);
+    return 0;
+}
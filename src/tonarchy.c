@@ -1,11 +1,68 @@
 #include "tonarchy.h"
+#include "assets_bundle.h"
 #include <string.h>
 #include <ctype.h>
 #include <sys/wait.h>
+#include <sys/statvfs.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/mount.h>
+#include <limits.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+extern char **environ;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} Log_Buffer;
 
 static FILE *log_file = NULL;
+static _Thread_local Log_Buffer *thread_log = NULL;
+static atomic_int steps_cancelled = 0;
+static pthread_mutex_t exec_spawn_lock = PTHREAD_MUTEX_INITIALIZER;
 static const char *level_strings[] = {"DEBUG", "INFO", "WARN", "ERROR"};
 static struct termios orig_termios;
+static int offline_repo_active = 0;
+static pid_t prefetch_pid = -1;
+static time_t prefetch_started = 0;
+static int mirrors_ranked = 0;
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+#ifndef BLKPG
+#define BLKPG _IO(0x12, 105)
+#define BLKPG_ADD_PARTITION 1
+#define BLKPG_DEL_PARTITION 2
+
+struct blkpg_ioctl_arg {
+    int op;
+    int flags;
+    int datalen;
+    void *data;
+};
+
+struct blkpg_partition {
+    long long start;
+    long long length;
+    int pno;
+    char devname[64];
+    char volname[64];
+};
+#endif
 
 static void part_path(char *out, size_t size, const char *disk, int part) {
     if (isdigit(disk[strlen(disk) - 1])) {
@@ -27,6 +84,22 @@ enum Terminal_Size {
     TERM_LARGE = 2
 };
 
+typedef enum {
+    STYLE_DEFAULT,
+    STYLE_WHITE,
+    STYLE_GREEN,
+    STYLE_LOGO,
+    STYLE_BLUE_BOLD,
+    STYLE_YELLOW,
+    STYLE_GRAY,
+    STYLE_RED
+} Screen_Style;
+
+typedef struct {
+    char glyph[5];
+    unsigned char style;
+} Screen_Cell;
+
 typedef struct {
     const char *name;
     const char *packages;
@@ -35,6 +108,85 @@ typedef struct {
 #define MAX_PROFILE_PACKAGES 512
 #define MAX_PACKAGE_NAME 128
 
+#define MIRRORLIST_PATH "/etc/pacman.d/mirrorlist"
+#define MAX_MIRRORS 64
+#define MIRROR_RANK_BUDGET_MS 4000
+#define MIRROR_SAMPLE_BYTES (256 * 1024)
+#define MIRROR_LOOKUP_POLL_MS 10
+
+#define MAX_IMAGE_CHUNKS 32
+
+#define PART_ALIGN_BYTES (1ULL << 20)
+#define EFI_PART_BYTES (1ULL << 30)
+#define SWAP_MAX_BYTES (8ULL << 30)
+#define SWAP_MIN_BYTES (2ULL << 30)
+#define ZRAM_ONLY_RAM_BYTES (16ULL << 30)
+#define ZRAM_ALGORITHM "zstd"
+#define SWAPFILE_PATH "/swapfile"
+#define UKI_NAME "tonarchy-linux.efi"
+#define UKI_LZ4_MIN_FREE_BYTES (256ULL << 20)
+#define BOOT_MODE_PATH "/mnt/etc/tonarchy-boot-mode"
+#define INITRAMFS_HOOK_DIR "/mnt/etc/pacman.d/hooks"
+#define INITRAMFS_HOOK_MASK INITRAMFS_HOOK_DIR "/90-mkinitcpio-install.hook"
+#define MAX_INITRAMFS_PRESETS 8
+#define MIN_ROOT_BYTES (8ULL << 30)
+#define MAX_ALIGN_BYTES (64ULL << 20)
+#define EXT4_BLOCK_SIZE 4096
+#define MAX_FORMAT_JOBS 4
+#define MAX_DISKS 64
+#define MAX_ID_ENTRIES 256
+#define GPT_ENTRY_COUNT 128
+#define GPT_ENTRY_SIZE 128
+#define MBR_MAX_SECTORS 0xFFFFFFFFULL
+
+#define SCREEN_MAX_ROWS 128
+#define SCREEN_MAX_COLS 256
+#define SCREEN_SKIP_MAX 4
+
+#define ZONEINFO_DIR "/usr/share/zoneinfo"
+#define KEYMAPS_DIR "/usr/share/kbd/keymaps"
+#define FUZZY_MAX_ITEMS 1024
+#define FUZZY_NAME_MAX 64
+#define FUZZY_QUERY_MAX 64
+
+#define PROGRESS_ROW 14
+#define PROGRESS_REDRAW_MS 250
+#define PROGRESS_SAMPLE_MS 1000
+#define PROGRESS_STALL_MS 60000
+
+#define PREFETCH_DIR "/tmp/tonarchy-prefetch"
+#define PREFETCH_MIN_FREE_BYTES (3ULL * 1024 * 1024 * 1024)
+
+typedef struct {
+    char names[FUZZY_MAX_ITEMS][FUZZY_NAME_MAX];
+    int count;
+    int loaded;
+} Fuzzy_Index;
+
+typedef struct {
+    int item;
+    int score;
+} Fuzzy_Match;
+
+typedef struct {
+    const char *phase;
+    const char *cache_dir;
+    const char *target;
+    char current[128];
+    int item;
+    int items;
+    unsigned long long cache_start;
+    unsigned long long cache_bytes;
+    unsigned long long target_start;
+    unsigned long long target_used;
+    double download_rate;
+    double write_rate;
+    struct timespec started;
+    struct timespec last_activity;
+    struct timespec last_sample;
+    struct timespec last_draw;
+} Progress_Pane;
+
 static const Package_Group PACKAGE_GROUPS[] = {
     {
         "base",
@@ -57,7 +209,7 @@ static const Package_Group PACKAGE_GROUPS[] = {
     {
         "de_oxwm",
         "xorg-xset libx11 libxft libxinerama freetype2 fontconfig pkg-config "
-        "lua firefox alacritty vlc evince eog zig ttf-iosevka-nerd "
+        "lua firefox alacritty vlc evince eog ttf-iosevka-nerd "
         "ttf-jetbrains-mono-nerd picom xclip xwallpaper maim rofi pulseaudio "
         "pulseaudio-alsa pavucontrol alsa-utils fastfetch ripgrep fd pcmanfm "
         "lxappearance papirus-icon-theme gnome-themes-extra"
@@ -76,9 +228,104 @@ static const Package_Group PACKAGE_GROUPS[] = {
     }
 };
 
+typedef enum {
+    PART_EFI,
+    PART_SWAP,
+    PART_ROOT
+} Part_Role;
+
+typedef struct {
+    int number;
+    Part_Role role;
+    uint64_t start;
+    uint64_t size;
+    char name[16];
+    char path[64];
+} Partition;
+
+typedef struct {
+    uint32_t logical_block;
+    uint32_t physical_block;
+    uint32_t minimum_io;
+    uint32_t optimal_io;
+    uint64_t alignment;
+} Disk_Topology;
+
+typedef enum {
+    DEVICE_HDD,
+    DEVICE_SSD,
+    DEVICE_NVME
+} Device_Class;
+
+typedef enum {
+    FS_EXT4,
+    FS_BTRFS,
+    FS_XFS,
+    FS_F2FS
+} Fs_Type;
+
+typedef enum {
+    SWAP_ZRAM,
+    SWAP_ZSWAP_FILE,
+    SWAP_PARTITION
+} Swap_Mode;
+
+typedef struct {
+    Swap_Mode mode;
+    uint64_t ram_bytes;
+    uint64_t size_bytes;
+} Swap_Plan;
+
+typedef struct {
+    char disk[64];
+    int uefi;
+    Fs_Type fs;
+    Swap_Plan swap;
+    uint64_t disk_bytes;
+    uint32_t sector_size;
+    Disk_Topology topo;
+    Device_Class device_class;
+    char transport[16];
+    int count;
+    Partition parts[4];
+} Disk_Layout;
+
+typedef struct {
+    int level;
+    const char *name;
+    const char **groups;
+    size_t group_count;
+} Install_Profile;
+
+static const char *BEGINNER_GROUPS[] = { "base", "display_xorg", "de_xfce" };
+static const char *OXIDIZED_GROUPS[] = { "base", "display_xorg", "de_oxwm" };
+static const char *ELECTRIFIED_GROUPS[] = {
+    "base",
+    "display_xorg",
+    "de_xfce",
+    "ham_core",
+    "ham_audio_serial_tools",
+    "ham_sdr"
+};
+
+static const Install_Profile INSTALL_PROFILES[] = {
+    { BEGINNER,    "beginner_xfce", BEGINNER_GROUPS,    ARRAY_LEN(BEGINNER_GROUPS) },
+    { OXIDIZED,    "oxidized_oxwm", OXIDIZED_GROUPS,    ARRAY_LEN(OXIDIZED_GROUPS) },
+    { ELECTRIFIED, "electrified",   ELECTRIFIED_GROUPS, ARRAY_LEN(ELECTRIFIED_GROUPS) }
+};
+
 static int install_packages_impl(const char *package_list);
-static int configure_xfce(const char *username);
-static int configure_oxwm(const char *username);
+static int check_internet_connection(void);
+static int validate_alphanumeric(const char *s);
+
+static const Install_Profile *find_install_profile(int level) {
+    for (size_t i = 0; i < ARRAY_LEN(INSTALL_PROFILES); i++) {
+        if (INSTALL_PROFILES[i].level == level) {
+            return &INSTALL_PROFILES[i];
+        }
+    }
+    return NULL;
+}
 
 static const char *find_group_packages(const char *group_name) {
     for (size_t i = 0; i < ARRAY_LEN(PACKAGE_GROUPS); i++) {
@@ -212,7 +459,7 @@ static int validate_mode_profile_packages(int level, const char *resolved_packag
     }
 
     if (level == OXIDIZED) {
-        const char *required[] = { "zig", "lua", "libx11" };
+        const char *required[] = { "lua", "libx11", "libxft" };
         for (size_t i = 0; i < ARRAY_LEN(required); i++) {
             if (!package_list_contains(resolved_packages, required[i])) {
                 LOG_ERROR("Oxidized profile missing required package: %s", required[i]);
@@ -237,48 +484,82 @@ static int validate_mode_profile_packages(int level, const char *resolved_packag
     return 0;
 }
 
-static int install_profile_packages(
-        const char *profile_name,
-        int level,
-        const char **selected_groups,
-        size_t selected_group_count
-    ) {
-    char resolved_packages[MAX_CMD_SIZE];
-    CHECK_OR_FAIL(
-        resolve_profile_packages(
-            profile_name,
-            selected_groups,
-            selected_group_count,
-            resolved_packages,
-            sizeof(resolved_packages)
-        ),
-        "Failed to resolve package profile"
-    );
-
-    CHECK_OR_FAIL(
-        validate_mode_profile_packages(level, resolved_packages),
-        "Package profile validation failed"
-    );
+static int is_uefi_system(void) {
+    struct stat st;
+    return stat("/sys/firmware/efi", &st) == 0;
+}
 
-    LOG_INFO("Installing profile '%s' via pacstrap", profile_name);
-    LOG_INFO("Profile groups count: %zu", selected_group_count);
-    return install_packages_impl(resolved_packages);
+static int offline_repo_available(void) {
+    struct stat st;
+    return stat(OFFLINE_REPO_DIR "/" OFFLINE_REPO_NAME ".db", &st) == 0;
 }
 
-static int configure_desktop_for_mode(int level, const char *username) {
-    if (level == OXIDIZED) {
-        return configure_oxwm(username);
+static int offline_repo_covers(const char *profile_name) {
+    if (!offline_repo_available()) {
+        return 0;
     }
-    if (level == BEGINNER || level == ELECTRIFIED) {
-        return configure_xfce(username);
+
+    FILE *fp = fopen(OFFLINE_REPO_DIR "/profiles", "r");
+    if (!fp) {
+        return 0;
     }
-    LOG_ERROR("No desktop configuration handler for mode: %d", level);
-    return 0;
+
+    int found = 0;
+    char line[256];
+    while (!found && fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        found = strcmp(line, profile_name) == 0;
+    }
+    fclose(fp);
+    return found;
 }
 
-static int is_uefi_system(void) {
+static int prepare_offline_repo(void) {
+    FILE *fp = fopen(OFFLINE_PACMAN_CONF, "w");
+    if (!fp) {
+        LOG_ERROR("Failed to write %s", OFFLINE_PACMAN_CONF);
+        return 0;
+    }
+
+    fprintf(fp,
+        "[options]\n"
+        "Architecture = auto\n"
+        "CheckSpace\n"
+        "SigLevel = Required DatabaseOptional\n"
+        "LocalFileSigLevel = Optional\n"
+        "\n"
+        "[%s]\n"
+        "Server = file://%s\n",
+        OFFLINE_REPO_NAME, OFFLINE_REPO_DIR);
+    fclose(fp);
+
     struct stat st;
-    return stat("/sys/firmware/efi", &st) == 0;
+    if (stat(OFFLINE_REPO_DIR "/" OFFLINE_REPO_NAME ".key", &st) == 0) {
+        char keyid[128] = "";
+        FILE *kf = fopen(OFFLINE_REPO_DIR "/" OFFLINE_REPO_NAME ".keyid", "r");
+        if (kf) {
+            if (fgets(keyid, sizeof(keyid), kf) != NULL) {
+                keyid[strcspn(keyid, "\n")] = '\0';
+            }
+            fclose(kf);
+        }
+
+        if (!validate_alphanumeric(keyid) || keyid[0] == '\0') {
+            LOG_ERROR("Offline repo signing key id is missing or invalid");
+            return 0;
+        }
+
+        if (!run_cmd("pacman-key", "--add", OFFLINE_REPO_DIR "/" OFFLINE_REPO_NAME ".key", NULL) ||
+            !run_cmd("pacman-key", "--lsign-key", keyid, NULL)) {
+            LOG_ERROR("Failed to trust offline repo signing key %s", keyid);
+            return 0;
+        }
+        LOG_INFO("Trusted offline repo signing key %s", keyid);
+    }
+
+    offline_repo_active = 1;
+    LOG_INFO("Using offline package repository at %s", OFFLINE_REPO_DIR);
+    return 1;
 }
 
 void logger_init(const char *log_path) {
@@ -299,1344 +580,5504 @@ void logger_close(void) {
     }
 }
 
+static void log_write(const char *data, size_t len) {
+    if (thread_log) {
+        if (thread_log->len + len > thread_log->cap) {
+            size_t cap = thread_log->cap ? thread_log->cap : 4096;
+            while (cap < thread_log->len + len) cap *= 2;
+            char *grown = realloc(thread_log->data, cap);
+            if (!grown) return;
+            thread_log->data = grown;
+            thread_log->cap = cap;
+        }
+        memcpy(thread_log->data + thread_log->len, data, len);
+        thread_log->len += len;
+        return;
+    }
+
+    if (log_file) {
+        fwrite(data, 1, len, log_file);
+        fflush(log_file);
+    }
+}
+
 void log_msg(Log_Level level, const char *fmt, ...) {
     if (!log_file) return;
 
     time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-
-    fprintf(
-        log_file,
-        "[%02d:%02d:%02d] [%s] ",
-        t->tm_hour,
-        t->tm_min,
-        t->tm_sec,
-        level_strings[level]
-    );
+    struct tm t;
+    localtime_r(&now, &t);
+
+    char line[MAX_CMD_SIZE + 64];
+    int len = snprintf(line, sizeof(line), "[%02d:%02d:%02d] [%s] ",
+                       t.tm_hour, t.tm_min, t.tm_sec, level_strings[level]);
 
     va_list args;
     va_start(args, fmt);
-    vfprintf(log_file, fmt, args);
+    vsnprintf(line + len, sizeof(line) - len - 1, fmt, args);
     va_end(args);
 
-    fprintf(log_file, "\n");
-    fflush(log_file);
+    size_t total = strlen(line);
+    line[total++] = '\n';
+    log_write(line, total);
 }
 
-int write_file(const char *path, const char *content) {
-    LOG_INFO("Writing file: %s", path);
-    FILE *fp = fopen(path, "w");
-    if (!fp) {
-        LOG_ERROR("Failed to open file for writing: %s", path);
-        return 0;
-    }
+static double elapsed_ms(const struct timespec *from, const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) * 1000.0 +
+           (double)(to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
 
-    if (fprintf(fp, "%s", content) < 0) {
-        LOG_ERROR("Failed to write to file: %s", path);
-        fclose(fp);
-        return 0;
+static void exec_describe(char *const argv[], char *out, size_t size) {
+    size_t used = 0;
+    out[0] = '\0';
+    for (int i = 0; argv[i] && used + 1 < size; i++) {
+        int n = snprintf(out + used, size - used, "%s%s", i ? " " : "", argv[i]);
+        if (n < 0) break;
+        used += (size_t)n;
     }
-
-    fclose(fp);
-    LOG_DEBUG("Successfully wrote file: %s", path);
-    return 1;
 }
 
-int write_file_fmt(const char *path, const char *fmt, ...) {
-    char content[MAX_CMD_SIZE];
-    va_list args;
-
-    va_start(args, fmt);
-    vsnprintf(content, sizeof(content), fmt, args);
-    va_end(args);
+static void exec_log_stream(Exec_Process *proc, char *line, size_t *line_len, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n' || *line_len == EXEC_LINE_MAX - 1) {
+            char out[EXEC_LINE_MAX + 64];
+            int n = snprintf(out, sizeof(out), "  [%s] %.*s\n", proc->label, (int)*line_len, line);
+            if (n > 0) log_write(out, (size_t)n < sizeof(out) ? (size_t)n : sizeof(out) - 1);
+            if (proc->on_line) {
+                line[*line_len] = '\0';
+                proc->on_line(proc->observer, line);
+            }
+            *line_len = 0;
+            if (data[i] == '\n') continue;
+        }
+        line[(*line_len)++] = data[i];
+    }
+}
 
-    return write_file(path, content);
+static void exec_flush_lines(Exec_Process *proc) {
+    if (proc->out_len > 0) exec_log_stream(proc, proc->out_line, &proc->out_len, "\n", 1);
+    if (proc->err_len > 0) exec_log_stream(proc, proc->err_line, &proc->err_len, "\n", 1);
 }
 
-int set_file_perms(const char *path, mode_t mode, const char *owner, const char *group) {
-    LOG_INFO("Setting permissions for %s: mode=%o owner=%s group=%s", path, mode, owner, group);
+int exec_start(char *const argv[], const Exec_Options *opts, Exec_Process *proc) {
+    static const Exec_Options defaults = {0};
+    if (!opts) opts = &defaults;
 
-    if (chmod(path, mode) != 0) {
-        LOG_ERROR("Failed to chmod %s", path);
+    memset(proc, 0, sizeof(*proc));
+    proc->pid = -1;
+    proc->out_fd = proc->err_fd = proc->in_fd = -1;
+    if (atomic_load(&steps_cancelled) && thread_log) {
+        LOG_WARN("Skipping %s, install step cancelled", argv[0]);
         return 0;
     }
-
-    char chown_cmd[512];
-    if (strncmp(path, CHROOT_PATH, strlen(CHROOT_PATH)) == 0) {
-        const char *chroot_path = path + strlen(CHROOT_PATH);
-        snprintf(chown_cmd, sizeof(chown_cmd),
-            "arch-chroot %s chown %s:%s %s 2>> /tmp/tonarchy-install.log",
-            CHROOT_PATH, owner, group, chroot_path);
+    proc->capture = opts->capture;
+    proc->capture_size = opts->capture_size;
+    proc->input = opts->input;
+    proc->input_len = opts->input ? strlen(opts->input) : 0;
+    proc->timeout_ms = opts->timeout_ms;
+    proc->quiet = opts->quiet;
+    proc->on_line = opts->on_line;
+    proc->on_tick = opts->on_tick;
+    proc->observer = opts->observer;
+    snprintf(proc->label, sizeof(proc->label), "%s", argv[0]);
+    if (opts->log_name) {
+        snprintf(proc->command, sizeof(proc->command), "%s", opts->log_name);
     } else {
-        snprintf(chown_cmd, sizeof(chown_cmd), "chown %s:%s %s", owner, group, path);
+        exec_describe(argv, proc->command, sizeof(proc->command));
+    }
+    if (proc->capture && proc->capture_size > 0) {
+        proc->capture[0] = '\0';
     }
 
-    if (system(chown_cmd) != 0) {
-        LOG_ERROR("Failed to chown %s", path);
+    int out_pipe[2] = {-1, -1}, err_pipe[2] = {-1, -1}, in_pipe[2] = {-1, -1};
+    int detached = opts->detached;
+    pthread_mutex_lock(&exec_spawn_lock);
+    if ((!detached && !opts->stdout_path && pipe(out_pipe) != 0) ||
+        (!detached && pipe(err_pipe) != 0) ||
+        (proc->input_len > 0 && pipe(in_pipe) != 0)) {
+        pthread_mutex_unlock(&exec_spawn_lock);
+        LOG_ERROR("Failed to create pipes for %s", proc->command);
         return 0;
     }
 
-    return 1;
-}
-
-int create_directory(const char *path, mode_t mode) {
-    LOG_INFO("Creating directory: %s", path);
-    char cmd[512];
-    snprintf(cmd, sizeof(cmd), "mkdir -p %s", path);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (in_pipe[0] >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, in_pipe[0], STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, in_pipe[0]);
+        posix_spawn_file_actions_addclose(&actions, in_pipe[1]);
+    } else {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    }
+    if (detached) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, EXEC_LOG_PATH, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    } else {
+        if (opts->stdout_path) {
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, opts->stdout_path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        } else {
+            posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+            posix_spawn_file_actions_addclose(&actions, out_pipe[0]);
+            posix_spawn_file_actions_addclose(&actions, out_pipe[1]);
+        }
+        posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+        posix_spawn_file_actions_addclose(&actions, err_pipe[0]);
+        posix_spawn_file_actions_addclose(&actions, err_pipe[1]);
+    }
 
-    if (system(cmd) != 0) {
-        LOG_ERROR("Failed to create directory: %s", path);
+    posix_spawnattr_t attr;
+    sigset_t defaults_set;
+    posix_spawnattr_init(&attr);
+    sigemptyset(&defaults_set);
+    sigaddset(&defaults_set, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &defaults_set);
+    if (detached) {
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | (detached ? POSIX_SPAWN_SETPGROUP : 0));
+
+    clock_gettime(CLOCK_MONOTONIC, &proc->started);
+    int err = posix_spawnp(&proc->pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (out_pipe[1] >= 0) close(out_pipe[1]);
+    if (err_pipe[1] >= 0) close(err_pipe[1]);
+    if (in_pipe[0] >= 0) close(in_pipe[0]);
+    if (out_pipe[0] >= 0) fcntl(out_pipe[0], F_SETFD, FD_CLOEXEC);
+    if (err_pipe[0] >= 0) fcntl(err_pipe[0], F_SETFD, FD_CLOEXEC);
+    if (in_pipe[1] >= 0) fcntl(in_pipe[1], F_SETFD, FD_CLOEXEC);
+    pthread_mutex_unlock(&exec_spawn_lock);
+
+    if (err != 0) {
+        LOG_ERROR("Failed to spawn %s: %s", proc->command, strerror(err));
+        if (out_pipe[0] >= 0) close(out_pipe[0]);
+        if (err_pipe[0] >= 0) close(err_pipe[0]);
+        if (in_pipe[1] >= 0) close(in_pipe[1]);
+        proc->pid = -1;
         return 0;
     }
 
-    if (chmod(path, mode) != 0) {
-        LOG_WARN("Failed to set permissions on directory: %s", path);
-    }
+    proc->out_fd = out_pipe[0];
+    proc->err_fd = err_pipe[0];
+    proc->in_fd = in_pipe[1];
 
+    LOG_DEBUG("Spawned %s (pid %d)", proc->command, (int)proc->pid);
     return 1;
 }
 
-int chroot_exec(const char *cmd) {
-    char full_cmd[MAX_CMD_SIZE];
-    snprintf(full_cmd, sizeof(full_cmd),
-        "arch-chroot %s /bin/bash -c '%s' >> /tmp/tonarchy-install.log 2>&1",
-        CHROOT_PATH, cmd);
+static void exec_read_fd(Exec_Process *proc, int *fd, int is_stdout) {
+    char buf[4096];
+    ssize_t n = read(*fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) return;
+    if (n <= 0) {
+        close(*fd);
+        *fd = -1;
+        return;
+    }
 
-    LOG_INFO("Executing in chroot: %s", cmd);
-    LOG_DEBUG("Full command: %s", full_cmd);
+    if (is_stdout && proc->capture) {
+        size_t room = proc->capture_size > proc->capture_len ? proc->capture_size - proc->capture_len - 1 : 0;
+        size_t copy = (size_t)n < room ? (size_t)n : room;
+        memcpy(proc->capture + proc->capture_len, buf, copy);
+        proc->capture_len += copy;
+        proc->capture[proc->capture_len] = '\0';
+    } else if (is_stdout) {
+        exec_log_stream(proc, proc->out_line, &proc->out_len, buf, (size_t)n);
+    } else {
+        exec_log_stream(proc, proc->err_line, &proc->err_len, buf, (size_t)n);
+    }
+}
 
-    int result = system(full_cmd);
-    if (result != 0) {
-        LOG_ERROR("Chroot command failed (exit %d): %s", result, cmd);
-        return 0;
+static void exec_check_timeout(Exec_Process *proc, const struct timespec *now) {
+    if (proc->pid <= 0) return;
+
+    double ms = elapsed_ms(&proc->started, now);
+    if (!proc->timed_out) {
+        int cancelled = thread_log && atomic_load(&steps_cancelled);
+        if (cancelled || (proc->timeout_ms > 0 && ms > proc->timeout_ms)) {
+            LOG_WARN("%s %s, terminating", proc->command,
+                     cancelled ? "cancelled" : "timed out");
+            kill(proc->pid, SIGTERM);
+            proc->timed_out = 1;
+            proc->kill_at_ms = ms + EXEC_KILL_GRACE_MS;
+        }
+    } else if (proc->timed_out == 1 && ms > proc->kill_at_ms) {
+        kill(proc->pid, SIGKILL);
+        proc->timed_out = 2;
     }
+}
 
-    LOG_DEBUG("Chroot command succeeded: %s", cmd);
-    return 1;
+static int exec_io_done(const Exec_Process *proc) {
+    return proc->out_fd < 0 && proc->err_fd < 0;
 }
 
-int chroot_exec_fmt(const char *fmt, ...) {
-    char cmd[MAX_CMD_SIZE];
-    va_list args;
+static void exec_pump(Exec_Process *procs, int count, int wait_ms) {
+    struct pollfd fds[EXEC_MAX_PARALLEL * 3];
+    Exec_Process *owners[EXEC_MAX_PARALLEL * 3];
+    int kinds[EXEC_MAX_PARALLEL * 3];
+    int nfds = 0;
+
+    for (int i = 0; i < count && i < EXEC_MAX_PARALLEL; i++) {
+        Exec_Process *p = &procs[i];
+        if (p->pid <= 0) continue;
+        if (p->out_fd >= 0) { fds[nfds] = (struct pollfd){ .fd = p->out_fd, .events = POLLIN }; owners[nfds] = p; kinds[nfds++] = 1; }
+        if (p->err_fd >= 0) { fds[nfds] = (struct pollfd){ .fd = p->err_fd, .events = POLLIN }; owners[nfds] = p; kinds[nfds++] = 2; }
+        if (p->in_fd >= 0) { fds[nfds] = (struct pollfd){ .fd = p->in_fd, .events = POLLOUT }; owners[nfds] = p; kinds[nfds++] = 0; }
+    }
 
-    va_start(args, fmt);
-    vsnprintf(cmd, sizeof(cmd), fmt, args);
-    va_end(args);
+    if (nfds == 0) {
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = EXEC_REAP_POLL_NS };
+        nanosleep(&ts, NULL);
+    } else if (poll(fds, (nfds_t)nfds, wait_ms) > 0) {
+        for (int i = 0; i < nfds; i++) {
+            if (!fds[i].revents) continue;
+            Exec_Process *p = owners[i];
+            if (kinds[i] == 0) {
+                ssize_t n = write(p->in_fd, p->input + p->input_off, p->input_len - p->input_off);
+                if (n > 0) p->input_off += (size_t)n;
+                if ((n < 0 && errno != EINTR && errno != EAGAIN) || p->input_off >= p->input_len) {
+                    close(p->in_fd);
+                    p->in_fd = -1;
+                }
+            } else {
+                exec_read_fd(p, kinds[i] == 1 ? &p->out_fd : &p->err_fd, kinds[i] == 1);
+            }
+        }
+    }
 
-    return chroot_exec(cmd);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = 0; i < count; i++) {
+        exec_check_timeout(&procs[i], &now);
+        if (procs[i].pid > 0 && procs[i].on_tick) {
+            procs[i].on_tick(procs[i].observer);
+        }
+    }
 }
 
-int chroot_exec_as_user(const char *username, const char *cmd) {
-    char full_cmd[MAX_CMD_SIZE * 2];
-    snprintf(full_cmd, sizeof(full_cmd), "sudo -u %s %s", username, cmd);
-    return chroot_exec(full_cmd);
-}
+static int exec_reap(Exec_Process *proc, Exec_Result *res) {
+    int status = 0;
+    struct rusage usage;
+    pid_t pid = wait4(proc->pid, &status, WNOHANG, &usage);
+    if (pid == 0) {
+        return 0;
+    }
 
-int chroot_exec_as_user_fmt(const char *username, const char *fmt, ...) {
-    char cmd[MAX_CMD_SIZE];
-    va_list args;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (proc->in_fd >= 0) {
+        close(proc->in_fd);
+        proc->in_fd = -1;
+    }
+    exec_flush_lines(proc);
 
-    va_start(args, fmt);
-    vsnprintf(cmd, sizeof(cmd), fmt, args);
-    va_end(args);
+    Exec_Result result = {0};
+    result.wall_ms = elapsed_ms(&proc->started, &now);
+    result.timed_out = proc->timed_out != 0;
+    if (pid < 0) {
+        result.status = -1;
+    } else {
+        result.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        result.cpu_ms = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+                        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+    }
+    proc->pid = -1;
 
-    return chroot_exec_as_user(username, cmd);
-}
+    if (result.status == 0) {
+        LOG_INFO("Ran %s (wall %.2fs, cpu %.2fs)", proc->command, result.wall_ms / 1000.0, result.cpu_ms / 1000.0);
+    } else if (proc->quiet) {
+        LOG_DEBUG("%s exited %d (wall %.2fs, cpu %.2fs)", proc->command, result.status,
+                  result.wall_ms / 1000.0, result.cpu_ms / 1000.0);
+    } else {
+        LOG_ERROR("%s %s %d (wall %.2fs, cpu %.2fs)", proc->command,
+                  result.timed_out ? "timed out, status" : "failed with exit", result.status,
+                  result.wall_ms / 1000.0, result.cpu_ms / 1000.0);
+    }
 
-int git_clone_as_user(const char *username, const char *repo_url, const char *dest_path) {
-    LOG_INFO("Cloning %s to %s as user %s", repo_url, dest_path, username);
-    return chroot_exec_as_user_fmt(username, "git clone %s %s", repo_url, dest_path);
+    if (res) *res = result;
+    return 1;
 }
 
-int make_clean_install(const char *build_dir) {
-    LOG_INFO("Building and installing from %s", build_dir);
-    return chroot_exec_fmt("cd %s && make clean install", build_dir);
+int exec_wait_any(Exec_Process *procs, int count, Exec_Result *res) {
+    for (;;) {
+        int running = 0;
+        for (int i = 0; i < count; i++) {
+            if (procs[i].pid <= 0) continue;
+            running++;
+            if (exec_io_done(&procs[i]) && exec_reap(&procs[i], res)) {
+                return i;
+            }
+        }
+        if (running == 0) {
+            return -1;
+        }
+        exec_pump(procs, count, EXEC_POLL_MS);
+    }
 }
 
-int create_user_dotfile(const char *username, const Dotfile *dotfile) {
-    char full_path[512];
-    snprintf(full_path, sizeof(full_path), "%s/home/%s/%s", CHROOT_PATH, username, dotfile->filename);
+int exec_wait(Exec_Process *proc, Exec_Result *res) {
+    return exec_wait_any(proc, 1, res) == 0;
+}
 
-    LOG_INFO("Creating dotfile %s for user %s", dotfile->filename, username);
+int exec_run(char *const argv[], const Exec_Options *opts, Exec_Result *res) {
+    Exec_Process proc;
+    Exec_Result result = { .status = -1 };
 
-    if (!write_file(full_path, dotfile->content)) {
+    if (!exec_start(argv, opts, &proc)) {
+        if (res) *res = result;
         return 0;
     }
+    exec_wait(&proc, &result);
+    if (res) *res = result;
+    return result.status == 0;
+}
 
-    if (!set_file_perms(full_path, dotfile->permissions, username, username)) {
-        return 0;
+pid_t exec_spawn_detached(char *const argv[]) {
+    Exec_Options opts = { .detached = 1 };
+    Exec_Process proc;
+    if (!exec_start(argv, &opts, &proc)) {
+        return -1;
     }
-
-    return 1;
+    return proc.pid;
 }
 
-int setup_systemd_override(const Systemd_Override *override) {
-    char dir_path[1024];
-    char file_path[2048];
+int run_cmd(const char *arg0, ...) {
+    char *argv[EXEC_MAX_ARGS];
+    int argc = 0;
+    va_list args;
 
-    snprintf(dir_path, sizeof(dir_path), "%s/etc/systemd/system/%s", CHROOT_PATH, override->drop_in_dir);
-    snprintf(file_path, sizeof(file_path), "%s/%s", dir_path, override->drop_in_file);
+    argv[argc++] = (char *)arg0;
+    va_start(args, arg0);
+    while (argc < EXEC_MAX_ARGS - 1) {
+        char *arg = va_arg(args, char *);
+        if (!arg) break;
+        argv[argc++] = arg;
+    }
+    va_end(args);
+    argv[argc] = NULL;
 
-    LOG_INFO("Setting up systemd override: %s/%s", override->drop_in_dir, override->drop_in_file);
+    return exec_run(argv, NULL, NULL);
+}
 
-    if (!create_directory(dir_path, 0755)) {
-        return 0;
-    }
+typedef enum {
+    STEP_PENDING,
+    STEP_RUNNING,
+    STEP_DONE,
+    STEP_FAILED,
+    STEP_SKIPPED,
+} Step_State;
 
-    FILE *fp = fopen(file_path, "w");
-    if (!fp) {
-        LOG_ERROR("Failed to create systemd override file: %s", file_path);
-        return 0;
+typedef struct {
+    const Step *steps;
+    int count;
+    const void *ctx;
+    int deps[STEP_MAX][STEP_MAX_DEPS];
+    int dep_count[STEP_MAX];
+    Step_State state[STEP_MAX];
+    Log_Buffer logs[STEP_MAX];
+    double wall_ms[STEP_MAX];
+    int in_use[3];
+    int running;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Step_Scheduler;
+
+static const int STEP_RESOURCE_LIMITS[] = { CHROOT_WORKERS, STEP_NETWORK_SLOTS, 1 };
+static const char *STEP_STATE_NAMES[] = { "pending", "running", "done", "failed", "skipped" };
+
+static int step_ready(const Step_Scheduler *sched, int i) {
+    if (sched->state[i] != STEP_PENDING) return 0;
+    for (int d = 0; d < sched->dep_count[i]; d++) {
+        if (sched->state[sched->deps[i][d]] != STEP_DONE) return 0;
     }
-
-    for (size_t i = 0; i < override->entry_count; i++) {
-        if (override->entries[i].value[0] == '\0') {
-            fprintf(fp, "%s\n", override->entries[i].key);
-        } else {
-            fprintf(fp, "%s=%s\n", override->entries[i].key, override->entries[i].value);
-        }
+    for (int r = 0; r < (int)ARRAY_LEN(STEP_RESOURCE_LIMITS); r++) {
+        if ((sched->steps[i].resources & (1u << r)) && sched->in_use[r] >= STEP_RESOURCE_LIMITS[r]) return 0;
     }
-
-    fclose(fp);
-    LOG_INFO("Successfully created systemd override");
     return 1;
 }
 
+static int step_next(const Step_Scheduler *sched) {
+    if (atomic_load(&steps_cancelled)) return -1;
+    for (int i = 0; i < sched->count; i++) {
+        if (step_ready(sched, i)) return i;
+    }
+    return -1;
+}
 
-static void disable_raw_mode(void) {
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
+static void step_claim(Step_Scheduler *sched, int i, int delta) {
+    for (int r = 0; r < (int)ARRAY_LEN(STEP_RESOURCE_LIMITS); r++) {
+        if (sched->steps[i].resources & (1u << r)) sched->in_use[r] += delta;
+    }
+    sched->running += delta;
 }
 
-static void enable_raw_mode(void) {
-    tcgetattr(STDIN_FILENO, &orig_termios);
-    atexit(disable_raw_mode);
+static void *step_worker(void *arg) {
+    Step_Scheduler *sched = arg;
 
-    struct termios raw = orig_termios;
-    raw.c_lflag &= ~(ECHO | ICANON);
-    raw.c_cc[VMIN] = 1;
-    raw.c_cc[VTIME] = 0;
+    pthread_mutex_lock(&sched->lock);
+    for (;;) {
+        int i = step_next(sched);
+        if (i < 0) {
+            if (sched->running == 0) break;
+            pthread_cond_wait(&sched->changed, &sched->lock);
+            continue;
+        }
 
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+        sched->state[i] = STEP_RUNNING;
+        step_claim(sched, i, 1);
+        pthread_mutex_unlock(&sched->lock);
+
+        struct timespec start, end;
+        thread_log = &sched->logs[i];
+        LOG_INFO("Step %s started", sched->steps[i].name);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int ok = sched->steps[i].run(sched->ctx);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        thread_log = NULL;
+
+        pthread_mutex_lock(&sched->lock);
+        sched->state[i] = ok ? STEP_DONE : STEP_FAILED;
+        sched->wall_ms[i] = elapsed_ms(&start, &end);
+        step_claim(sched, i, -1);
+        if (!ok) {
+            atomic_store(&steps_cancelled, 1);
+        }
+        pthread_cond_broadcast(&sched->changed);
+    }
+    pthread_cond_broadcast(&sched->changed);
+    pthread_mutex_unlock(&sched->lock);
+    return NULL;
 }
 
-static void get_terminal_size(int *rows, int *cols) {
-    struct winsize ws;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
-    *rows = ws.ws_row;
-    *cols = ws.ws_col;
-}
-
-static enum Terminal_Size get_terminal_size_category(int cols) {
-    if (cols < 45) return TERM_SMALL;
-    if (cols < 75) return TERM_MEDIUM;
-    return TERM_LARGE;
+static int step_index(const Step *steps, int count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(steps[i].name, name) == 0) return i;
+    }
+    return -1;
 }
 
-static int get_logo_width(int cols) {
-    enum Terminal_Size size = get_terminal_size_category(cols);
-    if (size == TERM_LARGE) return 70;
-    if (size == TERM_MEDIUM) return 25;
-    return 8;
+static void step_flush(Step_Scheduler *sched, int i, int *failed) {
+    if (sched->state[i] == STEP_PENDING) {
+        sched->state[i] = STEP_SKIPPED;
+    }
+    if (sched->logs[i].len > 0) {
+        log_write(sched->logs[i].data, sched->logs[i].len);
+    }
+    free(sched->logs[i].data);
+    sched->logs[i].data = NULL;
+
+    const char *name = sched->steps[i].name;
+    if (sched->state[i] == STEP_DONE) {
+        LOG_INFO("Step %s done in %.2fs", name, sched->wall_ms[i] / 1000.0);
+    } else if (sched->state[i] == STEP_FAILED) {
+        LOG_ERROR("Step %s failed after %.2fs", name, sched->wall_ms[i] / 1000.0);
+        if (failed && *failed < 0) *failed = i;
+    } else {
+        LOG_WARN("Step %s %s", name, STEP_STATE_NAMES[sched->state[i]]);
+    }
 }
 
-static int get_logo_start(int cols) {
-    int width = get_logo_width(cols);
-    int start = (cols - width) / 2;
-    return (start < 1) ? 1 : start;
-}
+int run_steps(const Step *steps, int count, const void *ctx, Step_Progress progress, int *failed) {
+    static Step_Scheduler sched;
+    if (count > STEP_MAX) {
+        LOG_ERROR("Too many install steps: %d", count);
+        return 0;
+    }
 
-static int get_menu_start_row(int cols) {
-    enum Terminal_Size size = get_terminal_size_category(cols);
-    if (size == TERM_LARGE) return 10;
-    if (size == TERM_MEDIUM) return 7;
-    return 4;
-}
+    memset(&sched, 0, sizeof(sched));
+    sched.steps = steps;
+    sched.count = count;
+    sched.ctx = ctx;
+    for (int i = 0; i < count; i++) {
+        for (int d = 0; d < STEP_MAX_DEPS && steps[i].deps[d]; d++) {
+            int dep = step_index(steps, i, steps[i].deps[d]);
+            if (dep < 0) {
+                LOG_ERROR("Step %s depends on unknown or later step %s", steps[i].name, steps[i].deps[d]);
+                return 0;
+            }
+            sched.deps[i][sched.dep_count[i]++] = dep;
+        }
+    }
+    pthread_mutex_init(&sched.lock, NULL);
+    pthread_cond_init(&sched.changed, NULL);
+    atomic_store(&steps_cancelled, 0);
+
+    struct timespec begin, now;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    pthread_t workers[STEP_MAX_WORKERS];
+    int worker_count = 0;
+    while (worker_count < STEP_MAX_WORKERS && worker_count < count &&
+           pthread_create(&workers[worker_count], NULL, step_worker, &sched) == 0) {
+        worker_count++;
+    }
+    if (worker_count == 0) {
+        step_worker(&sched);
+    }
 
-static void clear_screen(void) {
-    printf("\033[2J\033[H");
-    fflush(stdout);
-}
+    int flushed = 0;
+    if (failed) *failed = -1;
+    pthread_mutex_lock(&sched.lock);
+    for (;;) {
+        while (flushed < count && sched.state[flushed] != STEP_PENDING && sched.state[flushed] != STEP_RUNNING) {
+            int i = flushed++;
+            pthread_mutex_unlock(&sched.lock);
+            step_flush(&sched, i, failed);
+            if (progress) progress(ctx, flushed, count, &steps[i], sched.state[i] == STEP_DONE);
+            pthread_mutex_lock(&sched.lock);
+        }
+        if (flushed == count || (sched.running == 0 && step_next(&sched) < 0)) break;
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += STEP_TICK_MS / 1000;
+        if (pthread_cond_timedwait(&sched.changed, &sched.lock, &deadline) == ETIMEDOUT && progress) {
+            pthread_mutex_unlock(&sched.lock);
+            progress(ctx, flushed, count, NULL, 0);
+            pthread_mutex_lock(&sched.lock);
+        }
+    }
+    pthread_mutex_unlock(&sched.lock);
 
-static void draw_logo(int cols) {
-    const char *logo_large[] = {
-        "████████╗ ██████╗ ███╗   ██╗ █████╗ ██████╗  ██████╗██╗  ██╗██╗   ██╗",
-        "╚══██╔══╝██╔═══██╗████╗  ██║██╔══██╗██╔══██╗██╔════╝██║  ██║╚██╗ ██╔╝",
-        "   ██║   ██║   ██║██╔██╗ ██║███████║██████╔╝██║     ███████║ ╚████╔╝ ",
-        "   ██║   ██║   ██║██║╚██╗██║██╔══██║██╔══██╗██║     ██╔══██║  ╚██╔╝  ",
-        "   ██║   ╚██████╔╝██║ ╚████║██║  ██║██║  ██║╚██████╗██║  ██║   ██║   ",
-        "   ╚═╝    ╚═════╝ ╚═╝  ╚═══╝╚═╝  ╚═╝╚═╝  ╚═╝ ╚═════╝╚═╝  ╚═╝   ╚═╝   "
-    };
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    for (int i = flushed; i < count; i++) {
+        step_flush(&sched, i, failed);
+        if (progress) progress(ctx, i + 1, count, &steps[i], sched.state[i] == STEP_DONE);
+    }
 
-    const char *logo_medium[] = {
-        "╔╦╗╔═╗╔╗╔╔═╗╦═╗╔═╗╦ ╦╦ ╦",
-        " ║ ║ ║║║║╠═╣╠╦╝║  ╠═╣╚╦╝",
-        " ╩ ╚═╝╝╚╝╩ ╩╩╚═╚═╝╩ ╩ ╩ "
-    };
+    int done = 0;
+    double serial_ms = 0;
+    for (int i = 0; i < count; i++) {
+        serial_ms += sched.wall_ms[i];
+        if (sched.state[i] == STEP_DONE) done++;
+    }
 
-    const char *logo_small[] = {
-        "TONARCHY"
-    };
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    LOG_INFO("Ran %d of %d steps in %.2fs on %d workers (%.2fs if run serially)",
+             done, count, elapsed_ms(&begin, &now) / 1000.0, worker_count, serial_ms / 1000.0);
+    int ok = done == count;
+    atomic_store(&steps_cancelled, 0);
+    pthread_cond_destroy(&sched.changed);
+    pthread_mutex_destroy(&sched.lock);
+    return ok;
+}
 
-    enum Terminal_Size size = get_terminal_size_category(cols);
-    const char **logo;
-    int logo_height;
-    int logo_width;
+int write_file(const char *path, const char *content) {
+    LOG_INFO("Writing file: %s", path);
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        LOG_ERROR("Failed to open file for writing: %s", path);
+        return 0;
+    }
 
-    switch (size) {
-        case TERM_LARGE:
-            logo = logo_large;
-            logo_height = 6;
-            logo_width = 70;
-            break;
-        case TERM_MEDIUM:
-            logo = logo_medium;
-            logo_height = 3;
-            logo_width = 25;
-            break;
-        default:
-            logo = logo_small;
-            logo_height = 1;
-            logo_width = 8;
-            break;
+    if (fprintf(fp, "%s", content) < 0) {
+        LOG_ERROR("Failed to write to file: %s", path);
+        fclose(fp);
+        return 0;
     }
 
-    int logo_start = (cols - logo_width) / 2;
-    if (logo_start < 1) logo_start = 1;
+    fclose(fp);
+    LOG_DEBUG("Successfully wrote file: %s", path);
+    return 1;
+}
 
-    printf("\033[1;32m");
-    for (int i = 0; i < logo_height; i++) {
-        printf("\033[%d;%dH%s", i + 2, logo_start, logo[i]);
-    }
-    printf("\033[0m");
+int write_file_fmt(const char *path, const char *fmt, ...) {
+    char content[MAX_CMD_SIZE];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(content, sizeof(content), fmt, args);
+    va_end(args);
+
+    return write_file(path, content);
 }
 
-static int draw_menu(const char **items, int count, int selected) {
-    int rows, cols;
-    get_terminal_size(&rows, &cols);
+typedef struct {
+    char name[64];
+    unsigned int id;
+} Id_Entry;
 
-    clear_screen();
-    draw_logo(cols);
+typedef struct {
+    const char *path;
+    Id_Entry entries[MAX_ID_ENTRIES];
+    int count;
+    int loaded;
+} Id_Table;
 
-    int logo_start = get_logo_start(cols);
-    int menu_start_row = get_menu_start_row(cols);
+static Id_Table target_users = { .path = CHROOT_PATH "/etc/passwd" };
+static Id_Table target_groups = { .path = CHROOT_PATH "/etc/group" };
+static pthread_mutex_t id_tables_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    for (int i = 0; i < count; i++) {
-        printf("\033[%d;%dH", menu_start_row + i, logo_start + 2);
-        if (i == selected) {
-            printf("\033[1;34m> %s\033[0m", items[i]);
-        } else {
-            printf("\033[37m  %s\033[0m", items[i]);
-        }
-    }
+static void load_id_table(Id_Table *table) {
+    table->count = 0;
+    table->loaded = 1;
 
-    printf("\033[%d;%dH", menu_start_row + count + 2, logo_start);
-    printf("\033[33mj/k Navigate  Enter Select\033[0m");
+    FILE *fp = fopen(table->path, "r");
+    if (!fp) {
+        LOG_WARN("Failed to open %s", table->path);
+        return;
+    }
 
-    fflush(stdout);
-    return 0;
-}
+    char line[1024];
+    while (fgets(line, sizeof(line), fp) && table->count < MAX_ID_ENTRIES) {
+        char *name_end = strchr(line, ':');
+        char *id = name_end ? strchr(name_end + 1, ':') : NULL;
+        if (!id) continue;
+        *name_end = '\0';
 
-static int select_from_menu(const char **items, int count) {
-    int selected = 0;
+        char *end;
+        unsigned long value = strtoul(++id, &end, 10);
+        if (end == id || *end != ':') continue;
 
-    enable_raw_mode();
-    draw_menu(items, count, selected);
+        Id_Entry *entry = &table->entries[table->count++];
+        snprintf(entry->name, sizeof(entry->name), "%s", line);
+        entry->id = (unsigned int)value;
+    }
+    fclose(fp);
+    LOG_DEBUG("Loaded %d entries from %s", table->count, table->path);
+}
 
-    char c;
-    while (read(STDIN_FILENO, &c, 1) == 1) {
-        if (c == 'q' || c == 27) {
-            disable_raw_mode();
-            return -1;
-        }
+static int lookup_id(Id_Table *table, const char *name, unsigned int *id) {
+    int reloaded = !table->loaded;
+    if (!table->loaded) {
+        load_id_table(table);
+    }
 
-        if (c == 'j' || c == 66) {
-            if (selected < count - 1) {
-                selected++;
-                draw_menu(items, count, selected);
+    for (;;) {
+        for (int i = 0; i < table->count; i++) {
+            if (strcmp(table->entries[i].name, name) == 0) {
+                *id = table->entries[i].id;
+                return 1;
             }
         }
+        if (reloaded) break;
+        load_id_table(table);
+        reloaded = 1;
+    }
 
-        if (c == 'k' || c == 65) {
-            if (selected > 0) {
-                selected--;
-                draw_menu(items, count, selected);
-            }
-        }
+    char *end;
+    unsigned long value = strtoul(name, &end, 10);
+    if (*name && *end == '\0') {
+        *id = (unsigned int)value;
+        return 1;
+    }
+    return 0;
+}
 
-        if (c == '\r' || c == '\n') {
-            disable_raw_mode();
-            return selected;
+static int in_target_root(const char *path) {
+    size_t len = strlen(CHROOT_PATH);
+    return strncmp(path, CHROOT_PATH, len) == 0 && (path[len] == '/' || path[len] == '\0');
+}
+
+static int resolve_owner(const char *path, const char *owner, const char *group, uid_t *uid, gid_t *gid) {
+    if (in_target_root(path)) {
+        unsigned int u, g;
+        pthread_mutex_lock(&id_tables_lock);
+        int found = lookup_id(&target_users, owner, &u) && lookup_id(&target_groups, group, &g);
+        pthread_mutex_unlock(&id_tables_lock);
+        if (!found) {
+            return 0;
         }
+        *uid = (uid_t)u;
+        *gid = (gid_t)g;
+        return 1;
     }
 
-    disable_raw_mode();
-    return -1;
+    struct passwd *pw = getpwnam(owner);
+    struct group *gr = getgrnam(group);
+    if (!pw || !gr) {
+        return 0;
+    }
+    *uid = pw->pw_uid;
+    *gid = gr->gr_gid;
+    return 1;
 }
 
-void show_message(const char *message) {
-    int rows, cols;
-    get_terminal_size(&rows, &cols);
+int set_file_perms(const char *path, mode_t mode, const char *owner, const char *group) {
+    LOG_INFO("Setting permissions for %s: mode=%o owner=%s group=%s", path, mode, owner, group);
 
-    clear_screen();
-    draw_logo(cols);
+    uid_t uid;
+    gid_t gid;
+    if (!resolve_owner(path, owner, group, &uid, &gid)) {
+        LOG_ERROR("Unknown owner %s:%s for %s", owner, group, path);
+        return 0;
+    }
 
-    int logo_start = get_logo_start(cols);
-    int msg_row = get_menu_start_row(cols);
+    if (fchmodat(AT_FDCWD, path, mode, 0) != 0) {
+        LOG_ERROR("Failed to chmod %s: %s", path, strerror(errno));
+        return 0;
+    }
 
-    printf("\033[%d;%dH", msg_row, logo_start);
-    printf("\033[37m%s\033[0m", message);
-    fflush(stdout);
+    if (fchownat(AT_FDCWD, path, uid, gid, 0) != 0) {
+        LOG_ERROR("Failed to chown %s: %s", path, strerror(errno));
+        return 0;
+    }
 
-    sleep(2);
+    return 1;
 }
 
-static int check_internet_connection(void) {
-    int result = system("ping -c 1 -W 2 1.1.1.1 > /dev/null 2>&1");
-    return result == 0;
+static _Thread_local uid_t tree_uid;
+static _Thread_local gid_t tree_gid;
+static _Thread_local int tree_entries;
+static _Thread_local int tree_failures;
+
+static int chown_tree_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    if (fchownat(AT_FDCWD, path, tree_uid, tree_gid, AT_SYMLINK_NOFOLLOW) != 0) {
+        LOG_WARN("Failed to chown %s: %s", path, strerror(errno));
+        tree_failures++;
+    }
+    tree_entries++;
+    return 0;
 }
 
-static int list_wifi_networks(char networks[][256], char ssids[][128], int max_networks) {
-    FILE *fp = popen("nmcli -t -f SSID,SIGNAL,SECURITY device wifi list | head -20", "r");
-    if (!fp) {
+int chown_tree(const char *path, const char *owner, const char *group) {
+    if (!resolve_owner(path, owner, group, &tree_uid, &tree_gid)) {
+        LOG_ERROR("Unknown owner %s:%s for %s", owner, group, path);
         return 0;
     }
 
-    int count = 0;
-    char line[512];
-    while (count < max_networks && fgets(line, sizeof(line), fp) != NULL) {
-        line[strcspn(line, "\n")] = '\0';
-
-        char ssid[128] = "";
-        char signal[32] = "";
-        char security[64] = "";
-        char *token = strtok(line, ":");
-        if (token) snprintf(ssid, sizeof(ssid), "%s", token);
-        token = strtok(NULL, ":");
-        if (token) snprintf(signal, sizeof(signal), "%s", token);
-        token = strtok(NULL, ":");
-        if (token) snprintf(security, sizeof(security), "%s", token);
-
-        if (strlen(ssid) > 0 && strcmp(ssid, "--") != 0) {
-            snprintf(ssids[count], 128, "%s", ssid);
-            snprintf(networks[count], 255, "%s (%s%%) [%s]", ssid, signal,
-                     strlen(security) > 0 ? security : "Open");
-            count++;
-        }
+    tree_entries = 0;
+    tree_failures = 0;
+    if (nftw(path, chown_tree_entry, 32, FTW_PHYS | FTW_MOUNT) != 0) {
+        LOG_ERROR("Failed to walk %s: %s", path, strerror(errno));
+        return 0;
     }
-    pclose(fp);
-    return count;
+
+    LOG_INFO("Set owner %s:%s on %d entries under %s", owner, group, tree_entries, path);
+    return tree_failures == 0;
 }
 
-static int nmcli_connect_wifi(const char *ssid, const char *password) {
-    size_t ssid_len = strlen(ssid);
-    if (ssid_len == 0 || ssid_len >= 128) {
-        LOG_ERROR("Invalid SSID length for nmcli");
-        return 0;
-    }
-    for (size_t i = 0; i < ssid_len; i++) {
-        unsigned char c = (unsigned char)ssid[i];
-        if (iscntrl(c)) {
-            LOG_ERROR("SSID contains control characters");
-            return 0;
-        }
-    }
+int create_directory(const char *path, mode_t mode) {
+    LOG_INFO("Creating directory: %s", path);
 
-    if (password) {
-        size_t pass_len = strlen(password);
-        if (pass_len >= 256) {
-            LOG_ERROR("Password too long for nmcli");
-            return 0;
-        }
-        for (size_t i = 0; i < pass_len; i++) {
-            unsigned char c = (unsigned char)password[i];
-            if (iscntrl(c)) {
-                LOG_ERROR("Password contains control characters");
-                return 0;
-            }
+    char parts[PATH_MAX];
+    snprintf(parts, sizeof(parts), "%s", path);
+
+    int dir_fd = open(path[0] == '/' ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    char *save = NULL;
+    for (char *part = strtok_r(parts, "/", &save); part && dir_fd >= 0; part = strtok_r(NULL, "/", &save)) {
+        int next = -1;
+        if (mkdirat(dir_fd, part, 0755) == 0 || errno == EEXIST) {
+            next = openat(dir_fd, part, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
         }
+        int saved_errno = errno;
+        close(dir_fd);
+        errno = saved_errno;
+        dir_fd = next;
     }
 
-    pid_t pid = fork();
-    if (pid < 0) {
-        LOG_ERROR("Failed to fork for nmcli");
+    if (dir_fd < 0) {
+        LOG_ERROR("Failed to create directory %s: %s", path, strerror(errno));
         return 0;
     }
 
-    if (pid == 0) {
-        int devnull = open("/dev/null", O_WRONLY);
-        if (devnull >= 0) {
-            dup2(devnull, STDOUT_FILENO);
-            dup2(devnull, STDERR_FILENO);
-            close(devnull);
-        }
-
-        if (password && password[0] != '\0') {
-            char *const argv[] = {
-                "nmcli", "device", "wifi", "connect", (char *)ssid, "password", (char *)password, NULL
-            };
-            execv("/usr/bin/nmcli", argv);
-        } else {
-            char *const argv[] = { "nmcli", "device", "wifi", "connect", (char *)ssid, NULL };
-            execv("/usr/bin/nmcli", argv);
-        }
-        _exit(127);
+    if (fchmod(dir_fd, mode) != 0) {
+        LOG_WARN("Failed to set permissions on directory: %s", path);
     }
+    close(dir_fd);
 
-    int status = 0;
-    if (waitpid(pid, &status, 0) < 0) {
-        LOG_ERROR("waitpid failed for nmcli");
-        return 0;
-    }
+    return 1;
+}
 
-    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 1;
 }
 
-static int connect_to_wifi(const char *ssid) {
-    int rows, cols;
-    get_terminal_size(&rows, &cols);
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
 
-    clear_screen();
-    draw_logo(cols);
+typedef struct {
+    char *source;
+    char *dest;
+    uid_t uid;
+    gid_t gid;
+    mode_t mode;
+    unsigned long long bytes;
+    int reflinked;
+    int required;
+    int ok;
+} Copy_File;
 
-    int logo_start = get_logo_start(cols);
-    printf("\033[%d;%dH\033[37mConnecting to: %s\033[0m", 10, logo_start, ssid);
-    printf("\033[%d;%dH\033[37mEnter password (leave empty if open): \033[0m", 12, logo_start);
-    fflush(stdout);
+typedef struct {
+    char source[PATH_MAX];
+    char dest[PATH_MAX];
+    Copy_File *large;
+    int large_count;
+    int large_cap;
+    atomic_int next;
+    Copy_Stats stats;
+    uid_t uid;
+    gid_t gid;
+    int required;
+} Copy_Walk;
+
+static int copy_file_data(int in, int out, unsigned long long *bytes, int *reflinked) {
+    if (ioctl(out, FICLONE, in) == 0) {
+        struct stat st;
+        *reflinked = 1;
+        *bytes = fstat(in, &st) == 0 ? (unsigned long long)st.st_size : 0;
+        return 1;
+    }
 
-    char password[256] = "";
-    struct termios old_term;
-    tcgetattr(STDIN_FILENO, &old_term);
-    struct termios new_term = old_term;
-    new_term.c_lflag &= ~ECHO;
-    new_term.c_lflag |= ICANON;
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &new_term);
+    for (;;) {
+        ssize_t n = syscall(SYS_copy_file_range, in, NULL, out, NULL, (size_t)1 << 30, 0);
+        if (n == 0) return 1;
+        if (n > 0) {
+            *bytes += (unsigned long long)n;
+            continue;
+        }
+        if (*bytes == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) break;
+        return 0;
+    }
 
-    if (fgets(password, sizeof(password), stdin) != NULL) {
-        password[strcspn(password, "\n")] = '\0';
+    const size_t buf_size = 128 * 1024;
+    char *buf = malloc(buf_size);
+    if (!buf) return 0;
+    ssize_t n;
+    while ((n = read(in, buf, buf_size)) > 0) {
+        if (!write_all(out, buf, (size_t)n)) break;
+        *bytes += (unsigned long long)n;
     }
+    free(buf);
+    return n == 0;
+}
 
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_term);
+static void copy_file(Copy_File *file) {
+    file->ok = 0;
+    int in = open(file->source, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        LOG_WARN("Failed to open %s: %s", file->source, strerror(errno));
+        return;
+    }
+    int out = open(file->dest, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) {
+        LOG_WARN("Failed to create %s: %s", file->dest, strerror(errno));
+        close(in);
+        return;
+    }
 
-    clear_screen();
-    draw_logo(cols);
-    printf("\033[%d;%dH\033[37mConnecting...\033[0m", 10, logo_start);
-    fflush(stdout);
+    file->ok = copy_file_data(in, out, &file->bytes, &file->reflinked) &&
+               fchown(out, file->uid, file->gid) == 0 &&
+               fchmod(out, file->mode) == 0;
+    if (!file->ok) {
+        LOG_WARN("Failed to copy %s to %s: %s", file->source, file->dest, strerror(errno));
+    }
+    close(out);
+    close(in);
+}
 
-    int result = nmcli_connect_wifi(ssid, password);
-    sleep(2);
+static void copy_account(Copy_Stats *stats, const Copy_File *file) {
+    if (!file->ok) {
+        stats->failures++;
+        return;
+    }
+    stats->files++;
+    stats->bytes += file->bytes;
+    stats->reflinked += file->reflinked;
+}
 
-    if (result && check_internet_connection()) {
-        show_message("Connected successfully!");
-        return 1;
-    } else {
-        show_message("Connection failed. Please try again.");
-        return 0;
+static void copy_queue(Copy_Walk *walk, Copy_File file) {
+    if (walk->large_count == walk->large_cap) {
+        int cap = walk->large_cap ? walk->large_cap * 2 : 16;
+        Copy_File *large = realloc(walk->large, (size_t)cap * sizeof(Copy_File));
+        if (!large) {
+            walk->stats.failures++;
+            return;
+        }
+        walk->large = large;
+        walk->large_cap = cap;
     }
+    file.source = strdup(file.source);
+    file.dest = strdup(file.dest);
+    if (!file.source || !file.dest) {
+        free(file.source);
+        free(file.dest);
+        walk->stats.failures++;
+        return;
+    }
+    walk->large[walk->large_count++] = file;
 }
 
-static int setup_wifi_if_needed(void) {
-    if (check_internet_connection()) {
-        return 1;
+static void copy_walk(Copy_Walk *walk) {
+    char *source = walk->source;
+    char *dest = walk->dest;
+    struct stat st;
+    if (lstat(source, &st) != 0) {
+        LOG_WARN("Failed to read %s: %s", source, strerror(errno));
+        walk->stats.failures++;
+        return;
     }
 
-    int rows, cols;
-    get_terminal_size(&rows, &cols);
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = NULL;
+        if ((mkdir(dest, 0700) != 0 && errno != EEXIST) || (dir = opendir(source)) == NULL) {
+            LOG_WARN("Failed to copy directory %s: %s", source, strerror(errno));
+            walk->stats.failures++;
+            return;
+        }
+        size_t source_len = strlen(source);
+        size_t dest_len = strlen(dest);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            if (snprintf(source + source_len, PATH_MAX - source_len, "/%s", entry->d_name) >= (int)(PATH_MAX - source_len) ||
+                snprintf(dest + dest_len, PATH_MAX - dest_len, "/%s", entry->d_name) >= (int)(PATH_MAX - dest_len)) {
+                walk->stats.failures++;
+            } else {
+                copy_walk(walk);
+            }
+            source[source_len] = '\0';
+            dest[dest_len] = '\0';
+        }
+        closedir(dir);
+        if (fchownat(AT_FDCWD, dest, walk->uid, walk->gid, AT_SYMLINK_NOFOLLOW) != 0 ||
+            fchmodat(AT_FDCWD, dest, st.st_mode & 07777, 0) != 0) {
+            walk->stats.failures++;
+        }
+        walk->stats.dirs++;
+    } else if (S_ISLNK(st.st_mode)) {
+        char target[PATH_MAX];
+        ssize_t len = readlink(source, target, sizeof(target) - 1);
+        if (len >= 0) {
+            target[len] = '\0';
+            unlink(dest);
+        }
+        if (len < 0 || symlink(target, dest) != 0 ||
+            fchownat(AT_FDCWD, dest, walk->uid, walk->gid, AT_SYMLINK_NOFOLLOW) != 0) {
+            LOG_WARN("Failed to copy symlink %s: %s", source, strerror(errno));
+            walk->stats.failures++;
+            return;
+        }
+        walk->stats.links++;
+    } else if (S_ISREG(st.st_mode)) {
+        Copy_File file = {
+            .source = source, .dest = dest, .uid = walk->uid, .gid = walk->gid,
+            .mode = st.st_mode & 07777, .required = walk->required,
+        };
+        if (st.st_size >= COPY_PARALLEL_BYTES) {
+            copy_queue(walk, file);
+            return;
+        }
+        copy_file(&file);
+        copy_account(&walk->stats, &file);
+    } else {
+        LOG_WARN("Skipping special file %s", source);
+    }
+}
 
-    clear_screen();
-    draw_logo(cols);
+static void *copy_worker(void *arg) {
+    Copy_Walk *walk = arg;
+    int i;
+    while ((i = atomic_fetch_add(&walk->next, 1)) < walk->large_count) {
+        copy_file(&walk->large[i]);
+    }
+    return NULL;
+}
 
-    int logo_start = get_logo_start(cols);
-    printf("\033[%d;%dH\033[37mNo internet connection detected.\033[0m", 10, logo_start);
-    printf("\033[%d;%dH\033[37mScanning for WiFi networks...\033[0m", 11, logo_start);
-    fflush(stdout);
+static int copy_make_parents(const char *dest, uid_t uid, gid_t gid) {
+    char parts[PATH_MAX];
+    snprintf(parts, sizeof(parts), "%s", dest);
+    char *slash = strrchr(parts, '/');
+    if (!slash || slash == parts) {
+        return 1;
+    }
+    *slash = '\0';
+
+    for (char *p = parts + 1; ; p++) {
+        if (*p != '/' && *p != '\0') continue;
+        char saved = *p;
+        *p = '\0';
+        if (mkdir(parts, 0755) == 0) {
+            if (fchownat(AT_FDCWD, parts, uid, gid, 0) != 0) return 0;
+        } else if (errno != EEXIST) {
+            return 0;
+        }
+        *p = saved;
+        if (saved == '\0') break;
+    }
+    return 1;
+}
 
-    system("nmcli radio wifi on > /dev/null 2>&1");
-    sleep(1);
+int copy_trees(const Copy_Job *jobs, int count, Copy_Stats *stats) {
+    Copy_Walk *walk = calloc(1, sizeof(Copy_Walk));
+    if (!walk) {
+        return 0;
+    }
+    int ok = 1;
 
-    char networks[32][256];
-    char ssids[32][128];
-    int network_count = list_wifi_networks(networks, ssids, 32);
+    struct timespec begin, now;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
 
-    if (network_count == 0) {
-        show_message("No WiFi networks found. Please check your connection.");
-        return 0;
+    for (int i = 0; i < count; i++) {
+        const Copy_Job *job = &jobs[i];
+        struct stat st;
+        int failures = walk->stats.failures;
+        walk->required = job->required;
+        if (!resolve_owner(job->dest, job->owner, job->owner, &walk->uid, &walk->gid)) {
+            LOG_ERROR("Unknown owner %s for %s", job->owner, job->dest);
+            walk->stats.failures++;
+        } else if (lstat(job->source, &st) != 0) {
+            LOG_WARN("Missing asset %s", job->source);
+            walk->stats.failures++;
+        } else if (!copy_make_parents(job->dest, walk->uid, walk->gid)) {
+            LOG_WARN("Failed to create parents of %s: %s", job->dest, strerror(errno));
+            walk->stats.failures++;
+        } else {
+            snprintf(walk->source, sizeof(walk->source), "%s", job->source);
+            snprintf(walk->dest, sizeof(walk->dest), "%s", job->dest);
+            copy_walk(walk);
+        }
+        if (walk->stats.failures != failures && job->required) {
+            LOG_ERROR("Failed to copy %s to %s", job->source, job->dest);
+            ok = 0;
+        }
     }
 
-    const char *network_ptrs[32];
-    for (int i = 0; i < network_count; i++) {
-        network_ptrs[i] = networks[i];
+    pthread_t workers[COPY_WORKERS];
+    int worker_count = 0;
+    while (worker_count < COPY_WORKERS && worker_count < walk->large_count - 1 &&
+           pthread_create(&workers[worker_count], NULL, copy_worker, walk) == 0) {
+        worker_count++;
+    }
+    copy_worker(walk);
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
     }
+    for (int i = 0; i < walk->large_count; i++) {
+        copy_account(&walk->stats, &walk->large[i]);
+        if (!walk->large[i].ok && walk->large[i].required) {
+            LOG_ERROR("Failed to copy %s", walk->large[i].source);
+            ok = 0;
+        }
+        free(walk->large[i].source);
+        free(walk->large[i].dest);
+    }
+    free(walk->large);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    LOG_INFO("Copied %d files (%.1f MiB, %d reflinked), %d directories and %d symlinks in %.2fs",
+             walk->stats.files, (double)walk->stats.bytes / (1024.0 * 1024.0), walk->stats.reflinked,
+             walk->stats.dirs, walk->stats.links, elapsed_ms(&begin, &now) / 1000.0);
+    if (walk->stats.failures > 0) {
+        LOG_WARN("%d entries could not be copied", walk->stats.failures);
+    }
+    if (stats) *stats = walk->stats;
+    free(walk);
+    return ok;
+}
 
-    int selected = select_from_menu(network_ptrs, network_count);
-    if (selected < 0) {
-        show_message("WiFi setup cancelled. Installation requires internet.");
+typedef struct {
+    const char *source;
+    const char *target;
+    const char *fstype;
+    unsigned long flags;
+    const char *data;
+    int optional;
+} Chroot_Mount;
+
+static const Chroot_Mount CHROOT_MOUNTS[] = {
+    { "proc",     "proc",                     "proc",     MS_NOSUID | MS_NOEXEC | MS_NODEV,             NULL,              0 },
+    { "sys",      "sys",                      "sysfs",    MS_NOSUID | MS_NOEXEC | MS_NODEV | MS_RDONLY, NULL,              0 },
+    { "efivarfs", "sys/firmware/efi/efivars", "efivarfs", MS_NOSUID | MS_NOEXEC | MS_NODEV,             NULL,              1 },
+    { "udev",     "dev",                      "devtmpfs", MS_NOSUID,                                    "mode=0755",       0 },
+    { "devpts",   "dev/pts",                  "devpts",   MS_NOSUID | MS_NOEXEC,                        "mode=0620,gid=5", 0 },
+    { "shm",      "dev/shm",                  "tmpfs",    MS_NOSUID | MS_NODEV,                         "mode=1777",       0 },
+    { "run",      "run",                      "tmpfs",    MS_NOSUID | MS_NODEV,                         "mode=0755",       0 },
+    { "tmp",      "tmp",                      "tmpfs",    MS_STRICTATIME | MS_NODEV | MS_NOSUID,        "mode=1777",       0 },
+};
+
+typedef struct {
+    pid_t pid;
+    int request_fd;
+    int reply_fd;
+    int busy;
+} Chroot_Worker;
+
+static Chroot_Worker chroot_workers[CHROOT_WORKERS];
+static int chroot_worker_count = 0;
+static pthread_mutex_t chroot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t chroot_idle = PTHREAD_COND_INITIALIZER;
+static char chroot_mounted[ARRAY_LEN(CHROOT_MOUNTS) + 1][256];
+static int chroot_mounted_count = 0;
+
+static int chroot_mount(const char *source, const char *target, const char *fstype,
+                        unsigned long flags, const char *data) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", CHROOT_PATH, target);
+    mkdir(path, 0755);
+
+    if (mount(source, path, fstype, flags, data) != 0) {
         return 0;
     }
-
-    return connect_to_wifi(ssids[selected]);
+    snprintf(chroot_mounted[chroot_mounted_count++], sizeof(chroot_mounted[0]), "%s", path);
+    return 1;
 }
 
-static void draw_form(
-        const char *username,
-        const char *password,
-        const char *confirmed_password,
-        const char *hostname,
-        const char *keyboard,
-        const char *timezone,
-        int current_field
-    ) {
-    int rows, cols;
-    get_terminal_size(&rows, &cols);
+static void chroot_unmount_all(void) {
+    while (chroot_mounted_count > 0) {
+        const char *path = chroot_mounted[--chroot_mounted_count];
+        if (umount2(path, MNT_DETACH) != 0) {
+            LOG_WARN("Failed to unmount %s: %s", path, strerror(errno));
+        }
+    }
+}
 
-    clear_screen();
-    draw_logo(cols);
+static void chroot_worker_loop(int request_fd, int reply_fd) {
+    signal(SIGPIPE, SIG_IGN);
 
-    int logo_start = get_logo_start(cols);
-    int form_row = 10;
+    for (;;) {
+        uint32_t header[2];
+        if (!read_all(request_fd, header, sizeof(header)) || header[0] == 0) {
+            _exit(0);
+        }
 
-    printf(ANSI_CURSOR_POS ANSI_WHITE "Setup your system:" ANSI_RESET, form_row, logo_start);
-    form_row += 2;
+        char *cmd = malloc(header[0] + 1);
+        char *input = malloc(header[1] + 1);
+        if (!cmd || !input ||
+            !read_all(request_fd, cmd, header[0]) ||
+            !read_all(request_fd, input, header[1])) {
+            _exit(1);
+        }
+        cmd[header[0]] = '\0';
+
+        int out_pipe[2], in_pipe[2];
+        int32_t status = -1;
+        char *output = NULL;
+        size_t out_len = 0, out_cap = 0;
+
+        if (pipe(out_pipe) == 0 && pipe(in_pipe) == 0) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                signal(SIGPIPE, SIG_DFL);
+                dup2(in_pipe[0], STDIN_FILENO);
+                dup2(out_pipe[1], STDOUT_FILENO);
+                dup2(out_pipe[1], STDERR_FILENO);
+                close(in_pipe[0]);
+                close(in_pipe[1]);
+                close(out_pipe[0]);
+                close(out_pipe[1]);
+                execl("/bin/bash", "bash", "-c", cmd, (char *)NULL);
+                _exit(127);
+            }
+            close(in_pipe[0]);
+            close(out_pipe[1]);
+
+            size_t in_off = 0;
+            int in_fd = in_pipe[1];
+            if (header[1] == 0) {
+                close(in_fd);
+                in_fd = -1;
+            }
+            int wstatus = 0;
+            int reaped = 0;
+            struct timespec reaped_at, now;
+            for (;;) {
+                if (!reaped && pid > 0 && waitpid(pid, &wstatus, WNOHANG) == pid) {
+                    reaped = 1;
+                    clock_gettime(CLOCK_MONOTONIC, &reaped_at);
+                }
+                int timeout = EXEC_POLL_MS;
+                if (reaped) {
+                    clock_gettime(CLOCK_MONOTONIC, &now);
+                    timeout = CHROOT_DRAIN_MS - (int)elapsed_ms(&reaped_at, &now);
+                    if (timeout <= 0) break;
+                }
 
-    Tui_Field fields[] = {
-        {"Username",         username,           NULL,       0},
-        {"Password",         password,           NULL,       1},
-        {"Confirm Password", confirmed_password, NULL,       1},
-        {"Hostname",         hostname,           "tonarchy", 0},
-        {"Keyboard",         keyboard,           "us",       0},
-        {"Timezone",         timezone,           NULL,       0},
-    };
-    int num_fields = (int)(ARRAY_LEN(fields));
+                struct pollfd fds[2] = {
+                    { .fd = out_pipe[0], .events = POLLIN },
+                    { .fd = in_fd, .events = POLLOUT },
+                };
+                int ready = poll(fds, in_fd >= 0 ? 2 : 1, timeout);
+                if (ready < 0) {
+                    if (errno == EINTR) continue;
+                    break;
+                }
+                if (ready == 0 && reaped) break;
+                if (in_fd >= 0 && (fds[1].revents & (POLLOUT | POLLERR | POLLHUP))) {
+                    ssize_t n = write(in_fd, input + in_off, header[1] - in_off);
+                    if (n > 0) in_off += (size_t)n;
+                    if (n < 0 || in_off == header[1]) {
+                        close(in_fd);
+                        in_fd = -1;
+                    }
+                }
+                if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+                    if (out_cap - out_len < 4096) {
+                        out_cap = out_cap ? out_cap * 2 : 16384;
+                        output = realloc(output, out_cap);
+                        if (!output) _exit(1);
+                    }
+                    ssize_t n = read(out_pipe[0], output + out_len, out_cap - out_len);
+                    if (n <= 0) break;
+                    out_len += (size_t)n;
+                }
+            }
+            if (in_fd >= 0) close(in_fd);
+            close(out_pipe[0]);
 
-    for (int i = 0; i < num_fields; i++) {
-        printf(ANSI_CURSOR_POS, form_row + i, logo_start);
+            if (pid > 0 && (reaped || waitpid(pid, &wstatus, 0) == pid)) {
+                status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+            }
+        }
 
-        if (current_field == i) {
-            printf(ANSI_BLUE_BOLD ">" ANSI_RESET " ");
-        } else {
-            printf("  ");
+        uint32_t reply_len = (uint32_t)out_len;
+        if (!write_all(reply_fd, &status, sizeof(status)) ||
+            !write_all(reply_fd, &reply_len, sizeof(reply_len)) ||
+            !write_all(reply_fd, output ? output : "", out_len)) {
+            _exit(1);
         }
+        free(output);
+        free(cmd);
+        free(input);
+    }
+}
 
-        printf(ANSI_WHITE "%s: " ANSI_RESET, fields[i].label);
+static void chroot_close_worker(Chroot_Worker *worker) {
+    if (worker->pid <= 0) {
+        return;
+    }
+    close(worker->request_fd);
+    close(worker->reply_fd);
+    waitpid(worker->pid, NULL, 0);
+    worker->pid = -1;
+    worker->request_fd = worker->reply_fd = -1;
+}
 
-        if (strlen(fields[i].value) > 0) {
-            printf(ANSI_GREEN "%s" ANSI_RESET, fields[i].is_password ? "********" : fields[i].value);
-        } else if (current_field != i) {
-            if (fields[i].default_display) {
-                printf(ANSI_GRAY "%s" ANSI_RESET, fields[i].default_display);
-            } else {
-                printf(ANSI_GRAY "[not set]" ANSI_RESET);
+void chroot_session_stop(void) {
+    pthread_mutex_lock(&chroot_lock);
+    if (chroot_worker_count > 0) {
+        uint32_t header[2] = {0, 0};
+        for (int i = 0; i < chroot_worker_count; i++) {
+            if (chroot_workers[i].pid > 0) {
+                write_all(chroot_workers[i].request_fd, header, sizeof(header));
             }
         }
+        for (int i = 0; i < chroot_worker_count; i++) {
+            chroot_close_worker(&chroot_workers[i]);
+        }
+        chroot_worker_count = 0;
+        LOG_INFO("Chroot session stopped");
     }
-
-    fflush(stdout);
+    chroot_unmount_all();
+    pthread_mutex_unlock(&chroot_lock);
 }
 
-static int validate_alphanumeric(const char *s) {
-    for (int i = 0; s[i]; i++) {
-        if (!isalnum(s[i]) && s[i] != '-' && s[i] != '_')
-            return 0;
+static int chroot_spawn_worker(Chroot_Worker *worker) {
+    int request_pipe[2], reply_pipe[2];
+    pthread_mutex_lock(&exec_spawn_lock);
+    if (pipe(request_pipe) != 0) {
+        pthread_mutex_unlock(&exec_spawn_lock);
+        return 0;
+    }
+    if (pipe(reply_pipe) != 0) {
+        close(request_pipe[0]);
+        close(request_pipe[1]);
+        pthread_mutex_unlock(&exec_spawn_lock);
+        return 0;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(request_pipe[0]);
+        close(request_pipe[1]);
+        close(reply_pipe[0]);
+        close(reply_pipe[1]);
+        pthread_mutex_unlock(&exec_spawn_lock);
+        return 0;
+    }
+    if (pid == 0) {
+        close(request_pipe[1]);
+        close(reply_pipe[0]);
+        for (int i = 0; i < CHROOT_WORKERS; i++) {
+            if (&chroot_workers[i] != worker && chroot_workers[i].pid > 0) {
+                close(chroot_workers[i].request_fd);
+                close(chroot_workers[i].reply_fd);
+            }
+        }
+        if (chroot(CHROOT_PATH) != 0 || chdir("/") != 0) {
+            _exit(1);
+        }
+        fcntl(request_pipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(reply_pipe[1], F_SETFD, FD_CLOEXEC);
+        chroot_worker_loop(request_pipe[0], reply_pipe[1]);
+        _exit(0);
     }
+
+    close(request_pipe[0]);
+    close(reply_pipe[1]);
+    fcntl(request_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(reply_pipe[0], F_SETFD, FD_CLOEXEC);
+    pthread_mutex_unlock(&exec_spawn_lock);
+    worker->pid = pid;
+    worker->request_fd = request_pipe[1];
+    worker->reply_fd = reply_pipe[0];
+    worker->busy = 0;
     return 1;
 }
 
-static int read_line(char *buf, int size, int echo) {
-    struct termios old_term;
-    tcgetattr(STDIN_FILENO, &old_term);
-    struct termios new_term = old_term;
-    if (echo)
-        new_term.c_lflag |= ECHO;
-    else
-        new_term.c_lflag &= ~ECHO;
-    new_term.c_lflag |= ICANON;
-    new_term.c_lflag &= ~ISIG;
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &new_term);
+static int chroot_session_start_locked(void) {
+    if (chroot_worker_count > 0) {
+        return 1;
+    }
 
-    int result = (fgets(buf, size, stdin) != NULL);
-    if (result)
-        buf[strcspn(buf, "\n")] = '\0';
+    for (size_t i = 0; i < ARRAY_LEN(CHROOT_MOUNTS); i++) {
+        const Chroot_Mount *m = &CHROOT_MOUNTS[i];
+        if (m->optional) {
+            char host_path[256];
+            struct stat st;
+            snprintf(host_path, sizeof(host_path), "/%s", m->target);
+            if (stat(host_path, &st) != 0) continue;
+        }
+        if (!chroot_mount(m->source, m->target, m->fstype, m->flags, m->data)) {
+            LOG_ERROR("Failed to mount %s on %s/%s: %s", m->fstype, CHROOT_PATH, m->target, strerror(errno));
+            chroot_unmount_all();
+            return 0;
+        }
+    }
 
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_term);
-    return result;
-}
+    int fd = open(CHROOT_PATH "/etc/resolv.conf", O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!chroot_mount("/etc/resolv.conf", "etc/resolv.conf", NULL, MS_BIND, NULL)) {
+        LOG_WARN("Failed to bind mount resolv.conf: %s", strerror(errno));
+    }
 
-static int fzf_select(char *dest, const char *cmd, const char *default_val) {
-    clear_screen();
-    FILE *fp = popen(cmd, "r");
-    if (fp == NULL)
+    while (chroot_worker_count < CHROOT_WORKERS && chroot_spawn_worker(&chroot_workers[chroot_worker_count])) {
+        chroot_worker_count++;
+    }
+    if (chroot_worker_count == 0) {
+        LOG_ERROR("Failed to start chroot worker");
+        chroot_unmount_all();
         return 0;
-
-    char buf[256];
-    if (fgets(buf, sizeof(buf), fp) != NULL) {
-        buf[strcspn(buf, "\n")] = '\0';
-        if (strlen(buf) > 0)
-            strcpy(dest, buf);
     }
-    pclose(fp);
 
-    if (strlen(dest) == 0 && default_val)
-        strcpy(dest, default_val);
+    static int registered = 0;
+    if (!registered) {
+        atexit(chroot_session_stop);
+        registered = 1;
+    }
 
+    LOG_INFO("Chroot session started in %s (%d workers, %d mounts)", CHROOT_PATH, chroot_worker_count, chroot_mounted_count);
     return 1;
 }
 
-static int handle_password_entry(
-        char *password,
-        char *confirmed_password,
-        int form_row,
-        int logo_start,
-        char *username,
-        char *hostname,
-        char *keyboard,
-        char *timezone
-    ) {
-    char temp_input[256];
-    char password_confirm[256];
+int chroot_session_start(void) {
+    pthread_mutex_lock(&chroot_lock);
+    int ok = chroot_session_start_locked();
+    pthread_mutex_unlock(&chroot_lock);
+    return ok;
+}
 
-    printf(ANSI_CURSOR_POS, form_row + 1, logo_start + 13);
-    fflush(stdout);
+static Chroot_Worker *chroot_acquire(void) {
+    Chroot_Worker *worker = NULL;
+
+    pthread_mutex_lock(&chroot_lock);
+    while (!worker && chroot_session_start_locked()) {
+        int alive = 0;
+        for (int i = 0; i < chroot_worker_count && !worker; i++) {
+            if (chroot_workers[i].pid <= 0) continue;
+            alive++;
+            if (!chroot_workers[i].busy) {
+                worker = &chroot_workers[i];
+                worker->busy = 1;
+            }
+        }
+        if (alive == 0) {
+            LOG_ERROR("No chroot workers left");
+            break;
+        }
+        if (!worker) {
+            pthread_cond_wait(&chroot_idle, &chroot_lock);
+        }
+    }
+    pthread_mutex_unlock(&chroot_lock);
+    return worker;
+}
 
-    if (!read_line(temp_input, sizeof(temp_input), 0))
-        return -1;
+static void chroot_release(Chroot_Worker *worker, int alive) {
+    pthread_mutex_lock(&chroot_lock);
+    if (!alive) {
+        kill(worker->pid, SIGKILL);
+        chroot_close_worker(worker);
+        if (!chroot_spawn_worker(worker)) {
+            LOG_ERROR("Failed to replace chroot worker");
+        }
+    }
+    worker->busy = 0;
+    pthread_cond_broadcast(&chroot_idle);
+    pthread_mutex_unlock(&chroot_lock);
+}
 
-    if (strlen(temp_input) == 0) {
-        show_message("Password cannot be empty");
+int chroot_exec_input(const char *cmd, const char *input) {
+    if (atomic_load(&steps_cancelled) && thread_log) {
+        LOG_WARN("Skipping chroot command, install step cancelled: %s", cmd);
         return 0;
     }
+    LOG_INFO("Executing in chroot: %s", cmd);
 
-    strcpy(password, temp_input);
+    Chroot_Worker *worker = chroot_acquire();
+    if (!worker) {
+        return 0;
+    }
 
-    draw_form(username, password, confirmed_password, hostname, keyboard, timezone, 2);
-    printf(ANSI_CURSOR_POS, form_row + 2, logo_start + 20);
-    fflush(stdout);
+    uint32_t header[2] = { (uint32_t)strlen(cmd), input ? (uint32_t)strlen(input) : 0 };
+    int32_t status = -1;
+    uint32_t out_len = 0;
+    if (!write_all(worker->request_fd, header, sizeof(header)) ||
+        !write_all(worker->request_fd, cmd, header[0]) ||
+        !write_all(worker->request_fd, input ? input : "", header[1]) ||
+        !read_all(worker->reply_fd, &status, sizeof(status)) ||
+        !read_all(worker->reply_fd, &out_len, sizeof(out_len))) {
+        LOG_ERROR("Chroot session worker died while running: %s", cmd);
+        chroot_release(worker, 0);
+        return 0;
+    }
+
+    char buf[8192];
+    while (out_len > 0) {
+        size_t chunk = out_len < sizeof(buf) ? out_len : sizeof(buf);
+        if (!read_all(worker->reply_fd, buf, chunk)) {
+            chroot_release(worker, 0);
+            return 0;
+        }
+        log_write(buf, chunk);
+        out_len -= (uint32_t)chunk;
+    }
+    chroot_release(worker, 1);
+
+    if (status != 0) {
+        LOG_ERROR("Chroot command failed (exit %d): %s", status, cmd);
+        return 0;
+    }
+
+    LOG_DEBUG("Chroot command succeeded: %s", cmd);
+    return 1;
+}
+
+int chroot_exec(const char *cmd) {
+    return chroot_exec_input(cmd, NULL);
+}
+
+int chroot_exec_fmt(const char *fmt, ...) {
+    char cmd[MAX_CMD_SIZE];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(cmd, sizeof(cmd), fmt, args);
+    va_end(args);
+
+    return chroot_exec(cmd);
+}
+
+int chroot_exec_as_user(const char *username, const char *cmd) {
+    char full_cmd[MAX_CMD_SIZE * 2];
+    snprintf(full_cmd, sizeof(full_cmd), "sudo -u %s %s", username, cmd);
+    return chroot_exec(full_cmd);
+}
+
+int chroot_exec_as_user_fmt(const char *username, const char *fmt, ...) {
+    char cmd[MAX_CMD_SIZE];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(cmd, sizeof(cmd), fmt, args);
+    va_end(args);
+
+    return chroot_exec_as_user(username, cmd);
+}
+
+static int git_clone_bundle(const char *username, const char *name, const char *repo_url, const char *dest_path) {
+    char bundle[PATH_MAX];
+    char commit_path[PATH_MAX];
+    char staged[PATH_MAX];
+    snprintf(bundle, sizeof(bundle), "%s/%s.bundle", GIT_BUNDLE_DIR, name);
+    snprintf(commit_path, sizeof(commit_path), "%s/%s.commit", GIT_BUNDLE_DIR, name);
+    snprintf(staged, sizeof(staged), "%s/tmp/tonarchy-%s.bundle", CHROOT_PATH, name);
+    if (access(bundle, R_OK) != 0) {
+        return 0;
+    }
+
+    char commit[64] = "unknown";
+    FILE *fp = fopen(commit_path, "r");
+    if (fp) {
+        if (fgets(commit, sizeof(commit), fp)) commit[strcspn(commit, "\n")] = '\0';
+        fclose(fp);
+    }
+
+    LOG_INFO("Cloning %s to %s as user %s from local bundle (%s)", name, dest_path, username, commit);
+    Copy_Job job = { bundle, staged, username, 1 };
+    int ok = copy_trees(&job, 1, NULL) &&
+             chroot_exec_as_user_fmt(username, "git clone -q /tmp/tonarchy-%s.bundle %s && git -C %s remote set-url origin %s",
+                                     name, dest_path, dest_path, repo_url);
+    unlink(staged);
+    if (!ok) {
+        LOG_WARN("Failed to clone %s from local bundle", name);
+        chroot_exec_fmt("rm -rf %s", dest_path);
+        return 0;
+    }
+
+    if (check_internet_connection() &&
+        !chroot_exec_as_user_fmt(username, "git -C %s pull -q --ff-only", dest_path)) {
+        LOG_WARN("Failed to fetch %s updates from %s, keeping bundled commit %s", name, repo_url, commit);
+    }
+    return 1;
+}
+
+int git_clone_as_user(const char *username, const char *repo_url, const char *dest_path) {
+    const char *name = strrchr(repo_url, '/');
+    name = name ? name + 1 : repo_url;
+    if (git_clone_bundle(username, name, repo_url, dest_path)) {
+        return 1;
+    }
+
+    LOG_INFO("Cloning %s to %s as user %s", repo_url, dest_path, username);
+    return chroot_exec_as_user_fmt(username, "git clone %s %s", repo_url, dest_path);
+}
+
+int make_clean_install(const char *build_dir) {
+    LOG_INFO("Building and installing from %s", build_dir);
+    return chroot_exec_fmt("cd %s && make clean install", build_dir);
+}
+
+int create_user_dotfile(const char *username, const Dotfile *dotfile) {
+    char full_path[512];
+    snprintf(full_path, sizeof(full_path), "%s/home/%s/%s", CHROOT_PATH, username, dotfile->filename);
+
+    LOG_INFO("Creating dotfile %s for user %s", dotfile->filename, username);
+
+    if (!write_file(full_path, dotfile->content)) {
+        return 0;
+    }
+
+    if (chmod(full_path, dotfile->permissions) != 0) {
+        LOG_ERROR("Failed to chmod %s: %s", full_path, strerror(errno));
+        return 0;
+    }
+
+    return 1;
+}
+
+int setup_systemd_override(const Systemd_Override *override) {
+    char dir_path[1024];
+    char file_path[2048];
+
+    snprintf(dir_path, sizeof(dir_path), "%s/etc/systemd/system/%s", CHROOT_PATH, override->drop_in_dir);
+    snprintf(file_path, sizeof(file_path), "%s/%s", dir_path, override->drop_in_file);
+
+    LOG_INFO("Setting up systemd override: %s/%s", override->drop_in_dir, override->drop_in_file);
+
+    if (!create_directory(dir_path, 0755)) {
+        return 0;
+    }
+
+    FILE *fp = fopen(file_path, "w");
+    if (!fp) {
+        LOG_ERROR("Failed to create systemd override file: %s", file_path);
+        return 0;
+    }
+
+    for (size_t i = 0; i < override->entry_count; i++) {
+        if (override->entries[i].value[0] == '\0') {
+            fprintf(fp, "%s\n", override->entries[i].key);
+        } else {
+            fprintf(fp, "%s=%s\n", override->entries[i].key, override->entries[i].value);
+        }
+    }
+
+    fclose(fp);
+    LOG_INFO("Successfully created systemd override");
+    return 1;
+}
+
+
+static void disable_raw_mode(void) {
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
+}
+
+static void enable_raw_mode(void) {
+    tcgetattr(STDIN_FILENO, &orig_termios);
+    atexit(disable_raw_mode);
+
+    struct termios raw = orig_termios;
+    raw.c_lflag &= ~(ECHO | ICANON);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+}
+
+static const char *SCREEN_STYLES[] = {
+    [STYLE_DEFAULT]   = ANSI_RESET,
+    [STYLE_WHITE]     = ANSI_RESET ANSI_WHITE,
+    [STYLE_GREEN]     = ANSI_RESET ANSI_GREEN,
+    [STYLE_LOGO]      = ANSI_ESC "0;1;32m",
+    [STYLE_BLUE_BOLD] = ANSI_RESET ANSI_BLUE_BOLD,
+    [STYLE_YELLOW]    = ANSI_RESET ANSI_YELLOW,
+    [STYLE_GRAY]      = ANSI_RESET ANSI_GRAY,
+    [STYLE_RED]       = ANSI_RESET ANSI_ESC "31m",
+};
+
+static Screen_Cell screen_front[SCREEN_MAX_ROWS][SCREEN_MAX_COLS];
+static Screen_Cell screen_back[SCREEN_MAX_ROWS][SCREEN_MAX_COLS];
+static int screen_rows = 24;
+static int screen_cols = 80;
+static int screen_front_valid = 0;
+static int screen_cursor_row = 0;
+static int screen_cursor_col = 0;
+static volatile sig_atomic_t screen_resized = 1;
+
+static void handle_sigwinch(int sig) {
+    (void)sig;
+    screen_resized = 1;
+}
+
+static void get_terminal_size(int *rows, int *cols) {
+    static int handler_installed = 0;
+    if (!handler_installed) {
+        struct sigaction sa = {0};
+        sa.sa_handler = handle_sigwinch;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGWINCH, &sa, NULL);
+        handler_installed = 1;
+    }
+
+    if (screen_resized) {
+        screen_resized = 0;
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+            screen_rows = ws.ws_row < SCREEN_MAX_ROWS ? ws.ws_row : SCREEN_MAX_ROWS;
+            screen_cols = ws.ws_col < SCREEN_MAX_COLS ? ws.ws_col : SCREEN_MAX_COLS;
+        }
+        screen_front_valid = 0;
+    }
+    *rows = screen_rows;
+    *cols = screen_cols;
+}
+
+static void screen_invalidate(void) {
+    screen_front_valid = 0;
+}
+
+static int screen_put(int row, int col, Screen_Style style, const char *fmt, ...) {
+    char text[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    if (row < 1 || row > screen_rows) {
+        return col;
+    }
+
+    const unsigned char *p = (const unsigned char *)text;
+    while (*p) {
+        size_t len = *p >= 0xf0 ? 4 : *p >= 0xe0 ? 3 : *p >= 0xc0 ? 2 : 1;
+        if (strnlen((const char *)p, len) < len) {
+            break;
+        }
+        if (col >= 1 && col <= screen_cols) {
+            Screen_Cell *cell = &screen_back[row - 1][col - 1];
+            memcpy(cell->glyph, p, len);
+            cell->glyph[len] = '\0';
+            cell->style = (unsigned char)style;
+        }
+        p += len;
+        col++;
+    }
+    return col;
+}
+
+static void screen_clear_row(int row) {
+    if (row >= 1 && row <= screen_rows) {
+        for (int col = 0; col < screen_cols; col++) {
+            screen_back[row - 1][col] = (Screen_Cell){ " ", STYLE_DEFAULT };
+        }
+    }
+}
+
+static void screen_cursor(int row, int col) {
+    screen_cursor_row = row;
+    screen_cursor_col = col;
+}
+
+static int screen_cell_equal(const Screen_Cell *a, const Screen_Cell *b) {
+    return a->style == b->style && strcmp(a->glyph, b->glyph) == 0;
+}
+
+static void screen_present(void) {
+    static char out[SCREEN_MAX_ROWS * SCREEN_MAX_COLS * 32 + 64];
+    size_t len = 0;
+    int full = !screen_front_valid;
+    int style = -1;
+    int at_row = -1, at_col = -1;
+
+    len += (size_t)snprintf(out + len, sizeof(out) - len, "\033[?25l%s", full ? "\033[0m\033[2J" : "");
+    for (int r = 0; r < screen_rows; r++) {
+        for (int c = 0; c < screen_cols; c++) {
+            const Screen_Cell *cell = &screen_back[r][c];
+            if (full ? strcmp(cell->glyph, " ") == 0 && cell->style == STYLE_DEFAULT
+                     : screen_cell_equal(cell, &screen_front[r][c])) {
+                continue;
+            }
+
+            if (at_row == r && at_col <= c && c - at_col <= SCREEN_SKIP_MAX) {
+                for (int k = at_col; k < c && screen_back[r][k].style == style; k++) {
+                    len += (size_t)snprintf(out + len, sizeof(out) - len, "%s", screen_back[r][k].glyph);
+                    at_col = k + 1;
+                }
+            }
+            if (at_row != r || at_col != c) {
+                len += (size_t)snprintf(out + len, sizeof(out) - len, ANSI_CURSOR_POS, r + 1, c + 1);
+            }
+            if (cell->style != style) {
+                style = cell->style;
+                len += (size_t)snprintf(out + len, sizeof(out) - len, "%s", SCREEN_STYLES[style]);
+            }
+            len += (size_t)snprintf(out + len, sizeof(out) - len, "%s", cell->glyph);
+            at_row = r;
+            at_col = c + 1;
+        }
+    }
+
+    int cursor_row = screen_cursor_row > 0 ? screen_cursor_row : screen_rows;
+    int cursor_col = screen_cursor_row > 0 ? screen_cursor_col : 1;
+    len += (size_t)snprintf(out + len, sizeof(out) - len, ANSI_RESET ANSI_CURSOR_POS "\033[?25h",
+                            cursor_row, cursor_col);
+
+    fflush(stdout);
+    write_all(STDOUT_FILENO, out, len);
+    memcpy(screen_front, screen_back, sizeof(screen_front));
+    screen_front_valid = 1;
+}
+
+static enum Terminal_Size get_terminal_size_category(int cols) {
+    if (cols < 45) return TERM_SMALL;
+    if (cols < 75) return TERM_MEDIUM;
+    return TERM_LARGE;
+}
+
+static int get_logo_width(int cols) {
+    enum Terminal_Size size = get_terminal_size_category(cols);
+    if (size == TERM_LARGE) return 70;
+    if (size == TERM_MEDIUM) return 25;
+    return 8;
+}
+
+static int get_logo_start(int cols) {
+    int width = get_logo_width(cols);
+    int start = (cols - width) / 2;
+    return (start < 1) ? 1 : start;
+}
+
+static int get_menu_start_row(int cols) {
+    enum Terminal_Size size = get_terminal_size_category(cols);
+    if (size == TERM_LARGE) return 10;
+    if (size == TERM_MEDIUM) return 7;
+    return 4;
+}
+
+static void clear_screen(void) {
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+    for (int row = 1; row <= rows; row++) {
+        screen_clear_row(row);
+    }
+    screen_cursor(0, 0);
+}
+
+static void draw_logo(int cols) {
+    const char *logo_large[] = {
+        "████████╗ ██████╗ ███╗   ██╗ █████╗ ██████╗  ██████╗██╗  ██╗██╗   ██╗",
+        "╚══██╔══╝██╔═══██╗████╗  ██║██╔══██╗██╔══██╗██╔════╝██║  ██║╚██╗ ██╔╝",
+        "   ██║   ██║   ██║██╔██╗ ██║███████║██████╔╝██║     ███████║ ╚████╔╝ ",
+        "   ██║   ██║   ██║██║╚██╗██║██╔══██║██╔══██╗██║     ██╔══██║  ╚██╔╝  ",
+        "   ██║   ╚██████╔╝██║ ╚████║██║  ██║██║  ██║╚██████╗██║  ██║   ██║   ",
+        "   ╚═╝    ╚═════╝ ╚═╝  ╚═══╝╚═╝  ╚═╝╚═╝  ╚═╝ ╚═════╝╚═╝  ╚═╝   ╚═╝   "
+    };
+
+    const char *logo_medium[] = {
+        "╔╦╗╔═╗╔╗╔╔═╗╦═╗╔═╗╦ ╦╦ ╦",
+        " ║ ║ ║║║║╠═╣╠╦╝║  ╠═╣╚╦╝",
+        " ╩ ╚═╝╝╚╝╩ ╩╩╚═╚═╝╩ ╩ ╩ "
+    };
+
+    const char *logo_small[] = {
+        "TONARCHY"
+    };
+
+    enum Terminal_Size size = get_terminal_size_category(cols);
+    const char **logo;
+    int logo_height;
+    int logo_width;
+
+    switch (size) {
+        case TERM_LARGE:
+            logo = logo_large;
+            logo_height = 6;
+            logo_width = 70;
+            break;
+        case TERM_MEDIUM:
+            logo = logo_medium;
+            logo_height = 3;
+            logo_width = 25;
+            break;
+        default:
+            logo = logo_small;
+            logo_height = 1;
+            logo_width = 8;
+            break;
+    }
+
+    int logo_start = (cols - logo_width) / 2;
+    if (logo_start < 1) logo_start = 1;
+
+    for (int i = 0; i < logo_height; i++) {
+        screen_put(i + 2, logo_start, STYLE_LOGO, "%s", logo[i]);
+    }
+}
+
+static int draw_menu(const char **items, int count, int selected) {
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+
+    clear_screen();
+    draw_logo(cols);
+
+    int logo_start = get_logo_start(cols);
+    int menu_start_row = get_menu_start_row(cols);
+
+    for (int i = 0; i < count; i++) {
+        if (i == selected) {
+            screen_put(menu_start_row + i, logo_start + 2, STYLE_BLUE_BOLD, "> %s", items[i]);
+        } else {
+            screen_put(menu_start_row + i, logo_start + 2, STYLE_WHITE, "  %s", items[i]);
+        }
+    }
+
+    screen_put(menu_start_row + count + 2, logo_start, STYLE_YELLOW, "j/k Navigate  Enter Select");
+
+    screen_present();
+    return 0;
+}
+
+static int select_from_menu(const char **items, int count) {
+    int selected = 0;
+
+    enable_raw_mode();
+    draw_menu(items, count, selected);
+
+    char c;
+    while (read(STDIN_FILENO, &c, 1) == 1) {
+        if (c == 'q' || c == 27) {
+            disable_raw_mode();
+            return -1;
+        }
+
+        if (c == 'j' || c == 66) {
+            if (selected < count - 1) {
+                selected++;
+                draw_menu(items, count, selected);
+            }
+        }
+
+        if (c == 'k' || c == 65) {
+            if (selected > 0) {
+                selected--;
+                draw_menu(items, count, selected);
+            }
+        }
+
+        if (c == '\r' || c == '\n') {
+            disable_raw_mode();
+            return selected;
+        }
+    }
+
+    disable_raw_mode();
+    return -1;
+}
+
+void show_message(const char *message) {
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+
+    clear_screen();
+    draw_logo(cols);
+
+    int logo_start = get_logo_start(cols);
+    int msg_row = get_menu_start_row(cols);
+
+    screen_put(msg_row, logo_start, STYLE_WHITE, "%s", message);
+    screen_present();
+
+    sleep(2);
+}
+
+static unsigned long long dir_bytes(const char *path) {
+    unsigned long long total = 0;
+    DIR *dir = path ? opendir(path) : NULL;
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode)) {
+            total += (unsigned long long)st.st_size;
+        }
+    }
+    if (dir) closedir(dir);
+    return total;
+}
+
+static unsigned long long fs_used_bytes(const char *path) {
+    struct statvfs vfs;
+    if (!path || statvfs(path, &vfs) != 0) {
+        return 0;
+    }
+    return (unsigned long long)(vfs.f_blocks - vfs.f_bfree) * vfs.f_frsize;
+}
+
+static void progress_begin(Progress_Pane *pane, const char *phase, const char *cache_dir, const char *target) {
+    memset(pane, 0, sizeof(*pane));
+    pane->phase = phase;
+    pane->cache_dir = cache_dir;
+    pane->target = target;
+    pane->cache_start = pane->cache_bytes = dir_bytes(cache_dir);
+    pane->target_start = pane->target_used = fs_used_bytes(target);
+    clock_gettime(CLOCK_MONOTONIC, &pane->started);
+    pane->last_activity = pane->last_sample = pane->started;
+    LOG_INFO("Phase started: %s", phase);
+}
+
+static void progress_draw(Progress_Pane *pane) {
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+    int col = get_logo_start(cols);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pane->last_draw = now;
+    int elapsed = (int)(elapsed_ms(&pane->started, &now) / 1000.0);
+    int idle = (int)(elapsed_ms(&pane->last_activity, &now) / 1000.0);
+
+    for (int row = PROGRESS_ROW; row < PROGRESS_ROW + 5; row++) {
+        screen_clear_row(row);
+    }
+
+    int end = screen_put(PROGRESS_ROW, col, STYLE_WHITE, "%s", pane->phase);
+    screen_put(PROGRESS_ROW, end + 2, STYLE_GRAY, "%02d:%02d", elapsed / 60, elapsed % 60);
+    if (pane->items > 0) {
+        screen_put(PROGRESS_ROW + 1, col, STYLE_GREEN, "[%d/%d] %.*s", pane->item, pane->items, cols - col - 12, pane->current);
+    } else if (pane->current[0]) {
+        screen_put(PROGRESS_ROW + 1, col, STYLE_GREEN, "%.*s", cols - col, pane->current);
+    }
+    if (pane->cache_dir) {
+        screen_put(PROGRESS_ROW + 2, col, STYLE_WHITE, "Downloaded %.1f MiB (%.1f MiB/s)",
+                   (double)(pane->cache_bytes - pane->cache_start) / (1024.0 * 1024.0), pane->download_rate);
+    }
+    if (pane->target) {
+        screen_put(PROGRESS_ROW + 3, col, STYLE_WHITE, "Written to target %.1f MiB (%.1f MiB/s)",
+                   (double)(pane->target_used - pane->target_start) / (1024.0 * 1024.0), pane->write_rate);
+    }
+    if (idle * 1000 >= PROGRESS_STALL_MS) {
+        screen_put(PROGRESS_ROW + 4, col, STYLE_RED, "No progress for %dm%02ds", idle / 60, idle % 60);
+    } else {
+        screen_put(PROGRESS_ROW + 4, col, STYLE_GRAY, "Last activity %ds ago", idle);
+    }
+    screen_present();
+}
+
+static int progress_package_line(const char *line) {
+    static const char *const verbs[] = { "installing ", "upgrading ", "reinstalling ", "downgrading " };
+    for (size_t i = 0; i < ARRAY_LEN(verbs); i++) {
+        if (strncmp(line, verbs[i], strlen(verbs[i])) == 0) return 1;
+    }
+    return 0;
+}
+
+static void progress_line(void *observer, const char *line) {
+    Progress_Pane *pane = observer;
+    int item, items, consumed = 0;
+    while (*line == ' ') line++;
+
+    if (sscanf(line, "Packages (%d)", &items) == 1) {
+        pane->items = items;
+        clock_gettime(CLOCK_MONOTONIC, &pane->last_activity);
+        return;
+    }
+    if (progress_package_line(line)) {
+        pane->item++;
+        if (pane->item > pane->items) pane->items = pane->item;
+    } else if (sscanf(line, "(%d/%d) %n", &item, &items, &consumed) == 2 && consumed > 0) {
+        if (pane->items == 0) {
+            pane->item = item;
+            pane->items = items;
+        }
+        line += consumed;
+    } else if (strncmp(line, ":: ", 3) == 0) {
+        line += 3;
+    } else if (!strstr(line, "downloading")) {
+        return;
+    }
+
+    size_t len = strcspn(line, "\r");
+    while (len > 0 && (line[len - 1] == '.' || line[len - 1] == ' ')) len--;
+    snprintf(pane->current, sizeof(pane->current), "%.*s", (int)len, line);
+    clock_gettime(CLOCK_MONOTONIC, &pane->last_activity);
+}
+
+static void progress_tick(void *observer) {
+    Progress_Pane *pane = observer;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double since_sample = elapsed_ms(&pane->last_sample, &now);
+    if (since_sample >= PROGRESS_SAMPLE_MS) {
+        unsigned long long cache_bytes = pane->cache_dir ? dir_bytes(pane->cache_dir) : 0;
+        unsigned long long target_used = fs_used_bytes(pane->target);
+        double mib_per_s = 1000.0 / since_sample / (1024.0 * 1024.0);
+        pane->download_rate = cache_bytes > pane->cache_bytes ? (double)(cache_bytes - pane->cache_bytes) * mib_per_s : 0;
+        pane->write_rate = target_used > pane->target_used ? (double)(target_used - pane->target_used) * mib_per_s : 0;
+        if (cache_bytes != pane->cache_bytes || target_used != pane->target_used) {
+            pane->last_activity = now;
+        }
+        pane->cache_bytes = cache_bytes > pane->cache_bytes ? cache_bytes : pane->cache_bytes;
+        pane->target_used = target_used;
+        pane->last_sample = now;
+    }
+
+    if (elapsed_ms(&pane->last_draw, &now) >= PROGRESS_REDRAW_MS) {
+        progress_draw(pane);
+    }
+}
+
+static void progress_end(Progress_Pane *pane) {
+    progress_tick(pane);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    LOG_INFO("Phase finished: %s in %.1fs (%.1f MiB downloaded, %.1f MiB written)", pane->phase,
+             elapsed_ms(&pane->started, &now) / 1000.0,
+             (double)(pane->cache_bytes - pane->cache_start) / (1024.0 * 1024.0),
+             pane->target_used > pane->target_start ? (double)(pane->target_used - pane->target_start) / (1024.0 * 1024.0) : 0.0);
+}
+
+static int check_internet_connection(void) {
+    char *const argv[] = { "ping", "-c", "1", "-W", "2", "1.1.1.1", NULL };
+    Exec_Options opts = { .quiet = 1, .timeout_ms = 5000 };
+    return exec_run(argv, &opts, NULL);
+}
+
+static int list_wifi_networks(char networks[][256], char ssids[][128], int max_networks) {
+    static char output[16384];
+    char *const argv[] = { "nmcli", "-t", "-f", "SSID,SIGNAL,SECURITY", "device", "wifi", "list", NULL };
+    Exec_Options opts = { .capture = output, .capture_size = sizeof(output), .timeout_ms = 30000 };
+    if (!exec_run(argv, &opts, NULL)) {
+        return 0;
+    }
+
+    int count = 0;
+    int scanned = 0;
+    char *saveptr = NULL;
+    for (char *line = strtok_r(output, "\n", &saveptr);
+         line && count < max_networks && scanned < 20;
+         line = strtok_r(NULL, "\n", &saveptr), scanned++) {
+        char ssid[128] = "";
+        char signal[32] = "";
+        char security[64] = "";
+        char *token = strtok(line, ":");
+        if (token) snprintf(ssid, sizeof(ssid), "%s", token);
+        token = strtok(NULL, ":");
+        if (token) snprintf(signal, sizeof(signal), "%s", token);
+        token = strtok(NULL, ":");
+        if (token) snprintf(security, sizeof(security), "%s", token);
+
+        if (strlen(ssid) > 0 && strcmp(ssid, "--") != 0) {
+            snprintf(ssids[count], 128, "%s", ssid);
+            snprintf(networks[count], 255, "%s (%s%%) [%s]", ssid, signal,
+                     strlen(security) > 0 ? security : "Open");
+            count++;
+        }
+    }
+    return count;
+}
+
+static int nmcli_connect_wifi(const char *ssid, const char *password) {
+    size_t ssid_len = strlen(ssid);
+    if (ssid_len == 0 || ssid_len >= 128) {
+        LOG_ERROR("Invalid SSID length for nmcli");
+        return 0;
+    }
+    for (size_t i = 0; i < ssid_len; i++) {
+        unsigned char c = (unsigned char)ssid[i];
+        if (iscntrl(c)) {
+            LOG_ERROR("SSID contains control characters");
+            return 0;
+        }
+    }
+
+    if (password) {
+        size_t pass_len = strlen(password);
+        if (pass_len >= 256) {
+            LOG_ERROR("Password too long for nmcli");
+            return 0;
+        }
+        for (size_t i = 0; i < pass_len; i++) {
+            unsigned char c = (unsigned char)password[i];
+            if (iscntrl(c)) {
+                LOG_ERROR("Password contains control characters");
+                return 0;
+            }
+        }
+    }
+
+    char log_name[256];
+    snprintf(log_name, sizeof(log_name), "nmcli device wifi connect %s", ssid);
+    Exec_Options opts = { .log_name = log_name, .timeout_ms = 60000 };
+
+    if (password && password[0] != '\0') {
+        char *const argv[] = {
+            "nmcli", "device", "wifi", "connect", (char *)ssid, "password", (char *)password, NULL
+        };
+        return exec_run(argv, &opts, NULL);
+    }
+    char *const argv[] = { "nmcli", "device", "wifi", "connect", (char *)ssid, NULL };
+    return exec_run(argv, &opts, NULL);
+}
+
+static int connect_to_wifi(const char *ssid) {
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+
+    clear_screen();
+    draw_logo(cols);
+
+    int logo_start = get_logo_start(cols);
+    screen_put(10, logo_start, STYLE_WHITE, "Connecting to: %s", ssid);
+    int prompt_end = screen_put(12, logo_start, STYLE_WHITE, "Enter password (leave empty if open): ");
+    screen_cursor(12, prompt_end);
+    screen_present();
+
+    char password[256] = "";
+    struct termios old_term;
+    tcgetattr(STDIN_FILENO, &old_term);
+    struct termios new_term = old_term;
+    new_term.c_lflag &= ~ECHO;
+    new_term.c_lflag |= ICANON;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &new_term);
+
+    if (fgets(password, sizeof(password), stdin) != NULL) {
+        password[strcspn(password, "\n")] = '\0';
+    }
+
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_term);
+    screen_invalidate();
+
+    clear_screen();
+    draw_logo(cols);
+    screen_put(10, logo_start, STYLE_WHITE, "Connecting...");
+    screen_present();
+
+    int result = nmcli_connect_wifi(ssid, password);
+    sleep(2);
+
+    if (result && check_internet_connection()) {
+        show_message("Connected successfully!");
+        return 1;
+    } else {
+        show_message("Connection failed. Please try again.");
+        return 0;
+    }
+}
+
+static int setup_wifi_if_needed(void) {
+    if (check_internet_connection()) {
+        return 1;
+    }
+
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+
+    clear_screen();
+    draw_logo(cols);
+
+    int logo_start = get_logo_start(cols);
+    screen_put(10, logo_start, STYLE_WHITE, "No internet connection detected.");
+    screen_put(11, logo_start, STYLE_WHITE, "Scanning for WiFi networks...");
+    screen_present();
+
+    run_cmd("nmcli", "radio", "wifi", "on", NULL);
+    sleep(1);
+
+    char networks[32][256];
+    char ssids[32][128];
+    int network_count = list_wifi_networks(networks, ssids, 32);
+
+    if (network_count == 0) {
+        show_message("No WiFi networks found. Please check your connection.");
+        return 0;
+    }
+
+    const char *network_ptrs[32];
+    for (int i = 0; i < network_count; i++) {
+        network_ptrs[i] = networks[i];
+    }
+
+    int selected = select_from_menu(network_ptrs, network_count);
+    if (selected < 0) {
+        show_message("WiFi setup cancelled. Installation requires internet.");
+        return 0;
+    }
+
+    return connect_to_wifi(ssids[selected]);
+}
+
+typedef enum {
+    MIRROR_CONNECTING,
+    MIRROR_SENDING,
+    MIRROR_RECEIVING,
+    MIRROR_DONE,
+    MIRROR_FAILED
+} Mirror_State;
+
+typedef struct {
+    char server[512];
+    char host[256];
+    char port[8];
+    char path[512];
+    char request[1024];
+    size_t request_len;
+    size_t request_sent;
+    char header[2048];
+    size_t header_len;
+    int fd;
+    int order;
+    Mirror_State state;
+    size_t body_bytes;
+    double connect_ms;
+    double throughput;
+    struct timespec started;
+    struct timespec connected;
+    struct timespec finished;
+} Mirror_Probe;
+
+typedef struct {
+    char host[256];
+    char port[8];
+    struct addrinfo *res;
+    int done;
+    int abandoned;
+} Mirror_Lookup;
+
+static void replace_token(char *s, size_t size, const char *token, const char *value) {
+    char *p = strstr(s, token);
+    if (!p) return;
+
+    char tail[512];
+    snprintf(tail, sizeof(tail), "%s", p + strlen(token));
+    *p = '\0';
+    size_t used = strlen(s);
+    snprintf(s + used, size - used, "%s%s", value, tail);
+}
+
+static int parse_mirror_server(const char *line, Mirror_Probe *m) {
+    while (*line == '#' || isspace((unsigned char)*line)) line++;
+    if (strncmp(line, "Server", 6) != 0) return 0;
+    line += 6;
+    while (isspace((unsigned char)*line)) line++;
+    if (*line != '=') return 0;
+    line++;
+    while (isspace((unsigned char)*line)) line++;
+
+    snprintf(m->server, sizeof(m->server), "%s", line);
+    m->server[strcspn(m->server, " \t\r\n")] = '\0';
+
+    const char *rest = m->server;
+    if (strncmp(rest, "http://", 7) == 0) {
+        rest += 7;
+    } else if (strncmp(rest, "https://", 8) == 0) {
+        rest += 8;
+    } else {
+        return 0;
+    }
+
+    size_t host_len = strcspn(rest, ":/");
+    if (host_len == 0 || host_len >= sizeof(m->host)) return 0;
+    memcpy(m->host, rest, host_len);
+    m->host[host_len] = '\0';
+    rest += host_len;
+
+    snprintf(m->port, sizeof(m->port), "80");
+    if (*rest == ':') {
+        rest++;
+        size_t port_len = strcspn(rest, "/");
+        if (port_len == 0 || port_len >= sizeof(m->port)) return 0;
+        memcpy(m->port, rest, port_len);
+        m->port[port_len] = '\0';
+        rest += port_len;
+    }
+
+    snprintf(m->path, sizeof(m->path), "%s", *rest ? rest : "/");
+    replace_token(m->path, sizeof(m->path), "$repo", "extra");
+    replace_token(m->path, sizeof(m->path), "$arch", "x86_64");
+    size_t path_len = strlen(m->path);
+    snprintf(m->path + path_len, sizeof(m->path) - path_len, "%sextra.db",
+             path_len > 0 && m->path[path_len - 1] == '/' ? "" : "/");
+
+    int n = snprintf(m->request, sizeof(m->request),
+        "GET %s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "User-Agent: tonarchy\r\n"
+        "Range: bytes=0-%d\r\n"
+        "Connection: close\r\n"
+        "\r\n",
+        m->path, m->host, MIRROR_SAMPLE_BYTES - 1);
+    if (n < 0 || (size_t)n >= sizeof(m->request)) return 0;
+    m->request_len = (size_t)n;
+    return 1;
+}
+
+static int load_mirror_candidates(const char *path, Mirror_Probe *mirrors, int max) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        LOG_ERROR("Failed to open mirrorlist: %s", path);
+        return 0;
+    }
+
+    int count = 0;
+    char line[1024];
+    while (count < max && fgets(line, sizeof(line), fp) != NULL) {
+        Mirror_Probe *m = &mirrors[count];
+        memset(m, 0, sizeof(*m));
+        if (!parse_mirror_server(line, m)) continue;
+
+        int duplicate = 0;
+        for (int i = 0; i < count; i++) {
+            if (strcmp(mirrors[i].server, m->server) == 0) {
+                duplicate = 1;
+                break;
+            }
+        }
+        if (duplicate) continue;
+
+        m->fd = -1;
+        m->order = count;
+        m->state = MIRROR_FAILED;
+        count++;
+    }
+
+    fclose(fp);
+    return count;
+}
+
+static void finish_probe(Mirror_Probe *m, Mirror_State state) {
+    clock_gettime(CLOCK_MONOTONIC, &m->finished);
+    if (m->fd >= 0) {
+        close(m->fd);
+        m->fd = -1;
+    }
+
+    double ms = elapsed_ms(&m->connected, &m->finished);
+    if (m->body_bytes > 0 && ms > 0) {
+        m->throughput = (double)m->body_bytes * 1000.0 / ms;
+        m->state = MIRROR_DONE;
+    } else {
+        m->state = state;
+    }
+}
+
+static pthread_mutex_t mirror_lookup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *mirror_lookup_worker(void *arg) {
+    Mirror_Lookup *lookup = arg;
+    struct addrinfo hints = {0};
+    struct addrinfo *res = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(lookup->host, lookup->port, &hints, &res) != 0) {
+        res = NULL;
+    }
+
+    pthread_mutex_lock(&mirror_lookup_lock);
+    int abandoned = lookup->abandoned;
+    lookup->res = res;
+    lookup->done = 1;
+    pthread_mutex_unlock(&mirror_lookup_lock);
+
+    if (abandoned) {
+        if (res) freeaddrinfo(res);
+        free(lookup);
+    }
+    return NULL;
+}
+
+static Mirror_Lookup *start_mirror_lookup(const Mirror_Probe *m) {
+    Mirror_Lookup *lookup = calloc(1, sizeof(*lookup));
+    if (!lookup) return NULL;
+    snprintf(lookup->host, sizeof(lookup->host), "%s", m->host);
+    snprintf(lookup->port, sizeof(lookup->port), "%s", m->port);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, mirror_lookup_worker, lookup) != 0) {
+        free(lookup);
+        return NULL;
+    }
+    pthread_detach(thread);
+    return lookup;
+}
+
+static void start_probe(Mirror_Probe *m, const struct addrinfo *res) {
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0) {
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    clock_gettime(CLOCK_MONOTONIC, &m->started);
+    int rc = connect(fd, res->ai_addr, res->ai_addrlen);
+
+    if (rc != 0 && errno != EINPROGRESS) {
+        close(fd);
+        return;
+    }
+
+    m->fd = fd;
+    m->state = MIRROR_CONNECTING;
+}
+
+static int start_resolved_probes(Mirror_Probe *mirrors, Mirror_Lookup **lookups, int count) {
+    int pending = 0;
+    pthread_mutex_lock(&mirror_lookup_lock);
+    for (int i = 0; i < count; i++) {
+        Mirror_Lookup *lookup = lookups[i];
+        if (!lookup) continue;
+        if (!lookup->done) {
+            pending++;
+            continue;
+        }
+        if (lookup->res) {
+            start_probe(&mirrors[i], lookup->res);
+            freeaddrinfo(lookup->res);
+        } else {
+            LOG_WARN("Mirror %s: failed to resolve %s", mirrors[i].server, mirrors[i].host);
+        }
+        free(lookup);
+        lookups[i] = NULL;
+    }
+    pthread_mutex_unlock(&mirror_lookup_lock);
+    return pending;
+}
+
+static void abandon_mirror_lookups(const Mirror_Probe *mirrors, Mirror_Lookup **lookups, int count) {
+    pthread_mutex_lock(&mirror_lookup_lock);
+    for (int i = 0; i < count; i++) {
+        Mirror_Lookup *lookup = lookups[i];
+        if (!lookup) continue;
+        if (lookup->done) {
+            if (lookup->res) freeaddrinfo(lookup->res);
+            free(lookup);
+        } else {
+            LOG_WARN("Mirror %s: lookup of %s did not finish within budget", mirrors[i].server, mirrors[i].host);
+            lookup->abandoned = 1;
+        }
+        lookups[i] = NULL;
+    }
+    pthread_mutex_unlock(&mirror_lookup_lock);
+}
+
+static void advance_probe(Mirror_Probe *m, short revents) {
+    if (m->state == MIRROR_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(m->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+            finish_probe(m, MIRROR_FAILED);
+            return;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &m->connected);
+        m->connect_ms = elapsed_ms(&m->started, &m->connected);
+        m->state = MIRROR_SENDING;
+    }
+
+    if (m->state == MIRROR_SENDING) {
+        ssize_t n = send(m->fd, m->request + m->request_sent, m->request_len - m->request_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) finish_probe(m, MIRROR_FAILED);
+            return;
+        }
+        m->request_sent += (size_t)n;
+        if (m->request_sent == m->request_len) m->state = MIRROR_RECEIVING;
+        return;
+    }
+
+    if (m->state != MIRROR_RECEIVING || !(revents & (POLLIN | POLLHUP | POLLERR))) {
+        return;
+    }
+
+    char buf[16384];
+    ssize_t n = recv(m->fd, buf, sizeof(buf), 0);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) finish_probe(m, MIRROR_FAILED);
+        return;
+    }
+    if (n == 0) {
+        finish_probe(m, MIRROR_FAILED);
+        return;
+    }
+
+    size_t chunk = (size_t)n;
+    if (m->header_len < sizeof(m->header) - 1 && !strstr(m->header, "\r\n\r\n")) {
+        size_t take = sizeof(m->header) - 1 - m->header_len;
+        if (take > chunk) take = chunk;
+        memcpy(m->header + m->header_len, buf, take);
+        m->header_len += take;
+        m->header[m->header_len] = '\0';
+
+        char *end = strstr(m->header, "\r\n\r\n");
+        if (!end) {
+            if (m->header_len >= sizeof(m->header) - 1) finish_probe(m, MIRROR_FAILED);
+            return;
+        }
+
+        int status = 0;
+        if (sscanf(m->header, "HTTP/%*s %d", &status) != 1 || (status != 200 && status != 206)) {
+            LOG_WARN("Mirror %s: unexpected HTTP status %d", m->server, status);
+            finish_probe(m, MIRROR_FAILED);
+            return;
+        }
+
+        size_t header_bytes = (size_t)(end + 4 - m->header);
+        chunk -= header_bytes - (m->header_len - take);
+    }
+
+    m->body_bytes += chunk;
+    if (m->body_bytes >= MIRROR_SAMPLE_BYTES) {
+        finish_probe(m, MIRROR_DONE);
+    }
+}
+
+static int compare_mirrors(const void *a, const void *b) {
+    const Mirror_Probe *ma = a;
+    const Mirror_Probe *mb = b;
+    int ok_a = ma->state == MIRROR_DONE;
+    int ok_b = mb->state == MIRROR_DONE;
+
+    if (ok_a != ok_b) return ok_b - ok_a;
+    if (ok_a) {
+        if (ma->throughput > mb->throughput) return -1;
+        if (ma->throughput < mb->throughput) return 1;
+        if (ma->connect_ms < mb->connect_ms) return -1;
+        if (ma->connect_ms > mb->connect_ms) return 1;
+    }
+    return ma->order - mb->order;
+}
+
+static int rank_mirrors(const char *in_path, const char *out_path, int budget_ms) {
+    static Mirror_Probe mirrors[MAX_MIRRORS];
+    int count = load_mirror_candidates(in_path, mirrors, MAX_MIRRORS);
+    if (count == 0) {
+        LOG_WARN("No mirror candidates in %s", in_path);
+        return 0;
+    }
+
+    struct timespec begin, now;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    static Mirror_Lookup *lookups[MAX_MIRRORS];
+    for (int i = 0; i < count; i++) {
+        lookups[i] = start_mirror_lookup(&mirrors[i]);
+    }
+
+    struct pollfd fds[MAX_MIRRORS];
+    int index[MAX_MIRRORS];
+    for (;;) {
+        int resolving = start_resolved_probes(mirrors, lookups, count);
+        int nfds = 0;
+        for (int i = 0; i < count; i++) {
+            Mirror_Probe *m = &mirrors[i];
+            if (m->fd < 0) continue;
+            fds[nfds].fd = m->fd;
+            fds[nfds].events = m->state == MIRROR_RECEIVING ? POLLIN : POLLOUT;
+            fds[nfds].revents = 0;
+            index[nfds++] = i;
+        }
+        if (nfds == 0 && resolving == 0) break;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int remaining = budget_ms - (int)elapsed_ms(&begin, &now);
+        if (remaining <= 0) break;
+
+        int wait_ms = resolving && remaining > MIRROR_LOOKUP_POLL_MS ? MIRROR_LOOKUP_POLL_MS : remaining;
+        int ready = poll(fds, (nfds_t)nfds, wait_ms);
+        if (ready < 0 && errno != EINTR) break;
+
+        for (int i = 0; i < nfds && ready > 0; i++) {
+            if (fds[i].revents) advance_probe(&mirrors[index[i]], fds[i].revents);
+        }
+    }
+
+    abandon_mirror_lookups(mirrors, lookups, count);
+    for (int i = 0; i < count; i++) {
+        if (mirrors[i].fd >= 0) finish_probe(&mirrors[i], MIRROR_FAILED);
+    }
+
+    qsort(mirrors, (size_t)count, sizeof(mirrors[0]), compare_mirrors);
+
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tonarchy", out_path);
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) {
+        LOG_ERROR("Failed to write ranked mirrorlist: %s", tmp_path);
+        return 0;
+    }
+
+    int reachable = 0;
+    fprintf(fp, "## Ranked by tonarchy (connect latency, %d KiB sample throughput)\n\n", MIRROR_SAMPLE_BYTES / 1024);
+    for (int i = 0; i < count; i++) {
+        Mirror_Probe *m = &mirrors[i];
+        if (m->state == MIRROR_DONE) {
+            reachable++;
+            fprintf(fp, "# %.1f ms, %.2f MiB/s\n", m->connect_ms, m->throughput / (1024.0 * 1024.0));
+            LOG_INFO("Mirror %s: %.1f ms, %.2f MiB/s", m->server, m->connect_ms, m->throughput / (1024.0 * 1024.0));
+        } else {
+            fprintf(fp, "# unreachable within %d ms\n#", budget_ms);
+            LOG_INFO("Mirror %s: no sample within budget", m->server);
+        }
+        fprintf(fp, "Server = %s\n", m->server);
+    }
+    fclose(fp);
+
+    if (reachable == 0) {
+        LOG_WARN("No mirror answered within %d ms, keeping %s", budget_ms, out_path);
+        unlink(tmp_path);
+        return 0;
+    }
+
+    if (rename(tmp_path, out_path) != 0) {
+        LOG_ERROR("Failed to replace %s", out_path);
+        unlink(tmp_path);
+        return 0;
+    }
+
+    LOG_INFO("Ranked %d mirrors (%d reachable) into %s", count, reachable, out_path);
+    return 1;
+}
+
+static int rank_live_mirrors(void) {
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+
+    clear_screen();
+    draw_logo(cols);
+
+    int logo_start = get_logo_start(cols);
+    screen_put(10, logo_start, STYLE_WHITE, "Ranking package mirrors...");
+    screen_present();
+
+    mirrors_ranked = rank_mirrors(MIRRORLIST_PATH, MIRRORLIST_PATH, MIRROR_RANK_BUDGET_MS);
+    return mirrors_ranked;
+}
+
+static void draw_form(
+        const char *username,
+        const char *password,
+        const char *confirmed_password,
+        const char *hostname,
+        const char *keyboard,
+        const char *timezone,
+        int current_field
+    ) {
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+
+    clear_screen();
+    draw_logo(cols);
+
+    int logo_start = get_logo_start(cols);
+    int form_row = 10;
+
+    screen_put(form_row, logo_start, STYLE_WHITE, "Setup your system:");
+    form_row += 2;
+
+    Tui_Field fields[] = {
+        {"Username",         username,           NULL,       0},
+        {"Password",         password,           NULL,       1},
+        {"Confirm Password", confirmed_password, NULL,       1},
+        {"Hostname",         hostname,           "tonarchy", 0},
+        {"Keyboard",         keyboard,           "us",       0},
+        {"Timezone",         timezone,           NULL,       0},
+    };
+    int num_fields = (int)(ARRAY_LEN(fields));
+
+    for (int i = 0; i < num_fields; i++) {
+        int col = logo_start;
+        if (current_field == i) {
+            col = screen_put(form_row + i, col, STYLE_BLUE_BOLD, ">");
+            col = screen_put(form_row + i, col, STYLE_DEFAULT, " ");
+        } else {
+            col = screen_put(form_row + i, col, STYLE_DEFAULT, "  ");
+        }
+
+        col = screen_put(form_row + i, col, STYLE_WHITE, "%s: ", fields[i].label);
+
+        if (strlen(fields[i].value) > 0) {
+            screen_put(form_row + i, col, STYLE_GREEN, "%s", fields[i].is_password ? "********" : fields[i].value);
+        } else if (current_field != i) {
+            if (fields[i].default_display) {
+                screen_put(form_row + i, col, STYLE_GRAY, "%s", fields[i].default_display);
+            } else {
+                screen_put(form_row + i, col, STYLE_GRAY, "[not set]");
+            }
+        }
+    }
+
+    screen_present();
+}
+
+static int validate_alphanumeric(const char *s) {
+    for (int i = 0; s[i]; i++) {
+        if (!isalnum(s[i]) && s[i] != '-' && s[i] != '_')
+            return 0;
+    }
+    return 1;
+}
+
+static int read_line(char *buf, int size, int echo) {
+    struct termios old_term;
+    tcgetattr(STDIN_FILENO, &old_term);
+    struct termios new_term = old_term;
+    if (echo)
+        new_term.c_lflag |= ECHO;
+    else
+        new_term.c_lflag &= ~ECHO;
+    new_term.c_lflag |= ICANON;
+    new_term.c_lflag &= ~ISIG;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &new_term);
+
+    int result = (fgets(buf, size, stdin) != NULL);
+    if (result)
+        buf[strcspn(buf, "\n")] = '\0';
+
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_term);
+    screen_invalidate();
+    return result;
+}
+
+static Fuzzy_Index timezone_index;
+static Fuzzy_Index keymap_index;
+static Fuzzy_Index *fuzzy_scan_index;
+static size_t fuzzy_scan_root_len;
+
+static void fuzzy_index_add(Fuzzy_Index *index, const char *name, size_t len) {
+    if (index->count >= FUZZY_MAX_ITEMS || len == 0 || len >= FUZZY_NAME_MAX) {
+        return;
+    }
+    for (int i = 0; i < index->count; i++) {
+        if (strncmp(index->names[i], name, len) == 0 && index->names[i][len] == '\0') {
+            return;
+        }
+    }
+    memcpy(index->names[index->count], name, len);
+    index->names[index->count][len] = '\0';
+    index->count++;
+}
+
+static int timezone_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)ftw;
+    const char *name = path + fuzzy_scan_root_len + 1;
+    if ((type != FTW_F && type != FTW_SL) || !isupper((unsigned char)name[0])) {
+        return 0;
+    }
+
+    char magic[4];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) && memcmp(magic, "TZif", 4) == 0) {
+            fuzzy_index_add(fuzzy_scan_index, name, strlen(name));
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+static int keymap_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    if (type != FTW_F && type != FTW_SL) {
+        return 0;
+    }
+    const char *name = path + ftw->base;
+    const char *ext = strstr(name, ".map");
+    if (ext && (strcmp(ext, ".map") == 0 || strcmp(ext, ".map.gz") == 0)) {
+        fuzzy_index_add(fuzzy_scan_index, name, (size_t)(ext - name));
+    }
+    return 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp((const char *)a, (const char *)b);
+}
+
+static Fuzzy_Index *load_fuzzy_index(Fuzzy_Index *index, const char *root,
+                                     int (*entry)(const char *, const struct stat *, int, struct FTW *)) {
+    if (!index->loaded) {
+        fuzzy_scan_index = index;
+        fuzzy_scan_root_len = strlen(root);
+        if (nftw(root, entry, 32, FTW_PHYS) != 0) {
+            LOG_WARN("Failed to index %s: %s", root, strerror(errno));
+        }
+        qsort(index->names, (size_t)index->count, sizeof(index->names[0]), compare_names);
+        index->loaded = 1;
+        LOG_INFO("Indexed %d entries under %s", index->count, root);
+    }
+    return index;
+}
+
+static int fuzzy_score(const char *name, const char *query) {
+    if (!query[0]) {
+        return 0;
+    }
+
+    int score = 0;
+    int streak = 0;
+    const char *q = query;
+    for (const char *p = name; *p && *q; p++) {
+        if (tolower((unsigned char)*p) != tolower((unsigned char)*q)) {
+            streak = 0;
+            score--;
+            continue;
+        }
+        int boundary = p == name || p[-1] == '/' || p[-1] == '_' || p[-1] == '-';
+        streak++;
+        score += 16 + streak * 8 + (boundary ? 24 : 0) + (*p == *q ? 2 : 0);
+        q++;
+    }
+    return *q ? -1 : score + (strcasecmp(name, query) == 0 ? 1000 : 0);
+}
+
+static int compare_matches(const void *a, const void *b) {
+    const Fuzzy_Match *ma = a;
+    const Fuzzy_Match *mb = b;
+    if (ma->score != mb->score) {
+        return mb->score - ma->score;
+    }
+    return ma->item - mb->item;
+}
+
+static int fuzzy_filter(const Fuzzy_Index *index, const char *query, Fuzzy_Match *matches) {
+    int count = 0;
+    for (int i = 0; i < index->count; i++) {
+        int score = fuzzy_score(index->names[i], query);
+        if (score >= 0) {
+            matches[count++] = (Fuzzy_Match){ i, score };
+        }
+    }
+    qsort(matches, (size_t)count, sizeof(matches[0]), compare_matches);
+    return count;
+}
+
+static void draw_fuzzy(const char *prompt, const Fuzzy_Index *index, const char *query,
+                       const Fuzzy_Match *matches, int match_count, int selected) {
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+
+    clear_screen();
+    draw_logo(cols);
+
+    int logo_start = get_logo_start(cols);
+    int start_row = get_menu_start_row(cols);
+    int visible = rows - start_row - 3;
+    if (visible < 1) visible = 1;
+    int first = selected >= visible ? selected - visible + 1 : 0;
+
+    int col = screen_put(start_row, logo_start, STYLE_WHITE, "%s: ", prompt);
+    int cursor_col = screen_put(start_row, col, STYLE_GREEN, "%s", query);
+    screen_put(start_row, cursor_col + 1, STYLE_GRAY, "%d/%d", match_count, index->count);
+
+    for (int i = 0; i < visible && first + i < match_count; i++) {
+        const char *name = index->names[matches[first + i].item];
+        if (first + i == selected) {
+            screen_put(start_row + 2 + i, logo_start + 2, STYLE_BLUE_BOLD, "> %s", name);
+        } else {
+            screen_put(start_row + 2 + i, logo_start + 2, STYLE_WHITE, "  %s", name);
+        }
+    }
+
+    screen_put(rows, logo_start, STYLE_YELLOW, "Type to filter  Up/Down Move  Enter Select  Esc Cancel");
+    screen_cursor(start_row, cursor_col);
+    screen_present();
+}
+
+enum {
+    KEY_ESCAPE = 27,
+    KEY_UP = 256,
+    KEY_DOWN,
+    KEY_UNKNOWN
+};
+
+static int read_escape_key(void) {
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    char seq[2];
+    if (poll(&pfd, 1, 30) <= 0 || read(STDIN_FILENO, &seq[0], 1) != 1 ||
+        poll(&pfd, 1, 30) <= 0 || read(STDIN_FILENO, &seq[1], 1) != 1) {
+        return KEY_ESCAPE;
+    }
+    if (seq[0] == '[' && seq[1] == 'A') return KEY_UP;
+    if (seq[0] == '[' && seq[1] == 'B') return KEY_DOWN;
+    return KEY_UNKNOWN;
+}
+
+static int fuzzy_select(char *dest, const char *prompt, const Fuzzy_Index *index, const char *default_val) {
+    static Fuzzy_Match matches[FUZZY_MAX_ITEMS];
+    char query[FUZZY_QUERY_MAX];
+    snprintf(query, sizeof(query), "%s", dest[0] ? dest : default_val ? default_val : "");
+
+    int match_count = fuzzy_filter(index, query, matches);
+    int selected = 0;
+    int chosen = 0;
+
+    enable_raw_mode();
+    while (1) {
+        draw_fuzzy(prompt, index, query, matches, match_count, selected);
+
+        char c;
+        if (read(STDIN_FILENO, &c, 1) != 1) {
+            break;
+        }
+
+        size_t len = strlen(query);
+        int key = c == KEY_ESCAPE ? read_escape_key() : (unsigned char)c;
+        if (key == KEY_ESCAPE) {
+            break;
+        } else if (key == '\r' || key == '\n') {
+            if (match_count > 0) {
+                snprintf(dest, FUZZY_NAME_MAX, "%s", index->names[matches[selected].item]);
+                chosen = 1;
+                break;
+            }
+        } else if (key == KEY_UP || key == 16) {
+            if (selected > 0) selected--;
+        } else if (key == KEY_DOWN || key == 14) {
+            if (selected < match_count - 1) selected++;
+        } else if (key == 127 || key == 8 || key == 21) {
+            if (len > 0) {
+                query[key == 21 ? 0 : len - 1] = '\0';
+                match_count = fuzzy_filter(index, query, matches);
+                selected = 0;
+            }
+        } else if (key < KEY_UP && isprint(key) && len + 1 < sizeof(query)) {
+            query[len] = (char)key;
+            query[len + 1] = '\0';
+            match_count = fuzzy_filter(index, query, matches);
+            selected = 0;
+        }
+    }
+    disable_raw_mode();
+
+    if (!dest[0] && default_val) {
+        snprintf(dest, FUZZY_NAME_MAX, "%s", default_val);
+    }
+    return chosen;
+}
+
+static int select_keymap(char *keyboard) {
+    return fuzzy_select(keyboard, "Keyboard", load_fuzzy_index(&keymap_index, KEYMAPS_DIR, keymap_entry), "us");
+}
+
+static int select_timezone(char *timezone) {
+    return fuzzy_select(timezone, "Timezone", load_fuzzy_index(&timezone_index, ZONEINFO_DIR, timezone_entry), NULL);
+}
+
+static int handle_password_entry(
+        char *password,
+        char *confirmed_password,
+        int form_row,
+        int logo_start,
+        char *username,
+        char *hostname,
+        char *keyboard,
+        char *timezone
+    ) {
+    char temp_input[256];
+    char password_confirm[256];
+
+    screen_cursor(form_row + 1, logo_start + 13);
+    screen_present();
+
+    if (!read_line(temp_input, sizeof(temp_input), 0))
+        return -1;
+
+    if (strlen(temp_input) == 0) {
+        show_message("Password cannot be empty");
+        return 0;
+    }
+
+    strcpy(password, temp_input);
+
+    draw_form(username, password, confirmed_password, hostname, keyboard, timezone, 2);
+    screen_cursor(form_row + 2, logo_start + 20);
+    screen_present();
+
+    if (!read_line(password_confirm, sizeof(password_confirm), 0))
+        return -1;
+
+    if (strcmp(password, password_confirm) == 0) {
+        strcpy(confirmed_password, password_confirm);
+        return 1;
+    } else {
+        show_message("Passwords do not match");
+        return 0;
+    }
+}
+
+static int get_form_input(
+        char *username,
+        char *password,
+        char *confirmed_password,
+        char *hostname,
+        char *keyboard,
+        char *timezone
+    ) {
+    char temp_input[256];
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+    int logo_start = get_logo_start(cols);
+    int form_row = 12;
+
+    Form_Field fields[] = {
+        {username, NULL,       INPUT_TEXT,         13, "Username must be alphanumeric"},
+        {password, NULL,       INPUT_PASSWORD,     13, NULL},
+        {confirmed_password, NULL, INPUT_PASSWORD, 20, NULL},
+        {hostname, "tonarchy", INPUT_TEXT,         13, "Hostname must be alphanumeric"},
+        {keyboard, "us",       INPUT_KEYMAP,   0,  NULL},
+        {timezone, NULL,       INPUT_TIMEZONE, 0,  "Timezone is required"},
+    };
+    int num_fields = (int)(ARRAY_LEN(fields));
+
+    int current_field = 0;
+    while (current_field < num_fields) {
+        draw_form(username, password, confirmed_password, hostname, keyboard, timezone, current_field);
+        Form_Field *f = &fields[current_field];
+
+        if (f->type == INPUT_KEYMAP) {
+            select_keymap(keyboard);
+            current_field++;
+        } else if (f->type == INPUT_TIMEZONE) {
+            select_timezone(timezone);
+            if (strlen(timezone) == 0) {
+                show_message("Timezone is required");
+            } else {
+                current_field++;
+            }
+        } else if (current_field == 1) {
+            int result = handle_password_entry(
+                password,
+                confirmed_password,
+                form_row,
+                logo_start,
+                username,
+                hostname,
+                keyboard,
+                timezone
+            );
+            if (result == -1) return 0;
+            if (result == 1) current_field = 3;
+        } else if (current_field == 2) {
+            current_field = 1;
+        } else {
+            screen_cursor(form_row + current_field, logo_start + f->cursor_offset);
+            screen_present();
+
+            if (!read_line(temp_input, sizeof(temp_input), 1))
+                return 0;
+
+            if (strlen(temp_input) == 0) {
+                if (f->default_val) {
+                    strcpy(f->dest, f->default_val);
+                    current_field++;
+                }
+            } else if (validate_alphanumeric(temp_input)) {
+                strcpy(f->dest, temp_input);
+                current_field++;
+            } else {
+                show_message(f->error_msg);
+            }
+        }
+    }
+
+    while (1) {
+        draw_form(username, password, confirmed_password, hostname, keyboard, timezone, 6);
+
+        get_terminal_size(&rows, &cols);
+        logo_start = get_logo_start(cols);
+
+        screen_put(20, logo_start, STYLE_YELLOW, "Press Enter to continue, or field number to edit (0-5)");
+        screen_present();
+
+        enable_raw_mode();
+        char c;
+        if (read(STDIN_FILENO, &c, 1) == 1) {
+            if (c == '\r' || c == '\n') {
+                disable_raw_mode();
+                return 1;
+            }
+            if (c == 'q' || c == 27) {
+                disable_raw_mode();
+                return 0;
+            }
+            if (c >= '0' && c <= '5') {
+                disable_raw_mode();
+                int edit_field = c - '0';
+                Form_Field *f = &fields[edit_field];
+
+                if (f->type == INPUT_KEYMAP) {
+                    select_keymap(keyboard);
+                } else if (f->type == INPUT_TIMEZONE) {
+                    select_timezone(timezone);
+                    if (strlen(timezone) == 0)
+                        show_message("Timezone is required");
+                } else if (edit_field == 1 || edit_field == 2) {
+                    draw_form(username, password, confirmed_password, hostname, keyboard, timezone, 1);
+                    handle_password_entry(password, confirmed_password,
+                                          form_row, logo_start,
+                                          username, hostname, keyboard, timezone);
+                } else {
+                    draw_form(username, password, confirmed_password, hostname, keyboard, timezone, edit_field);
+                    screen_cursor(form_row + edit_field, logo_start + f->cursor_offset);
+                    screen_present();
+
+                    if (read_line(temp_input, sizeof(temp_input), 1)) {
+                        if (strlen(temp_input) == 0 && f->default_val) {
+                            strcpy(f->dest, f->default_val);
+                        } else if (strlen(temp_input) > 0) {
+                            if (validate_alphanumeric(temp_input))
+                                strcpy(f->dest, temp_input);
+                            else
+                                show_message(f->error_msg);
+                        }
+                    }
+                }
+                continue;
+            }
+        }
+        disable_raw_mode();
+    }
+
+    return 1;
+}
+
+static const char *GPT_TYPE_EFI  = "C12A7328-F81F-11D2-BA4B-00A0C93EC93B";
+static const char *GPT_TYPE_SWAP = "0657FD6D-A4AB-43C4-84E5-0933C84B4F4F";
+static const char *GPT_TYPE_LINUX = "0FC63DAF-8483-4772-8E79-3D69D8477DE4";
+
+static uint32_t crc32_ieee(const void *data, size_t len) {
+    static uint32_t table[256];
+    static int table_ready = 0;
+
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        table_ready = 1;
+    }
+
+    const uint8_t *p = data;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static int guid_from_string(const char *s, uint8_t out[16]) {
+    unsigned int b[16];
+    if (sscanf(s, "%2x%2x%2x%2x-%2x%2x-%2x%2x-%2x%2x-%2x%2x%2x%2x%2x%2x",
+               &b[3], &b[2], &b[1], &b[0], &b[5], &b[4], &b[7], &b[6],
+               &b[8], &b[9], &b[10], &b[11], &b[12], &b[13], &b[14], &b[15]) != 16) {
+        return 0;
+    }
+    for (int i = 0; i < 16; i++) out[i] = (uint8_t)b[i];
+    return 1;
+}
+
+static int random_bytes(uint8_t *out, size_t len) {
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, out, len);
+    close(fd);
+    return n == (ssize_t)len;
+}
+
+static int random_guid(uint8_t out[16]) {
+    if (!random_bytes(out, 16)) return 0;
+    out[7] = (uint8_t)((out[7] & 0x0F) | 0x40);
+    out[8] = (uint8_t)((out[8] & 0x3F) | 0x80);
+    return 1;
+}
+
+static Partition *layout_part(Disk_Layout *layout, Part_Role role) {
+    for (int i = 0; i < layout->count; i++) {
+        if (layout->parts[i].role == role) {
+            return &layout->parts[i];
+        }
+    }
+    return NULL;
+}
+
+static int probe_disk_geometry(int fd, uint64_t *bytes, uint32_t *sector_size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return 0;
+
+    if (S_ISBLK(st.st_mode)) {
+        int ssz = 0;
+        if (ioctl(fd, BLKGETSIZE64, bytes) != 0 || ioctl(fd, BLKSSZGET, &ssz) != 0) {
+            return 0;
+        }
+        *sector_size = (uint32_t)ssz;
+    } else {
+        *bytes = (uint64_t)st.st_size;
+        *sector_size = 512;
+    }
+    return *bytes > 0 && *sector_size >= 512;
+}
+
+static uint64_t read_sysfs_u64(const char *disk, const char *attr, uint64_t fallback) {
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/block/%s/queue/%s", disk, attr);
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return fallback;
+    }
+    unsigned long long value = 0;
+    int ok = fscanf(fp, "%llu", &value) == 1;
+    fclose(fp);
+    return ok ? (uint64_t)value : fallback;
+}
+
+static uint64_t gcd_u64(uint64_t a, uint64_t b) {
+    while (b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static uint64_t lcm_u64(uint64_t a, uint64_t b) {
+    if (a == 0) return b;
+    if (b == 0) return a;
+    return a / gcd_u64(a, b) * b;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t align) {
+    return (value + align - 1) / align * align;
+}
+
+static void read_disk_topology(Disk_Layout *layout) {
+    Disk_Topology *t = &layout->topo;
+    uint32_t ss = layout->sector_size;
+
+    t->logical_block = ss;
+    t->physical_block = (uint32_t)read_sysfs_u64(layout->disk, "physical_block_size", ss);
+    t->minimum_io = (uint32_t)read_sysfs_u64(layout->disk, "minimum_io_size", t->physical_block);
+    t->optimal_io = (uint32_t)read_sysfs_u64(layout->disk, "optimal_io_size", 0);
+
+    if (t->physical_block < ss || t->physical_block % ss != 0) {
+        t->physical_block = ss;
+    }
+    if (t->minimum_io < t->physical_block || t->minimum_io % t->physical_block != 0) {
+        t->minimum_io = t->physical_block;
+    }
+    if (t->optimal_io % t->minimum_io != 0) {
+        LOG_WARN("Ignoring optimal_io_size %u (not a multiple of minimum_io_size %u)", t->optimal_io, t->minimum_io);
+        t->optimal_io = 0;
+    }
+
+    t->alignment = lcm_u64(lcm_u64(PART_ALIGN_BYTES, t->minimum_io), t->optimal_io);
+    if (t->alignment > MAX_ALIGN_BYTES) {
+        LOG_WARN("Alignment %llu exceeds %llu, using minimum_io only",
+                 (unsigned long long)t->alignment, (unsigned long long)MAX_ALIGN_BYTES);
+        t->optimal_io = 0;
+        t->alignment = lcm_u64(PART_ALIGN_BYTES, t->minimum_io);
+    }
+
+    LOG_INFO("Topology of /dev/%s: logical %u, physical %u, min_io %u, opt_io %u, alignment %llu",
+             layout->disk, t->logical_block, t->physical_block, t->minimum_io, t->optimal_io,
+             (unsigned long long)t->alignment);
+}
+
+static const char *DEVICE_CLASS_NAMES[] = {"HDD", "SSD", "NVMe"};
+
+static void disk_transport(const char *disk, char *out, size_t size) {
+    char link[256];
+    char resolved[PATH_MAX];
+    snprintf(link, sizeof(link), "/sys/block/%s", disk);
+    snprintf(out, size, "unknown");
+
+    if (!realpath(link, resolved)) {
+        return;
+    }
+
+    static const struct { const char *needle; const char *name; } transports[] = {
+        {"/nvme", "nvme"}, {"/usb", "usb"}, {"/mmc", "mmc"}, {"/virtio", "virtio"},
+        {"/ata", "sata"}, {"/host", "scsi"}, {"/virtual/", "virtual"},
+    };
+    for (size_t i = 0; i < sizeof(transports) / sizeof(transports[0]); i++) {
+        if (strstr(resolved, transports[i].needle)) {
+            snprintf(out, size, "%s", transports[i].name);
+            return;
+        }
+    }
+}
+
+static Device_Class classify_device(const char *disk, const char *transport) {
+    if (strcmp(transport, "nvme") == 0) {
+        return DEVICE_NVME;
+    }
+    return read_sysfs_u64(disk, "rotational", 1) == 0 ? DEVICE_SSD : DEVICE_HDD;
+}
+
+static void read_device_class(Disk_Layout *layout) {
+    disk_transport(layout->disk, layout->transport, sizeof(layout->transport));
+    layout->device_class = classify_device(layout->disk, layout->transport);
+
+    LOG_INFO("Device class of /dev/%s: %s (transport %s)",
+             layout->disk, DEVICE_CLASS_NAMES[layout->device_class], layout->transport);
+}
+
+typedef struct {
+    char name[64];
+    char model[64];
+    char transport[16];
+    Device_Class device_class;
+    uint64_t size_bytes;
+    int removable;
+    uint32_t logical_block;
+    uint32_t physical_block;
+    int partitions;
+    char in_use[64];
+    int score;
+} Disk_Info;
+
+static const char *IGNORED_BLOCK_PREFIXES[] = {"loop", "ram", "zram", "sr", "fd", "dm-", "nbd"};
+static const char *IGNORED_MMC_HW_PARTS[] = {"boot", "rpmb"};
+
+static int ignored_block_device(const char *name) {
+    for (size_t i = 0; i < ARRAY_LEN(IGNORED_BLOCK_PREFIXES); i++) {
+        if (strncmp(name, IGNORED_BLOCK_PREFIXES[i], strlen(IGNORED_BLOCK_PREFIXES[i])) == 0) {
+            return 1;
+        }
+    }
+    if (strncmp(name, "mmcblk", 6) == 0) {
+        const char *rest = name + 6;
+        while (isdigit((unsigned char)*rest)) rest++;
+        for (size_t i = 0; i < ARRAY_LEN(IGNORED_MMC_HW_PARTS); i++) {
+            if (strncmp(rest, IGNORED_MMC_HW_PARTS[i], strlen(IGNORED_MMC_HW_PARTS[i])) == 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int read_sysfs_string(const char *path, char *out, size_t size) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        out[0] = '\0';
+        return 0;
+    }
+    if (!fgets(out, size, fp)) {
+        out[0] = '\0';
+    }
+    fclose(fp);
+
+    size_t len = strlen(out);
+    while (len > 0 && isspace((unsigned char)out[len - 1])) {
+        out[--len] = '\0';
+    }
+    return len > 0;
+}
+
+static void format_size(uint64_t bytes, char *out, size_t size) {
+    const char *units = "BKMGTP";
+    double value = (double)bytes;
+    int unit = 0;
+    while (value >= 1024.0 && unit < 5) {
+        value /= 1024.0;
+        unit++;
+    }
+    snprintf(out, size, "%.1f%c", value, units[unit]);
+}
+
+static int load_active_devices(const char *path, int field, char *out, size_t size) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return 0;
+    }
+
+    size_t used = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        char cols[2][512];
+        if (sscanf(line, "%511s %511s", cols[0], cols[1]) < field + 1) continue;
+        if (strncmp(cols[0], "/dev/", 5) != 0) continue;
+        int n = snprintf(out + used, size - used, "%s %s\n", cols[0] + 5, field == 1 ? cols[1] : "[SWAP]");
+        if (n < 0 || (size_t)n >= size - used) break;
+        used += (size_t)n;
+    }
+    fclose(fp);
+    return 1;
+}
+
+static void find_device_user(const char *active, const char *device, char *out, size_t size) {
+    size_t len = strlen(device);
+    const char *line = active;
+    while (line && *line) {
+        if (strncmp(line, device, len) == 0 && line[len] == ' ') {
+            const char *where = line + len + 1;
+            size_t where_len = strcspn(where, "\n");
+            snprintf(out, size, "%.*s", (int)where_len, where);
+            return;
+        }
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+}
+
+static int dir_has_entries(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+    struct dirent *entry;
+    int found = 0;
+    while (!found && (entry = readdir(dir)) != NULL) {
+        found = entry->d_name[0] != '.';
+    }
+    closedir(dir);
+    return found;
+}
+
+static void check_disk_usage(Disk_Info *info, const char *active) {
+    char path[512];
+
+    find_device_user(active, info->name, info->in_use, sizeof(info->in_use));
+    snprintf(path, sizeof(path), "/sys/block/%s/holders", info->name);
+    if (!info->in_use[0] && dir_has_entries(path)) {
+        snprintf(info->in_use, sizeof(info->in_use), "held by device mapper/RAID");
+    }
+
+    snprintf(path, sizeof(path), "/sys/block/%s", info->name);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+    size_t name_len = strlen(info->name);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, info->name, name_len) != 0) continue;
+        info->partitions++;
+        if (info->in_use[0]) continue;
+
+        find_device_user(active, entry->d_name, info->in_use, sizeof(info->in_use));
+        snprintf(path, sizeof(path), "/sys/block/%s/%s/holders", info->name, entry->d_name);
+        if (!info->in_use[0] && dir_has_entries(path)) {
+            snprintf(info->in_use, sizeof(info->in_use), "%s held by device mapper/RAID", entry->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+static int disk_speed_score(const Disk_Info *info) {
+    int score = info->device_class == DEVICE_NVME ? 30 : info->device_class == DEVICE_SSD ? 20 : 10;
+    if (strcmp(info->transport, "usb") == 0 || strcmp(info->transport, "mmc") == 0) {
+        score -= 8;
+    }
+    return score;
+}
+
+static int compare_disks(const void *a, const void *b) {
+    const Disk_Info *da = a;
+    const Disk_Info *db = b;
+    int usable_a = da->in_use[0] == '\0';
+    int usable_b = db->in_use[0] == '\0';
+    if (usable_a != usable_b) return usable_b - usable_a;
+    if (da->score != db->score) return db->score - da->score;
+    if (da->size_bytes != db->size_bytes) return da->size_bytes < db->size_bytes ? 1 : -1;
+    return strcmp(da->name, db->name);
+}
+
+static int scan_disks(Disk_Info *disks, int max) {
+    DIR *dir = opendir("/sys/block");
+    if (!dir) {
+        return 0;
+    }
+
+    static char active[65536];
+    active[0] = '\0';
+    load_active_devices("/proc/self/mounts", 1, active, sizeof(active));
+    size_t used = strlen(active);
+    load_active_devices("/proc/swaps", 0, active + used, sizeof(active) - used);
+
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && count < max) {
+        if (entry->d_name[0] == '.' || ignored_block_device(entry->d_name)) continue;
+
+        Disk_Info *info = &disks[count];
+        memset(info, 0, sizeof(*info));
+        snprintf(info->name, sizeof(info->name), "%s", entry->d_name);
+
+        char path[512];
+        char value[64];
+        snprintf(path, sizeof(path), "/sys/block/%s/size", info->name);
+        if (!read_sysfs_string(path, value, sizeof(value))) continue;
+        info->size_bytes = strtoull(value, NULL, 10) * 512;
+        if (info->size_bytes == 0) continue;
+
+        snprintf(path, sizeof(path), "/sys/block/%s/device/model", info->name);
+        if (!read_sysfs_string(path, info->model, sizeof(info->model))) {
+            snprintf(info->model, sizeof(info->model), "Unknown model");
+        }
+        snprintf(path, sizeof(path), "/sys/block/%s/removable", info->name);
+        info->removable = read_sysfs_string(path, value, sizeof(value)) && value[0] == '1';
+
+        disk_transport(info->name, info->transport, sizeof(info->transport));
+        info->device_class = classify_device(info->name, info->transport);
+        info->logical_block = (uint32_t)read_sysfs_u64(info->name, "logical_block_size", 512);
+        info->physical_block = (uint32_t)read_sysfs_u64(info->name, "physical_block_size", info->logical_block);
+        check_disk_usage(info, active);
+        info->score = disk_speed_score(info);
+        count++;
+    }
+    closedir(dir);
+
+    qsort(disks, (size_t)count, sizeof(Disk_Info), compare_disks);
+    return count;
+}
+
+static int select_disk(char *disk_name) {
+
+    Disk_Info disks[MAX_DISKS];
+    int disk_count = scan_disks(disks, MAX_DISKS);
+    if (disk_count == 0) {
+        show_message("No disks found");
+        return 0;
+    }
+
+    char labels[MAX_DISKS][256];
+    const char *disk_ptrs[MAX_DISKS];
+    for (int i = 0; i < disk_count; i++) {
+        const Disk_Info *d = &disks[i];
+        char size[16];
+        format_size(d->size_bytes, size, sizeof(size));
+
+        char status[96] = "";
+        if (d->in_use[0]) {
+            snprintf(status, sizeof(status), " [in use: %s]", d->in_use);
+        } else if (i == 0) {
+            snprintf(status, sizeof(status), " [fastest]");
+        }
+
+        snprintf(labels[i], sizeof(labels[i]), "%-8s %7s  %-4s %-6s %u/%u  %d part%s  %.32s%s%s",
+                 d->name, size, DEVICE_CLASS_NAMES[d->device_class], d->transport,
+                 d->logical_block, d->physical_block, d->partitions, d->partitions == 1 ? "" : "s",
+                 d->model, d->removable ? " (removable)" : "", status);
+        disk_ptrs[i] = labels[i];
+        LOG_INFO("Disk: %s", labels[i]);
+    }
+
+    int selected;
+    for (;;) {
+        selected = select_from_menu(disk_ptrs, disk_count);
+        if (selected < 0) {
+            return 0;
+        }
+        if (!disks[selected].in_use[0]) {
+            break;
+        }
+        char message[256];
+        snprintf(message, sizeof(message), "/dev/%s is in use (%s)", disks[selected].name, disks[selected].in_use);
+        show_message(message);
+    }
+
+    strcpy(disk_name, disks[selected].name);
+
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+    clear_screen();
+    draw_logo(cols);
+
+    int logo_start = get_logo_start(cols);
+    int col = screen_put(10, logo_start, STYLE_WHITE, "WARNING: All data on ");
+    col = screen_put(10, col, STYLE_RED, "/dev/%s", disk_name);
+    screen_put(10, col, STYLE_WHITE, " will be destroyed!");
+    int prompt_end = screen_put(12, logo_start, STYLE_WHITE, "Type 'yes' to confirm: ");
+    screen_cursor(12, prompt_end);
+    screen_present();
+
+    char confirm[256];
+    struct termios old_term;
+    tcgetattr(STDIN_FILENO, &old_term);
+    struct termios new_term = old_term;
+    new_term.c_lflag |= (ECHO | ICANON);
+    new_term.c_lflag &= ~ISIG;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &new_term);
+
+    if (fgets(confirm, sizeof(confirm), stdin) == NULL) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_term);
+        return 0;
+    }
+    confirm[strcspn(confirm, "\n")] = '\0';
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_term);
+    screen_invalidate();
+
+    if (strcmp(confirm, "yes") != 0) {
+        show_message("Installation cancelled");
+        return 0;
+    }
+
+    return 1;
+}
+
+static void ext4_mkfs_options(const Disk_Layout *layout, char *out, size_t size) {
+    const Disk_Topology *t = &layout->topo;
+    char ext_opts[192];
+    int len;
+
+    if (layout->device_class == DEVICE_HDD) {
+        len = snprintf(out, size, "-b %d -G 64 -J size=256", EXT4_BLOCK_SIZE);
+        snprintf(ext_opts, sizeof(ext_opts), "nodiscard,lazy_itable_init=1,lazy_journal_init=0");
+    } else {
+        len = snprintf(out, size, "-b %d", EXT4_BLOCK_SIZE);
+        snprintf(ext_opts, sizeof(ext_opts), "discard,lazy_itable_init=1,lazy_journal_init=1");
+    }
+
+    uint32_t stride = t->minimum_io > EXT4_BLOCK_SIZE ? t->minimum_io / EXT4_BLOCK_SIZE : 0;
+    uint32_t stripe_width = t->optimal_io > EXT4_BLOCK_SIZE ? t->optimal_io / EXT4_BLOCK_SIZE : 0;
+    size_t ext_len = strlen(ext_opts);
+    if (stride) {
+        ext_len += snprintf(ext_opts + ext_len, sizeof(ext_opts) - ext_len, ",stride=%u", stride);
+    }
+    if (stripe_width) {
+        snprintf(ext_opts + ext_len, sizeof(ext_opts) - ext_len, ",stripe_width=%u", stripe_width);
+    }
+
+    snprintf(out + len, size - len, " -E %s", ext_opts);
+}
+
+static void btrfs_mkfs_command(const Disk_Layout *layout, const Partition *part, char *out, size_t size) {
+    (void)layout;
+    snprintf(out, size, "mkfs.btrfs -f -L root %s", part->path);
+}
+
+static void ext4_mkfs_command(const Disk_Layout *layout, const Partition *part, char *out, size_t size) {
+    char opts[256];
+    ext4_mkfs_options(layout, opts, sizeof(opts));
+    snprintf(out, size, "mkfs.ext4 -F -L root %s %s", opts, part->path);
+}
+
+static void xfs_mkfs_command(const Disk_Layout *layout, const Partition *part, char *out, size_t size) {
+    const Disk_Topology *t = &layout->topo;
+    char stripe[64] = "";
+    if (t->minimum_io > EXT4_BLOCK_SIZE && t->optimal_io > t->minimum_io) {
+        snprintf(stripe, sizeof(stripe), " -d su=%u,sw=%u", t->minimum_io, t->optimal_io / t->minimum_io);
+    }
+    snprintf(out, size, "mkfs.xfs -f -L root%s %s", stripe, part->path);
+}
+
+static void f2fs_mkfs_command(const Disk_Layout *layout, const Partition *part, char *out, size_t size) {
+    (void)layout;
+    snprintf(out, size, "mkfs.f2fs -f -l root -O extra_attr,inode_checksum,sb_checksum,compression %s", part->path);
+}
+
+static int mount_root_plain(const char *device, const char *options) {
+    return run_cmd("mount", "-o", options, device, CHROOT_PATH, NULL);
+}
+
+static const struct {
+    const char *name;
+    const char *mount_point;
+} BTRFS_SUBVOLUMES[] = {
+    {"@",     ""},
+    {"@home", "home"},
+    {"@pkg",  "var/cache/pacman/pkg"},
+    {"@log",  "var/log"},
+};
+
+static int mount_root_btrfs(const char *device, const char *options) {
+    if (!run_cmd("mount", "-o", "subvolid=5", device, CHROOT_PATH, NULL)) {
+        return 0;
+    }
+    for (size_t i = 0; i < ARRAY_LEN(BTRFS_SUBVOLUMES); i++) {
+        char subvol[256];
+        snprintf(subvol, sizeof(subvol), "%s/%s", CHROOT_PATH, BTRFS_SUBVOLUMES[i].name);
+        struct stat st;
+        if (stat(subvol, &st) == 0) {
+            continue;
+        }
+        if (!run_cmd("btrfs", "subvolume", "create", subvol, NULL)) {
+            LOG_ERROR("Failed to create btrfs subvolume %s", BTRFS_SUBVOLUMES[i].name);
+            run_cmd("umount", CHROOT_PATH, NULL);
+            return 0;
+        }
+    }
+    if (!run_cmd("umount", CHROOT_PATH, NULL)) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < ARRAY_LEN(BTRFS_SUBVOLUMES); i++) {
+        char target[256];
+        char subvol_options[256];
+        snprintf(target, sizeof(target), "%s/%s", CHROOT_PATH, BTRFS_SUBVOLUMES[i].mount_point);
+        snprintf(subvol_options, sizeof(subvol_options), "%s,subvol=%s", options, BTRFS_SUBVOLUMES[i].name);
+        if (!run_cmd("mkdir", "-p", target, NULL) ||
+            !run_cmd("mount", "-o", subvol_options, device, target, NULL)) {
+            LOG_ERROR("Failed to mount btrfs subvolume %s on %s", BTRFS_SUBVOLUMES[i].name, target);
+            return 0;
+        }
+        LOG_INFO("Mounted btrfs subvolume %s on %s", BTRFS_SUBVOLUMES[i].name, target);
+    }
+    return 1;
+}
+
+typedef struct {
+    Fs_Type type;
+    const char *name;
+    const char *description;
+    const char *package;
+    const char *mount_options;
+    const char *kernel_options;
+    void (*mkfs_command)(const Disk_Layout *layout, const Partition *part, char *out, size_t size);
+    int (*mount_root)(const char *device, const char *options);
+} Filesystem_Ops;
+
+static const Filesystem_Ops FILESYSTEMS[] = {
+    { FS_EXT4,  "ext4",  "ext4",
+      "e2fsprogs",   "defaults", "",
+      ext4_mkfs_command,  mount_root_plain },
+    { FS_BTRFS, "btrfs", "btrfs (zstd compression, @ @home @pkg @log subvolumes)",
+      "btrfs-progs", "noatime,compress=zstd:1", "rootflags=subvol=@",
+      btrfs_mkfs_command, mount_root_btrfs },
+    { FS_XFS,   "xfs",   "XFS",
+      "xfsprogs",    "noatime", "",
+      xfs_mkfs_command,   mount_root_plain },
+    { FS_F2FS,  "f2fs",  "F2FS (flash-friendly, zstd compression)",
+      "f2fs-tools",  "noatime,lazytime,compress_algorithm=zstd,compress_chksum,compress_extension=*", "",
+      f2fs_mkfs_command,  mount_root_plain },
+};
+
+static const Filesystem_Ops *find_filesystem(Fs_Type type) {
+    for (size_t i = 0; i < ARRAY_LEN(FILESYSTEMS); i++) {
+        if (FILESYSTEMS[i].type == type) {
+            return &FILESYSTEMS[i];
+        }
+    }
+    return &FILESYSTEMS[0];
+}
+
+static const Filesystem_Ops *layout_fs(const Disk_Layout *layout) {
+    return find_filesystem(layout->fs);
+}
+
+static Fs_Type recommended_filesystem(const Disk_Layout *layout) {
+    if (layout->device_class == DEVICE_HDD) {
+        return FS_EXT4;
+    }
+    if (layout->uefi && (strcmp(layout->transport, "mmc") == 0 || strcmp(layout->transport, "usb") == 0)) {
+        return FS_F2FS;
+    }
+    return FS_BTRFS;
+}
+
+static int select_filesystem(Disk_Layout *layout) {
+    Fs_Type recommended = recommended_filesystem(layout);
+    const char *items[ARRAY_LEN(FILESYSTEMS)];
+    char labels[ARRAY_LEN(FILESYSTEMS)][128];
+    Fs_Type types[ARRAY_LEN(FILESYSTEMS)];
+    int count = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < ARRAY_LEN(FILESYSTEMS); i++) {
+            int is_recommended = FILESYSTEMS[i].type == recommended;
+            if (is_recommended != (pass == 0)) continue;
+            if (FILESYSTEMS[i].type == FS_F2FS && !layout->uefi) continue;
+            snprintf(labels[count], sizeof(labels[count]), "%s%s", FILESYSTEMS[i].description,
+                     is_recommended ? " [recommended]" : "");
+            items[count] = labels[count];
+            types[count] = FILESYSTEMS[i].type;
+            count++;
+        }
+    }
+
+    int choice = select_from_menu(items, count);
+    if (choice < 0) {
+        return 0;
+    }
+    layout->fs = types[choice];
+    LOG_INFO("Root filesystem: %s (recommended for %s: %s)", layout_fs(layout)->name,
+             DEVICE_CLASS_NAMES[layout->device_class], find_filesystem(recommended)->name);
+    return 1;
+}
+
+typedef struct {
+    const Partition *part;
+    char cmd[512];
+    char *argv[EXEC_MAX_ARGS];
+    Exec_Process proc;
+    Exec_Result result;
+} Format_Job;
+
+static int split_args(char *line, char **argv, int max) {
+    int argc = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(line, " ", &save); tok && argc < max - 1; tok = strtok_r(NULL, " ", &save)) {
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+static int format_partitions(const Disk_Layout *layout) {
+    Format_Job jobs[MAX_FORMAT_JOBS];
+    Exec_Process procs[MAX_FORMAT_JOBS];
+    int job_count = 0;
+
+    for (int i = 0; i < layout->count && job_count < MAX_FORMAT_JOBS; i++) {
+        const Partition *p = &layout->parts[i];
+        Format_Job *job = &jobs[job_count++];
+        job->part = p;
+        job->result = (Exec_Result){ .status = -1 };
+
+        if (p->role == PART_EFI) {
+            snprintf(job->cmd, sizeof(job->cmd), "mkfs.fat -F32 -S %u %s",
+                     layout->topo.logical_block, p->path);
+        } else if (p->role == PART_SWAP) {
+            snprintf(job->cmd, sizeof(job->cmd), "mkswap %s", p->path);
+        } else {
+            layout_fs(layout)->mkfs_command(layout, p, job->cmd, sizeof(job->cmd));
+        }
+    }
+
+    struct timespec begin, now;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    Progress_Pane pane;
+    progress_begin(&pane, "Formatting partitions", NULL, NULL);
+    pane.items = job_count;
+    Exec_Options opts = { .on_line = progress_line, .on_tick = progress_tick, .observer = &pane };
+
+    for (int i = 0; i < job_count; i++) {
+        LOG_INFO("Formatting %s: %s", jobs[i].part->name, jobs[i].cmd);
+        split_args(jobs[i].cmd, jobs[i].argv, EXEC_MAX_ARGS);
+        if (!exec_start(jobs[i].argv, &opts, &procs[i])) {
+            LOG_ERROR("Failed to spawn mkfs for %s", jobs[i].part->path);
+        }
+    }
+
+    Exec_Result result;
+    int done;
+    while ((done = exec_wait_any(procs, job_count, &result)) >= 0) {
+        jobs[done].result = result;
+        pane.item++;
+        snprintf(pane.current, sizeof(pane.current), "Formatted %s", jobs[done].part->path);
+        clock_gettime(CLOCK_MONOTONIC, &pane.last_activity);
+        progress_draw(&pane);
+    }
+    progress_end(&pane);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int failures = 0;
+    double serial_ms = 0;
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].result.status != 0) {
+            LOG_ERROR("Failed to format %s partition: %s", jobs[i].part->name, jobs[i].part->path);
+            failures++;
+            continue;
+        }
+        serial_ms += jobs[i].result.wall_ms;
+        LOG_INFO("Formatted %s partition %s in %.2fs (cpu %.2fs)", jobs[i].part->name, jobs[i].part->path,
+                 jobs[i].result.wall_ms / 1000.0, jobs[i].result.cpu_ms / 1000.0);
+    }
+    LOG_INFO("Formatted %d partitions in %.2fs (%.2fs if run serially)",
+             job_count, elapsed_ms(&begin, &now) / 1000.0, serial_ms / 1000.0);
+
+    return failures == 0;
+}
+
+static void add_partition(Disk_Layout *layout, Part_Role role, const char *name, uint64_t start, uint64_t size) {
+    Partition *p = &layout->parts[layout->count];
+    p->number = layout->count + 1;
+    p->role = role;
+    p->start = start;
+    p->size = size;
+    snprintf(p->name, sizeof(p->name), "%s", name);
+
+    char path[sizeof(p->path)];
+    part_path(path, sizeof(path), layout->disk, p->number);
+    memcpy(p->path, path, sizeof(path));
+    layout->count++;
+}
+
+static int compute_disk_layout(Disk_Layout *layout) {
+    const uint64_t align = layout->topo.alignment ? layout->topo.alignment : PART_ALIGN_BYTES;
+    uint64_t usable = layout->disk_bytes;
+    if (layout->uefi) {
+        usable -= (1 + (GPT_ENTRY_COUNT * GPT_ENTRY_SIZE + layout->sector_size - 1) / layout->sector_size) *
+                  (uint64_t)layout->sector_size;
+    }
+    uint64_t end = usable / align * align;
+    if (!layout->uefi) {
+        uint64_t mbr_end = MBR_MAX_SECTORS * layout->sector_size / align * align;
+        if (end > mbr_end) {
+            LOG_WARN("MBR addresses at most %llu GiB, leaving the rest of /dev/%s unpartitioned",
+                     (unsigned long long)(mbr_end >> 30), layout->disk);
+            end = mbr_end;
+        }
+    }
+
+    uint64_t offset = align;
+    layout->count = 0;
+
+    if (layout->uefi) {
+        uint64_t efi_size = align_up(EFI_PART_BYTES, align);
+        add_partition(layout, PART_EFI, "EFI", offset, efi_size);
+        offset += efi_size;
+    }
+    if (layout->swap.mode == SWAP_PARTITION) {
+        uint64_t swap_size = align_up(layout->swap.size_bytes, align);
+        add_partition(layout, PART_SWAP, "swap", offset, swap_size);
+        offset += swap_size;
+    }
+
+    if (end <= offset + MIN_ROOT_BYTES) {
+        LOG_ERROR("Disk /dev/%s is too small (%llu bytes)", layout->disk, (unsigned long long)layout->disk_bytes);
+        return 0;
+    }
+    add_partition(layout, PART_ROOT, "root", offset, end - offset);
+
+    for (int i = 0; i < layout->count; i++) {
+        LOG_INFO("Partition %d (%s): start %llu MiB, size %llu MiB",
+                 layout->parts[i].number, layout->parts[i].name,
+                 (unsigned long long)(layout->parts[i].start >> 20),
+                 (unsigned long long)(layout->parts[i].size >> 20));
+    }
+    return 1;
+}
+
+static int write_zeroes(int fd, uint64_t offset, uint64_t len) {
+    static const uint8_t zero[65536];
+    while (len > 0) {
+        size_t chunk = len > sizeof(zero) ? sizeof(zero) : (size_t)len;
+        if (pwrite(fd, zero, chunk, (off_t)offset) != (ssize_t)chunk) return 0;
+        offset += chunk;
+        len -= chunk;
+    }
+    return 1;
+}
+
+static void mbr_entry(uint8_t *e, int bootable, uint8_t type, uint64_t start_lba, uint64_t count) {
+    if (count > 0xFFFFFFFFu) count = 0xFFFFFFFFu;
+    e[0] = bootable ? 0x80 : 0x00;
+    e[1] = 0xFE; e[2] = 0xFF; e[3] = 0xFF;
+    e[4] = type;
+    e[5] = 0xFE; e[6] = 0xFF; e[7] = 0xFF;
+    put_le32(e + 8, (uint32_t)start_lba);
+    put_le32(e + 12, (uint32_t)count);
+}
+
+static int write_gpt(int fd, const Disk_Layout *layout) {
+    const uint32_t ss = layout->sector_size;
+    const uint64_t last_lba = layout->disk_bytes / ss - 1;
+    const uint32_t entries_bytes = GPT_ENTRY_COUNT * GPT_ENTRY_SIZE;
+    const uint64_t entries_sectors = (entries_bytes + ss - 1) / ss;
+
+    uint8_t mbr[512] = {0};
+    mbr_entry(mbr + 446, 0, 0xEE, 1, last_lba);
+    mbr[510] = 0x55;
+    mbr[511] = 0xAA;
+
+    static uint8_t entries[GPT_ENTRY_COUNT * GPT_ENTRY_SIZE];
+    memset(entries, 0, sizeof(entries));
+    for (int i = 0; i < layout->count; i++) {
+        const Partition *p = &layout->parts[i];
+        uint8_t *e = entries + (size_t)i * GPT_ENTRY_SIZE;
+        const char *type = p->role == PART_EFI ? GPT_TYPE_EFI :
+                           p->role == PART_SWAP ? GPT_TYPE_SWAP : GPT_TYPE_LINUX;
+        if (!guid_from_string(type, e) || !random_guid(e + 16)) return 0;
+        put_le64(e + 32, p->start / ss);
+        put_le64(e + 40, (p->start + p->size) / ss - 1);
+        for (size_t c = 0; p->name[c] && c < 36; c++) {
+            put_le16(e + 56 + c * 2, (uint16_t)(unsigned char)p->name[c]);
+        }
+    }
+    uint32_t entries_crc = crc32_ieee(entries, entries_bytes);
+
+    uint8_t disk_guid[16];
+    if (!random_guid(disk_guid)) return 0;
+
+    uint8_t primary[512] = {0};
+    memcpy(primary, "EFI PART", 8);
+    put_le32(primary + 8, 0x00010000);
+    put_le32(primary + 12, 92);
+    put_le64(primary + 40, 2 + entries_sectors);
+    put_le64(primary + 48, last_lba - 1 - entries_sectors);
+    memcpy(primary + 56, disk_guid, 16);
+    put_le32(primary + 80, GPT_ENTRY_COUNT);
+    put_le32(primary + 84, GPT_ENTRY_SIZE);
+    put_le32(primary + 88, entries_crc);
+
+    uint8_t backup[512];
+    memcpy(backup, primary, sizeof(backup));
+
+    put_le64(primary + 24, 1);
+    put_le64(primary + 32, last_lba);
+    put_le64(primary + 72, 2);
+    put_le32(primary + 16, crc32_ieee(primary, 92));
+
+    put_le64(backup + 24, last_lba);
+    put_le64(backup + 32, 1);
+    put_le64(backup + 72, last_lba - entries_sectors);
+    put_le32(backup + 16, crc32_ieee(backup, 92));
+
+    return pwrite(fd, mbr, sizeof(mbr), 0) == (ssize_t)sizeof(mbr) &&
+           pwrite(fd, primary, sizeof(primary), (off_t)ss) == (ssize_t)sizeof(primary) &&
+           pwrite(fd, entries, entries_bytes, (off_t)(2 * ss)) == (ssize_t)entries_bytes &&
+           pwrite(fd, entries, entries_bytes, (off_t)((last_lba - entries_sectors) * ss)) == (ssize_t)entries_bytes &&
+           pwrite(fd, backup, sizeof(backup), (off_t)(last_lba * ss)) == (ssize_t)sizeof(backup);
+}
+
+static int write_mbr(int fd, const Disk_Layout *layout) {
+    const uint32_t ss = layout->sector_size;
+    uint8_t mbr[512] = {0};
+
+    if (!random_bytes(mbr + 440, 4)) return 0;
+    for (int i = 0; i < layout->count; i++) {
+        const Partition *p = &layout->parts[i];
+        mbr_entry(mbr + 446 + i * 16, p->role == PART_ROOT,
+                  p->role == PART_SWAP ? 0x82 : 0x83, p->start / ss, p->size / ss);
+    }
+    mbr[510] = 0x55;
+    mbr[511] = 0xAA;
+
+    return pwrite(fd, mbr, sizeof(mbr), 0) == (ssize_t)sizeof(mbr);
+}
+
+static int rescan_partitions(int fd, const Disk_Layout *layout) {
+    if (ioctl(fd, BLKRRPART) == 0) {
+        return 1;
+    }
+    LOG_WARN("BLKRRPART failed (%s), updating partitions with BLKPG", strerror(errno));
+
+    for (int n = 1; n <= 16; n++) {
+        struct blkpg_partition part = { .pno = n };
+        struct blkpg_ioctl_arg arg = { .op = BLKPG_DEL_PARTITION, .datalen = sizeof(part), .data = &part };
+        ioctl(fd, BLKPG, &arg);
+    }
+
+    for (int i = 0; i < layout->count; i++) {
+        struct blkpg_partition part = {
+            .start = (long long)layout->parts[i].start,
+            .length = (long long)layout->parts[i].size,
+            .pno = layout->parts[i].number
+        };
+        struct blkpg_ioctl_arg arg = { .op = BLKPG_ADD_PARTITION, .datalen = sizeof(part), .data = &part };
+        if (ioctl(fd, BLKPG, &arg) != 0) {
+            LOG_ERROR("BLKPG add partition %d failed: %s", part.pno, strerror(errno));
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int write_partition_table(const char *dev_path, Disk_Layout *layout) {
+    int fd = open(dev_path, O_RDWR | O_CLOEXEC | O_EXCL);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open %s: %s", dev_path, strerror(errno));
+        return 0;
+    }
+
+    struct stat st;
+    int is_block = fstat(fd, &st) == 0 && S_ISBLK(st.st_mode);
+
+    if (!probe_disk_geometry(fd, &layout->disk_bytes, &layout->sector_size)) {
+        close(fd);
+        return 0;
+    }
+    read_disk_topology(layout);
+    if (!compute_disk_layout(layout)) {
+        close(fd);
+        return 0;
+    }
+
+    int ok = write_zeroes(fd, 0, PART_ALIGN_BYTES) &&
+             write_zeroes(fd, layout->disk_bytes - PART_ALIGN_BYTES, PART_ALIGN_BYTES);
+    if (ok) {
+        ok = layout->uefi ? write_gpt(fd, layout) : write_mbr(fd, layout);
+    }
+    if (ok) {
+        ok = fsync(fd) == 0;
+    }
+    if (!ok) {
+        LOG_ERROR("Failed to write partition table to %s: %s", dev_path, strerror(errno));
+        close(fd);
+        return 0;
+    }
+    LOG_INFO("Wrote %s partition table to %s", layout->uefi ? "GPT" : "MBR", dev_path);
+
+    if (is_block && !rescan_partitions(fd, layout)) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+static int wait_for_partitions(const Disk_Layout *layout) {
+    run_cmd("udevadm", "settle", "--timeout=10", NULL);
+
+    for (int tries = 0; tries < 50; tries++) {
+        int ready = 1;
+        struct stat st;
+        for (int i = 0; i < layout->count; i++) {
+            if (stat(layout->parts[i].path, &st) != 0 || !S_ISBLK(st.st_mode)) {
+                ready = 0;
+                break;
+            }
+        }
+        if (ready) return 1;
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = 100000000 };
+        nanosleep(&ts, NULL);
+    }
+
+    LOG_ERROR("Partition device nodes did not appear for /dev/%s", layout->disk);
+    return 0;
+}
+
+static const char *SWAP_MODE_NAMES[] = {"zram", "zswap + swap file", "swap partition"};
+
+static uint64_t read_mem_total(void) {
+    FILE *fp = fopen("/proc/meminfo", "r");
+    if (!fp) {
+        return 0;
+    }
+
+    char line[256];
+    unsigned long long kib = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "MemTotal: %llu kB", &kib) == 1) {
+            break;
+        }
+    }
+    fclose(fp);
+    return (uint64_t)kib * 1024;
+}
+
+static void plan_swap(Disk_Layout *layout) {
+    Swap_Plan *plan = &layout->swap;
+    uint64_t ram = read_mem_total();
+    int slow_flash = strcmp(layout->transport, "mmc") == 0 ||
+                     (strcmp(layout->transport, "usb") == 0 && layout->device_class != DEVICE_HDD);
+    int swapfile_ok = layout->fs == FS_EXT4 || layout->fs == FS_XFS;
+
+    plan->ram_bytes = ram;
+    if (slow_flash || ram >= ZRAM_ONLY_RAM_BYTES) {
+        plan->mode = SWAP_ZRAM;
+        plan->size_bytes = slow_flash ? ram : ram / 2;
+    } else if (layout->device_class == DEVICE_HDD) {
+        plan->mode = SWAP_PARTITION;
+        plan->size_bytes = ram <= SWAP_MIN_BYTES ? ram * 2 : ram;
+    } else if (swapfile_ok) {
+        plan->mode = SWAP_ZSWAP_FILE;
+        plan->size_bytes = ram;
+    } else {
+        plan->mode = SWAP_ZRAM;
+        plan->size_bytes = ram;
+    }
+
+    if (plan->size_bytes > SWAP_MAX_BYTES) plan->size_bytes = SWAP_MAX_BYTES;
+    if (plan->size_bytes < SWAP_MIN_BYTES) plan->size_bytes = SWAP_MIN_BYTES;
+
+    LOG_INFO("Swap plan: %s, %llu MiB (RAM %llu MiB, %s on %s)",
+             SWAP_MODE_NAMES[plan->mode], (unsigned long long)(plan->size_bytes >> 20),
+             (unsigned long long)(ram >> 20), layout_fs(layout)->name,
+             DEVICE_CLASS_NAMES[layout->device_class]);
+}
+
+static int create_swapfile(uint64_t size_bytes) {
+    char size[32];
+    snprintf(size, sizeof(size), "%llu", (unsigned long long)size_bytes);
+    if (!run_cmd("fallocate", "-l", size, CHROOT_PATH SWAPFILE_PATH, NULL) ||
+        !run_cmd("chmod", "600", CHROOT_PATH SWAPFILE_PATH, NULL) ||
+        !run_cmd("mkswap", CHROOT_PATH SWAPFILE_PATH, NULL) ||
+        !run_cmd("swapon", CHROOT_PATH SWAPFILE_PATH, NULL)) {
+        LOG_ERROR("Failed to create swap file %s%s", CHROOT_PATH, SWAPFILE_PATH);
+        return 0;
+    }
+    LOG_INFO("Enabled %llu MiB swap file", (unsigned long long)(size_bytes >> 20));
+    return 1;
+}
+
+static void swap_kernel_options(const Swap_Plan *plan, char *out, size_t size) {
+    if (plan->mode == SWAP_ZRAM) {
+        snprintf(out, size, "zswap.enabled=0");
+    } else if (plan->mode == SWAP_ZSWAP_FILE) {
+        snprintf(out, size, "zswap.enabled=1 zswap.compressor=%s zswap.max_pool_percent=20", ZRAM_ALGORITHM);
+    } else {
+        out[0] = '\0';
+    }
+}
+
+static void build_kernel_options(const Disk_Layout *layout, char *out, size_t size) {
+    char swap_opts[128];
+    const char *fs_opts = layout_fs(layout)->kernel_options;
+
+    swap_kernel_options(&layout->swap, swap_opts, sizeof(swap_opts));
+    snprintf(out, size, "%s%s%s", fs_opts, fs_opts[0] && swap_opts[0] ? " " : "", swap_opts);
+}
+
+static int configure_swap(const Disk_Layout *layout) {
+    if (layout->swap.mode != SWAP_ZRAM) {
+        return 1;
+    }
+
+    if (!write_file_fmt("/mnt/etc/systemd/zram-generator.conf",
+            "[zram0]\n"
+            "zram-size = %llu\n"
+            "compression-algorithm = %s\n"
+            "swap-priority = 100\n",
+            (unsigned long long)(layout->swap.size_bytes >> 20), ZRAM_ALGORITHM)) {
+        LOG_ERROR("Failed to write zram-generator.conf");
+        return 0;
+    }
+
+    if (!write_file("/mnt/etc/sysctl.d/99-vm-zram-parameters.conf",
+            "vm.swappiness = 180\n"
+            "vm.watermark_boost_factor = 0\n"
+            "vm.watermark_scale_factor = 125\n"
+            "vm.page-cluster = 0\n")) {
+        LOG_ERROR("Failed to write zram sysctl parameters");
+        return 0;
+    }
+
+    LOG_INFO("Configured %llu MiB zram swap (%s)", (unsigned long long)(layout->swap.size_bytes >> 20), ZRAM_ALGORITHM);
+    return 1;
+}
+
+static int is_mountpoint(const char *path) {
+    char parent[PATH_MAX];
+    struct stat st, parent_st;
+    snprintf(parent, sizeof(parent), "%s/..", path);
+    if (stat(path, &st) != 0 || stat(parent, &parent_st) != 0) {
+        return 0;
+    }
+    return st.st_dev != parent_st.st_dev || st.st_ino == parent_st.st_ino;
+}
+
+static int swap_active(const char *path) {
+    FILE *fp = fopen("/proc/swaps", "r");
+    if (!fp) {
+        return 0;
+    }
 
-    if (!read_line(password_confirm, sizeof(password_confirm), 0))
-        return -1;
+    int active = 0;
+    char line[512];
+    char name[256];
+    while (!active && fgets(line, sizeof(line), fp)) {
+        active = sscanf(line, "%255s", name) == 1 && strcmp(name, path) == 0;
+    }
+    fclose(fp);
+    return active;
+}
 
-    if (strcmp(password, password_confirm) == 0) {
-        strcpy(confirmed_password, password_confirm);
-        return 1;
-    } else {
-        show_message("Passwords do not match");
+static int mount_target(Disk_Layout *layout) {
+    Partition *efi = layout_part(layout, PART_EFI);
+    Partition *swap = layout_part(layout, PART_SWAP);
+    Partition *root = layout_part(layout, PART_ROOT);
+
+    const Filesystem_Ops *fs = layout_fs(layout);
+    if (is_mountpoint(CHROOT_PATH)) {
+        LOG_INFO("Root partition already mounted on %s", CHROOT_PATH);
+    } else if (!fs->mount_root(root->path, fs->mount_options)) {
+        LOG_ERROR("Failed to mount root: %s", root->path);
         return 0;
+    } else {
+        LOG_INFO("Mounted %s root partition (%s)", fs->name, fs->mount_options);
+    }
+
+    if (efi && !is_mountpoint(CHROOT_PATH "/boot")) {
+        mkdir(CHROOT_PATH "/boot", 0755);
+        if (!run_cmd("mount", efi->path, CHROOT_PATH "/boot", NULL)) {
+            LOG_ERROR("Failed to mount EFI: %s", efi->path);
+            return 0;
+        }
+        LOG_INFO("Mounted EFI partition");
+    }
+
+    struct stat st;
+    if (swap) {
+        if (!swap_active(swap->path) && !run_cmd("swapon", swap->path, NULL)) {
+            LOG_ERROR("Failed to enable swap: %s", swap->path);
+            return 0;
+        }
+        LOG_INFO("Enabled swap partition");
+    } else if (layout->swap.mode == SWAP_ZSWAP_FILE) {
+        if (stat(CHROOT_PATH SWAPFILE_PATH, &st) != 0) {
+            return create_swapfile(layout->swap.size_bytes);
+        }
+        if (!swap_active(CHROOT_PATH SWAPFILE_PATH) && !run_cmd("swapon", CHROOT_PATH SWAPFILE_PATH, NULL)) {
+            LOG_ERROR("Failed to enable swap file %s%s", CHROOT_PATH, SWAPFILE_PATH);
+            return 0;
+        }
     }
+    return 1;
 }
 
-static int get_form_input(
-        char *username,
-        char *password,
-        char *confirmed_password,
-        char *hostname,
-        char *keyboard,
-        char *timezone
-    ) {
-    char temp_input[256];
+static int partition_disk(Disk_Layout *layout) {
     int rows, cols;
     get_terminal_size(&rows, &cols);
+
+    clear_screen();
+    draw_logo(cols);
+
     int logo_start = get_logo_start(cols);
-    int form_row = 12;
+    const char *disk = layout->disk;
 
-    Form_Field fields[] = {
-        {username, NULL,       INPUT_TEXT,         13, "Username must be alphanumeric"},
-        {password, NULL,       INPUT_PASSWORD,     13, NULL},
-        {confirmed_password, NULL, INPUT_PASSWORD, 20, NULL},
-        {hostname, "tonarchy", INPUT_TEXT,         13, "Hostname must be alphanumeric"},
-        {keyboard, "us",       INPUT_FZF_KEYMAP,   0,  NULL},
-        {timezone, NULL,       INPUT_FZF_TIMEZONE, 0,  "Timezone is required"},
-    };
-    int num_fields = (int)(ARRAY_LEN(fields));
+    screen_put(10, logo_start, STYLE_WHITE, "Partitioning /dev/%s (%s mode)...", disk, layout->uefi ? "UEFI" : "BIOS");
+    screen_present();
 
-    int current_field = 0;
-    while (current_field < num_fields) {
-        draw_form(username, password, confirmed_password, hostname, keyboard, timezone, current_field);
-        Form_Field *f = &fields[current_field];
+    LOG_INFO("Starting disk partitioning: /dev/%s (mode: %s)", disk, layout->uefi ? "UEFI" : "BIOS");
 
-        if (f->type == INPUT_FZF_KEYMAP) {
-            fzf_select(keyboard, "localectl list-keymaps | fzf --height=40% --reverse --prompt='Keyboard: ' --header='Start typing to filter, Enter to select' --query='us'", "us");
-            current_field++;
-        } else if (f->type == INPUT_FZF_TIMEZONE) {
-            fzf_select(timezone, "timedatectl list-timezones | fzf --height=40% --reverse --prompt='Timezone: ' --header='Type your city/timezone, Enter to select'", NULL);
-            if (strlen(timezone) == 0) {
-                show_message("Timezone is required");
-            } else {
-                current_field++;
-            }
-        } else if (current_field == 1) {
-            int result = handle_password_entry(
-                password,
-                confirmed_password,
-                form_row,
-                logo_start,
-                username,
-                hostname,
-                keyboard,
-                timezone
-            );
-            if (result == -1) return 0;
-            if (result == 1) current_field = 3;
-        } else if (current_field == 2) {
-            current_field = 1;
-        } else {
-            printf(ANSI_CURSOR_POS, form_row + current_field, logo_start + f->cursor_offset);
-            fflush(stdout);
+    char dev_path[128];
+    snprintf(dev_path, sizeof(dev_path), "/dev/%s", disk);
+    if (!write_partition_table(dev_path, layout) || !wait_for_partitions(layout)) {
+        show_message("Failed to create partitions");
+        return 0;
+    }
+    LOG_INFO("Created %d partitions", layout->count);
 
-            if (!read_line(temp_input, sizeof(temp_input), 1))
-                return 0;
+    screen_put(11, logo_start, STYLE_WHITE, "Formatting partitions (%s)...",
+           DEVICE_CLASS_NAMES[layout->device_class]);
+    screen_present();
 
-            if (strlen(temp_input) == 0) {
-                if (f->default_val) {
-                    strcpy(f->dest, f->default_val);
-                    current_field++;
-                }
-            } else if (validate_alphanumeric(temp_input)) {
-                strcpy(f->dest, temp_input);
-                current_field++;
-            } else {
-                show_message(f->error_msg);
-            }
+    if (!format_partitions(layout)) {
+        show_message("Failed to format partitions");
+        return 0;
+    }
+
+    screen_put(12, logo_start, STYLE_WHITE, "Mounting partitions...");
+    screen_present();
+
+    if (!mount_target(layout)) {
+        show_message("Failed to mount partitions");
+        return 0;
+    }
+    LOG_INFO("Disk partitioning completed successfully");
+
+    show_message("Disk prepared successfully!");
+    return 1;
+}
+
+static void stop_package_prefetch(void) {
+    if (prefetch_pid <= 0) {
+        return;
+    }
+    kill(prefetch_pid, SIGTERM);
+    waitpid(prefetch_pid, NULL, 0);
+    prefetch_pid = -1;
+    LOG_INFO("Package prefetch stopped");
+}
+
+static int start_package_prefetch(const char *package_list) {
+    mkdir(PREFETCH_DIR, 0755);
+    mkdir(PREFETCH_DIR "/db", 0755);
+    mkdir(PREFETCH_DIR "/pkg", 0755);
+
+    struct statvfs vfs;
+    int fetch_packages = statvfs(PREFETCH_DIR, &vfs) == 0 &&
+        (unsigned long long)vfs.f_bavail * vfs.f_frsize >= PREFETCH_MIN_FREE_BYTES;
+
+    char packages[MAX_CMD_SIZE];
+    char *argv[MAX_PROFILE_PACKAGES + 16];
+    int argc = 0;
+
+    argv[argc++] = "pacman";
+    argv[argc++] = fetch_packages ? "-Syw" : "-Sy";
+    argv[argc++] = "--noconfirm";
+    argv[argc++] = "--dbpath";
+    argv[argc++] = PREFETCH_DIR "/db";
+    argv[argc++] = "--cachedir";
+    argv[argc++] = PREFETCH_DIR "/pkg";
+
+    if (fetch_packages) {
+        snprintf(packages, sizeof(packages), "%s", package_list);
+        char *saveptr = NULL;
+        char *token = strtok_r(packages, " ", &saveptr);
+        while (token && argc < (int)ARRAY_LEN(argv) - 1) {
+            argv[argc++] = token;
+            token = strtok_r(NULL, " ", &saveptr);
         }
+    } else {
+        LOG_WARN("Not enough space in %s to stage packages, prefetching sync databases only", PREFETCH_DIR);
     }
+    argv[argc] = NULL;
 
-    while (1) {
-        draw_form(username, password, confirmed_password, hostname, keyboard, timezone, 6);
+    pid_t pid = exec_spawn_detached(argv);
+    if (pid < 0) {
+        LOG_WARN("Failed to start package prefetch");
+        return 0;
+    }
 
-        get_terminal_size(&rows, &cols);
-        logo_start = get_logo_start(cols);
+    prefetch_pid = pid;
+    prefetch_started = time(NULL);
+    atexit(stop_package_prefetch);
+    LOG_INFO("Started package prefetch (pid %d, %d arguments)", (int)pid, argc);
+    return 1;
+}
 
-        printf(ANSI_CURSOR_POS ANSI_YELLOW "Press Enter to continue, or field number to edit (0-5)" ANSI_RESET, 20, logo_start);
-        fflush(stdout);
+static int finish_package_prefetch(void) {
+    if (prefetch_pid <= 0) {
+        return 0;
+    }
 
-        enable_raw_mode();
-        char c;
-        if (read(STDIN_FILENO, &c, 1) == 1) {
-            if (c == '\r' || c == '\n') {
-                disable_raw_mode();
-                return 1;
-            }
-            if (c == 'q' || c == 27) {
-                disable_raw_mode();
-                return 0;
-            }
-            if (c >= '0' && c <= '5') {
-                disable_raw_mode();
-                int edit_field = c - '0';
-                Form_Field *f = &fields[edit_field];
+    int status = 0;
+    if (waitpid(prefetch_pid, &status, WNOHANG) == 0) {
+        int rows, cols;
+        get_terminal_size(&rows, &cols);
+        screen_put(12, get_logo_start(cols), STYLE_WHITE, "Waiting for package prefetch to finish...");
+        screen_present();
+        waitpid(prefetch_pid, &status, 0);
+    }
+    prefetch_pid = -1;
 
-                if (f->type == INPUT_FZF_KEYMAP) {
-                    fzf_select(keyboard, "localectl list-keymaps | fzf --height=40% --reverse --prompt='Keyboard: ' --header='Start typing to filter, Enter to select' --query='us'", "us");
-                } else if (f->type == INPUT_FZF_TIMEZONE) {
-                    fzf_select(timezone, "timedatectl list-timezones | fzf --height=40% --reverse --prompt='Timezone: ' --header='Type your city/timezone, Enter to select'", NULL);
-                    if (strlen(timezone) == 0)
-                        show_message("Timezone is required");
-                } else if (edit_field == 1 || edit_field == 2) {
-                    draw_form(username, password, confirmed_password, hostname, keyboard, timezone, 1);
-                    handle_password_entry(password, confirmed_password,
-                                          form_row, logo_start,
-                                          username, hostname, keyboard, timezone);
-                } else {
-                    draw_form(username, password, confirmed_password, hostname, keyboard, timezone, edit_field);
-                    printf(ANSI_CURSOR_POS, form_row + edit_field, logo_start + f->cursor_offset);
-                    fflush(stdout);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        LOG_WARN("Package prefetch failed, pacstrap will download what is missing");
+    } else {
+        LOG_INFO("Package prefetch finished in %lds", (long)(time(NULL) - prefetch_started));
+    }
 
-                    if (read_line(temp_input, sizeof(temp_input), 1)) {
-                        if (strlen(temp_input) == 0 && f->default_val) {
-                            strcpy(f->dest, f->default_val);
-                        } else if (strlen(temp_input) > 0) {
-                            if (validate_alphanumeric(temp_input))
-                                strcpy(f->dest, temp_input);
-                            else
-                                show_message(f->error_msg);
-                        }
-                    }
-                }
-                continue;
-            }
+    create_directory("/mnt/var/lib/pacman/sync", 0755);
+    DIR *dir = opendir(PREFETCH_DIR "/db/sync");
+    struct dirent *entry;
+    int seeded = 0;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 4 || strcmp(entry->d_name + len - 3, ".db") != 0) continue;
+        char src[PATH_MAX];
+        snprintf(src, sizeof(src), "%s/db/sync/%s", PREFETCH_DIR, entry->d_name);
+        if (run_cmd("cp", "-p", src, "/mnt/var/lib/pacman/sync/", NULL)) {
+            seeded++;
         }
-        disable_raw_mode();
+    }
+    if (dir) closedir(dir);
+    if (seeded == 0) {
+        LOG_WARN("Failed to seed target sync databases from prefetch");
     }
 
     return 1;
 }
 
-static int select_disk(char *disk_name) {
+typedef struct {
+    char preset[64];
+    int ok;
+} Initramfs_Job;
+
+static int mask_initramfs_hook(void) {
+    if (!create_directory(INITRAMFS_HOOK_DIR, 0755) ||
+        (symlink("/dev/null", INITRAMFS_HOOK_MASK) != 0 && errno != EEXIST)) {
+        LOG_ERROR("Failed to mask the mkinitcpio pacman hook: %s", strerror(errno));
+        return 0;
+    }
+    LOG_INFO("Deferring initramfs generation until the system is configured");
+    return 1;
+}
+
+static void *initramfs_worker(void *arg) {
+    Initramfs_Job *job = arg;
+    job->ok = chroot_exec_fmt("mkinitcpio -p %s", job->preset);
+    return NULL;
+}
+
+static int build_initramfs(void) {
+    unlink(INITRAMFS_HOOK_MASK);
+
+    Initramfs_Job jobs[MAX_INITRAMFS_PRESETS];
+    int count = 0;
+    DIR *dir = opendir("/mnt/etc/mkinitcpio.d");
+    struct dirent *entry;
+    while (dir && count < MAX_INITRAMFS_PRESETS && (entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len > 7 && len < sizeof(jobs[0].preset) + 7 && strcmp(entry->d_name + len - 7, ".preset") == 0) {
+            snprintf(jobs[count].preset, sizeof(jobs[count].preset), "%.*s", (int)(len - 7), entry->d_name);
+            jobs[count].ok = 0;
+            count++;
+        }
+    }
+    if (dir) closedir(dir);
+    if (count == 0) {
+        LOG_ERROR("No mkinitcpio presets found on target");
+        return 0;
+    }
+
+    struct timespec begin, now;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    pthread_t threads[MAX_INITRAMFS_PRESETS];
+    int started[MAX_INITRAMFS_PRESETS] = {0};
+    for (int i = 1; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, initramfs_worker, &jobs[i]) == 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (i == 0 || !started[i]) {
+            initramfs_worker(&jobs[i]);
+        } else {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        if (!jobs[i].ok) {
+            LOG_ERROR("mkinitcpio preset %s failed", jobs[i].preset);
+            failures++;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    LOG_INFO("Built %d initramfs preset(s) in %.1fs", count, elapsed_ms(&begin, &now) / 1000.0);
+    return failures == 0;
+}
+
+static int install_packages_impl(const char *package_list) {
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+
     clear_screen();
+    draw_logo(cols);
+
+    int logo_start = get_logo_start(cols);
+    screen_put(10, logo_start, STYLE_WHITE, "Installing system packages...");
+    screen_put(11, logo_start, STYLE_WHITE, "This will take several minutes.");
+    screen_present();
+
+    LOG_INFO("Starting package installation");
+    LOG_INFO("Packages: %s", package_list);
+
+    CHECK_OR_FAIL(mask_initramfs_hook(), "Failed to prepare target for installation");
+
+    char packages[MAX_CMD_SIZE];
+    char *argv[MAX_PROFILE_PACKAGES + 16];
+    int argc = 0;
+
+    argv[argc++] = "pacstrap";
+    argv[argc++] = "-K";
+    if (offline_repo_active) {
+        LOG_INFO("Installing from offline repository");
+        argv[argc++] = "-C";
+        argv[argc++] = OFFLINE_PACMAN_CONF;
+    }
+    argv[argc++] = "/mnt";
+
+    snprintf(packages, sizeof(packages), "%s", package_list);
+    int planned = split_args(packages, argv + argc, (int)ARRAY_LEN(argv) - argc - 4);
+    argc += planned;
+
+    const char *cache_dir = CHROOT_PATH "/var/cache/pacman/pkg";
+    if (!offline_repo_active && finish_package_prefetch()) {
+        LOG_INFO("Installing with prefetched package cache");
+        cache_dir = PREFETCH_DIR "/pkg";
+        argv[argc++] = "--cachedir";
+        argv[argc++] = (char *)cache_dir;
+    }
+    argv[argc++] = "--hookdir";
+    argv[argc++] = INITRAMFS_HOOK_DIR;
+    argv[argc] = NULL;
+
+    Progress_Pane pane;
+    progress_begin(&pane, "Installing packages", cache_dir, CHROOT_PATH);
+    pane.items = planned;
+    Exec_Options opts = { .on_line = progress_line, .on_tick = progress_tick, .observer = &pane };
+    Exec_Result result;
+    exec_run(argv, &opts, &result);
+    progress_end(&pane);
+    if (result.status == 0) {
+        run_cmd("rm", "-rf", PREFETCH_DIR, NULL);
+    }
+
+    if (result.status == 0 && mirrors_ranked &&
+        !run_cmd("cp", MIRRORLIST_PATH, "/mnt" MIRRORLIST_PATH, NULL)) {
+        LOG_WARN("Failed to install ranked mirrorlist on target");
+    }
+    if (result.status != 0) {
+        LOG_ERROR("pacstrap failed with exit code %d", result.status);
+        show_message("Failed to install packages");
+        return 0;
+    }
+
+    LOG_INFO("Package installation completed successfully");
+    show_message("Packages installed successfully!");
+    return 1;
+}
+
+static int rootfs_image_available(const char *profile_name) {
+    char path[512];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s/image.conf", ROOTFS_IMAGE_DIR, profile_name);
+    return stat(path, &st) == 0;
+}
+
+static int rootfs_images_available(void) {
+    for (size_t i = 0; i < ARRAY_LEN(INSTALL_PROFILES); i++) {
+        if (rootfs_image_available(INSTALL_PROFILES[i].name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int read_image_packages(const char *profile_name, char *out, size_t out_size) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s/image.conf", ROOTFS_IMAGE_DIR, profile_name);
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        LOG_ERROR("Failed to open image manifest: %s", path);
+        return 0;
+    }
+
+    int found = 0;
+    char line[MAX_CMD_SIZE];
+    while (!found && fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "packages=", 9) == 0) {
+            snprintf(out, out_size, "%s", line + 9);
+            found = 1;
+        }
+    }
+    fclose(fp);
+
+    if (!found) {
+        LOG_ERROR("Image manifest has no package list: %s", path);
+    }
+    return found;
+}
+
+static int spawn_image_chunk(const char *chunk_path, int is_boot, const Exec_Options *opts, Exec_Process *proc) {
+    if (is_boot) {
+        char *const argv[] = {
+            "tar", "-x", "--zstd", "-f", (char *)chunk_path, "-C", CHROOT_PATH,
+            "--no-same-owner", "--no-same-permissions", NULL
+        };
+        return exec_start(argv, opts, proc);
+    }
+
+    char *const argv[] = {
+        "tar", "-x", "--zstd", "-p", "-f", (char *)chunk_path, "-C", CHROOT_PATH,
+        "--numeric-owner", "--xattrs", "--xattrs-include=*", "--acls", NULL
+    };
+    return exec_start(argv, opts, proc);
+}
+
+static int deploy_rootfs_image(const char *profile_name) {
+    char image_dir[512];
+    snprintf(image_dir, sizeof(image_dir), "%s/%s", ROOTFS_IMAGE_DIR, profile_name);
+
+    DIR *dir = opendir(image_dir);
+    if (!dir) {
+        LOG_ERROR("Failed to open image directory: %s", image_dir);
+        return 0;
+    }
+
+    char chunks[MAX_IMAGE_CHUNKS][256];
+    int chunk_count = 0;
+    unsigned long long total_bytes = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && chunk_count < MAX_IMAGE_CHUNKS) {
+        size_t len = strlen(entry->d_name);
+        if (len <= 8 || strcmp(entry->d_name + len - 8, ".tar.zst") != 0 ||
+            strcmp(entry->d_name, ROOTFS_DIRS_CHUNK) == 0) {
+            continue;
+        }
+        snprintf(chunks[chunk_count], sizeof(chunks[0]), "%s", entry->d_name);
+
+        char path[1024];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", image_dir, entry->d_name);
+        if (stat(path, &st) == 0) {
+            total_bytes += (unsigned long long)st.st_size;
+        }
+        chunk_count++;
+    }
+    closedir(dir);
 
-    FILE *fp = popen("lsblk -d -n -o NAME,SIZE,MODEL,TYPE | grep -E '(disk|nvme)' | grep -v -E '(loop|rom|airoot)' | awk '{printf \"%s (%s) %s\\n\", $1, $2, substr($0, index($0,$3))}'", "r");
-    if (fp == NULL) {
-        show_message("Failed to list disks");
+    if (chunk_count == 0) {
+        LOG_ERROR("Image %s has no chunks", image_dir);
         return 0;
     }
 
-    char disks[32][256];
-    char names[32][64];
-    int disk_count = 0;
+    long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_jobs < 2) max_jobs = 2;
+
+    Exec_Process procs[MAX_IMAGE_CHUNKS];
+    struct timespec begin, now;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    Progress_Pane pane;
+    progress_begin(&pane, "Extracting system image", NULL, CHROOT_PATH);
+    pane.items = chunk_count;
+    Exec_Options opts = { .on_tick = progress_tick, .observer = &pane };
+
+    int next = 0;
+    int running = 0;
+    int failures = 0;
+    while (next < chunk_count || running > 0) {
+        while (next < chunk_count && running < max_jobs && failures == 0) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", image_dir, chunks[next]);
+            if (!spawn_image_chunk(path, strcmp(chunks[next], "boot.tar.zst") == 0, &opts, &procs[next])) {
+                LOG_ERROR("Failed to spawn extraction for %s", chunks[next]);
+                failures++;
+                break;
+            }
+            LOG_INFO("Extracting image chunk %s", chunks[next]);
+            next++;
+            running++;
+        }
 
-    while (disk_count < 32 && fgets(disks[disk_count], sizeof(disks[0]), fp) != NULL) {
-        disks[disk_count][strcspn(disks[disk_count], "\n")] = '\0';
-        if (sscanf(disks[disk_count], "%63s", names[disk_count]) == 1) {
-            disk_count++;
+        if (running == 0) {
+            break;
         }
-    }
-    pclose(fp);
 
-    if (disk_count == 0) {
-        show_message("No disks found");
-        return 0;
+        Exec_Result result;
+        int done = exec_wait_any(procs, next, &result);
+        if (done < 0) {
+            break;
+        }
+        running--;
+        if (result.status != 0) {
+            LOG_ERROR("Extraction of %s failed (status %d)", chunks[done], result.status);
+            failures++;
+        } else {
+            LOG_INFO("Extracted %s in %.1fs", chunks[done], result.wall_ms / 1000.0);
+        }
+        pane.item++;
+        snprintf(pane.current, sizeof(pane.current), "Extracted %s", chunks[done]);
     }
 
-    const char *disk_ptrs[32];
-    for (int i = 0; i < disk_count; i++) {
-        disk_ptrs[i] = disks[i];
+    char dirs_path[1024];
+    struct stat dirs_st;
+    snprintf(dirs_path, sizeof(dirs_path), "%s/%s", image_dir, ROOTFS_DIRS_CHUNK);
+    if (failures == 0 && stat(dirs_path, &dirs_st) == 0) {
+        snprintf(pane.current, sizeof(pane.current), "Restoring directory metadata");
+        Exec_Process proc;
+        Exec_Result result;
+        if (!spawn_image_chunk(dirs_path, 0, &opts, &proc) || !exec_wait(&proc, &result) || result.status != 0) {
+            LOG_ERROR("Failed to restore directory metadata from %s", dirs_path);
+            failures++;
+        }
+    } else if (failures == 0) {
+        LOG_WARN("Image %s has no %s; directory metadata depends on extraction order",
+                 image_dir, ROOTFS_DIRS_CHUNK);
     }
+    progress_end(&pane);
 
-    int selected = select_from_menu(disk_ptrs, disk_count);
-    if (selected < 0) {
-        return 0;
-    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = elapsed_ms(&begin, &now) / 1000.0;
+    LOG_INFO("Deployed %d image chunks (%.1f MiB compressed) in %.1fs with %ld jobs",
+             chunk_count, (double)total_bytes / (1024.0 * 1024.0), seconds, max_jobs);
 
-    strcpy(disk_name, names[selected]);
+    return failures == 0;
+}
 
+static int install_profile_image(const Install_Profile *profile) {
     int rows, cols;
     get_terminal_size(&rows, &cols);
+
     clear_screen();
     draw_logo(cols);
 
     int logo_start = get_logo_start(cols);
-    printf("\033[%d;%dH\033[37mWARNING: All data on \033[31m/dev/%s\033[37m will be destroyed!\033[0m", 10, logo_start, disk_name);
-    printf("\033[%d;%dH\033[37mType 'yes' to confirm: \033[0m", 12, logo_start);
-    fflush(stdout);
+    screen_put(10, logo_start, STYLE_WHITE, "Deploying system image...");
+    screen_present();
 
-    char confirm[256];
-    struct termios old_term;
-    tcgetattr(STDIN_FILENO, &old_term);
-    struct termios new_term = old_term;
-    new_term.c_lflag |= (ECHO | ICANON);
-    new_term.c_lflag &= ~ISIG;
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &new_term);
+    LOG_INFO("Deploying rootfs image for profile '%s'", profile->name);
+    CHECK_OR_FAIL(deploy_rootfs_image(profile->name), "Failed to deploy system image");
 
-    if (fgets(confirm, sizeof(confirm), stdin) == NULL) {
-        tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_term);
-        return 0;
+    if (!run_cmd("cp", MIRRORLIST_PATH, "/mnt" MIRRORLIST_PATH, NULL)) {
+        LOG_WARN("Failed to install live mirrorlist on target");
     }
-    confirm[strcspn(confirm, "\n")] = '\0';
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_term);
 
-    if (strcmp(confirm, "yes") != 0) {
-        show_message("Installation cancelled");
+    screen_put(11, logo_start, STYLE_WHITE, "Finalizing image...");
+    screen_present();
+
+    CHECK_OR_FAIL(chroot_exec("systemd-machine-id-setup"), "Failed to set machine id");
+    CHECK_OR_FAIL(
+        chroot_exec("pacman-key --init && pacman-key --populate archlinux"),
+        "Failed to initialize pacman keyring"
+    );
+    CHECK_OR_FAIL(mask_initramfs_hook(), "Failed to prepare target for installation");
+
+    LOG_INFO("Image installation completed successfully");
+    show_message("System image deployed successfully!");
+    return 1;
+}
+
+static int read_partition_uuid(const char *path, char *uuid_out, size_t uuid_size) {
+    char *argv[] = { "blkid", "-s", "UUID", "-o", "value", (char *)path, NULL };
+    Exec_Options opts = { .capture = uuid_out, .capture_size = uuid_size, .quiet = 1 };
+
+    uuid_out[0] = '\0';
+    if (!exec_run(argv, &opts, NULL)) {
+        LOG_ERROR("Failed to get UUID for %s", path);
         return 0;
     }
+    uuid_out[strcspn(uuid_out, "\n")] = '\0';
 
+    if (strlen(uuid_out) == 0) {
+        LOG_ERROR("Empty UUID for %s", path);
+        return 0;
+    }
     return 1;
 }
 
-static int partition_disk(const char *disk) {
-    char cmd[1024];
-    int rows, cols;
-    get_terminal_size(&rows, &cols);
+typedef enum {
+    JOURNAL_NONE,
+    JOURNAL_PARTITIONED,
+    JOURNAL_PACKAGES,
+    JOURNAL_CONFIGURED,
+    JOURNAL_COMPLETE
+} Journal_Phase;
 
-    clear_screen();
-    draw_logo(cols);
+static const char *JOURNAL_PHASE_NAMES[] = {"none", "partitioned", "packages", "configured", "complete"};
 
-    int logo_start = get_logo_start(cols);
-    int uefi = is_uefi_system();
+typedef struct {
+    char profile[32];
+    Disk_Layout layout;
+    char uuids[4][64];
+    uint64_t packages_hash;
+    uint64_t config_hash;
+    Journal_Phase phase;
+    char steps[STEP_MAX][32];
+    int step_count;
+} Install_Journal;
+
+static uint64_t fnv1a_update(uint64_t hash, const char *s) {
+    while (*s) {
+        hash ^= (unsigned char)*s++;
+        hash *= 1099511628211ULL;
+    }
+    return hash ^ 0xff;
+}
 
-    char part1[64], part2[64], part3[64];
-    part_path(part1, sizeof(part1), disk, 1);
-    part_path(part2, sizeof(part2), disk, 2);
-    part_path(part3, sizeof(part3), disk, 3);
+static const char *cpu_microcode_package(void) {
+    FILE *fp = fopen("/proc/cpuinfo", "r");
+    if (!fp) {
+        return NULL;
+    }
 
-    printf("\033[%d;%dH\033[37mPartitioning /dev/%s (%s mode)...\033[0m", 10, logo_start, disk, uefi ? "UEFI" : "BIOS");
-    fflush(stdout);
+    const char *package = NULL;
+    char line[256];
+    while (!package && fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "vendor_id", 9) == 0) {
+            if (strstr(line, "GenuineIntel")) {
+                package = "intel-ucode";
+            } else if (strstr(line, "AuthenticAMD")) {
+                package = "amd-ucode";
+            } else {
+                break;
+            }
+        }
+    }
+    fclose(fp);
+    return package;
+}
+
+static int append_plan_package(char *plan, size_t plan_size, const char *package) {
+    if (!package || !package[0] || package_list_contains(plan, package)) {
+        return 1;
+    }
+    size_t used = strlen(plan);
+    int written = snprintf(plan + used, plan_size - used, "%s%s", used > 0 ? " " : "", package);
+    if (written < 0 || (size_t)written >= plan_size - used) {
+        LOG_ERROR("Package plan buffer too small while adding %s", package);
+        return 0;
+    }
+    return 1;
+}
 
-    LOG_INFO("Starting disk partitioning: /dev/%s (mode: %s)", disk, uefi ? "UEFI" : "BIOS");
+static int build_package_plan(const Install_Profile *profile, const Disk_Layout *layout, int use_image,
+                              char *plan, size_t plan_size) {
+    if (use_image) {
+        return read_image_packages(profile->name, plan, plan_size);
+    }
 
-    snprintf(cmd, sizeof(cmd), "wipefs -af /dev/%s 2>> /tmp/tonarchy-install.log", disk);
-    if (system(cmd) != 0) {
-        LOG_ERROR("Failed to wipe disk: /dev/%s", disk);
-        show_message("Failed to wipe disk");
+    if (!resolve_profile_packages(profile->name, profile->groups, profile->group_count, plan, plan_size)) {
         return 0;
     }
-    LOG_INFO("Wiped disk");
 
-    if (uefi) {
-        snprintf(cmd, sizeof(cmd), "sgdisk --zap-all /dev/%s 2>> /tmp/tonarchy-install.log", disk);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to zap disk: /dev/%s", disk);
-            show_message("Failed to zap disk");
-            return 0;
-        }
-        LOG_INFO("Zapped disk (GPT)");
-
-        snprintf(cmd, sizeof(cmd),
-            "sgdisk --clear "
-            "--new=1:0:+1G --typecode=1:ef00 --change-name=1:EFI "
-            "--new=2:0:+4G --typecode=2:8200 --change-name=2:swap "
-            "--new=3:0:0 --typecode=3:8300 --change-name=3:root "
-            "/dev/%s 2>> /tmp/tonarchy-install.log", disk);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to create partitions on /dev/%s", disk);
-            show_message("Failed to create partitions");
-            return 0;
-        }
-        LOG_INFO("Created partitions (EFI, swap, root)");
-    } else {
-        snprintf(cmd, sizeof(cmd),
-            "parted -s /dev/%s mklabel msdos "
-            "mkpart primary linux-swap 1MiB 4GiB "
-            "mkpart primary ext4 4GiB 100%% "
-            "set 2 boot on 2>> /tmp/tonarchy-install.log", disk);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to create MBR partitions on /dev/%s", disk);
-            show_message("Failed to create partitions");
+    const char *extras[] = {
+        layout_fs(layout)->package,
+        layout->swap.mode == SWAP_ZRAM ? "zram-generator" : NULL,
+        layout->uefi ? NULL : "grub",
+        cpu_microcode_package(),
+    };
+    for (size_t i = 0; i < ARRAY_LEN(extras); i++) {
+        if (!append_plan_package(plan, plan_size, extras[i])) {
             return 0;
         }
-        LOG_INFO("Created MBR partitions (swap, root)");
     }
+    return 1;
+}
 
-    printf("\033[%d;%dH\033[37mFormatting partitions...\033[0m", 11, logo_start);
-    fflush(stdout);
+static int validate_package_plan(const Install_Profile *profile, const Disk_Layout *layout, const char *plan) {
+    if (!validate_mode_profile_packages(profile->level, plan)) {
+        return 0;
+    }
 
-    if (uefi) {
-        snprintf(cmd, sizeof(cmd), "mkfs.fat -F32 %s 2>> /tmp/tonarchy-install.log", part1);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to format EFI partition: %s", part1);
-            show_message("Failed to format EFI partition");
+    const char *required[] = {
+        "base",
+        "linux",
+        layout_fs(layout)->package,
+        layout->swap.mode == SWAP_ZRAM ? "zram-generator" : NULL,
+        layout->uefi ? NULL : "grub",
+    };
+    for (size_t i = 0; i < ARRAY_LEN(required); i++) {
+        if (required[i] && !package_list_contains(plan, required[i])) {
+            LOG_ERROR("Package plan for '%s' is missing required package: %s", profile->name, required[i]);
             return 0;
         }
-        LOG_INFO("Formatted EFI partition");
+    }
+    return 1;
+}
 
-        snprintf(cmd, sizeof(cmd), "mkswap %s 2>> /tmp/tonarchy-install.log", part2);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to format swap: %s", part2);
-            show_message("Failed to format swap partition");
-            return 0;
-        }
-        LOG_INFO("Formatted swap partition");
+static uint64_t package_plan_hash(int use_image, const char *plan) {
+    uint64_t hash = 14695981039346656037ULL;
+    hash = fnv1a_update(hash, use_image ? "image" : "pacstrap");
+    return fnv1a_update(hash, plan);
+}
 
-        snprintf(cmd, sizeof(cmd), "mkfs.ext4 -F %s 2>> /tmp/tonarchy-install.log", part3);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to format root: %s", part3);
-            show_message("Failed to format root partition");
-            return 0;
-        }
-        LOG_INFO("Formatted root partition");
-    } else {
-        snprintf(cmd, sizeof(cmd), "mkswap %s 2>> /tmp/tonarchy-install.log", part1);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to format swap: %s", part1);
-            show_message("Failed to format swap partition");
-            return 0;
-        }
-        LOG_INFO("Formatted swap partition");
+static int write_file_atomic(const char *path, const char *content) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
 
-        snprintf(cmd, sizeof(cmd), "mkfs.ext4 -F %s 2>> /tmp/tonarchy-install.log", part2);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to format root: %s", part2);
-            show_message("Failed to format root partition");
-            return 0;
-        }
-        LOG_INFO("Formatted root partition");
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return 0;
+    }
+    size_t len = strlen(content);
+    int ok = write(fd, content, len) == (ssize_t)len && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return 0;
     }
+    return 1;
+}
 
-    printf("\033[%d;%dH\033[37mMounting partitions...\033[0m", 12, logo_start);
-    fflush(stdout);
+static int journal_save(const Install_Journal *journal) {
+    const Disk_Layout *layout = &journal->layout;
+    char content[MAX_CMD_SIZE];
+    int used = snprintf(content, sizeof(content),
+        "version=1\n"
+        "profile=%s\n"
+        "disk=%s\n"
+        "uefi=%d\n"
+        "fs=%s\n"
+        "swap=%d %llu\n"
+        "packages=%016llx\n"
+        "config=%016llx\n"
+        "phase=%s\n",
+        journal->profile, layout->disk, layout->uefi, layout_fs(layout)->name,
+        (int)layout->swap.mode, (unsigned long long)layout->swap.size_bytes,
+        (unsigned long long)journal->packages_hash, (unsigned long long)journal->config_hash,
+        JOURNAL_PHASE_NAMES[journal->phase]);
+    for (int i = 0; i < layout->count && used < (int)sizeof(content); i++) {
+        const Partition *p = &layout->parts[i];
+        used += snprintf(content + used, sizeof(content) - used, "part=%d %s %s %s\n",
+                         p->number, p->name, p->path, journal->uuids[i]);
+    }
+    for (int i = 0; i < journal->step_count && used < (int)sizeof(content); i++) {
+        used += snprintf(content + used, sizeof(content) - used, "step=%s\n", journal->steps[i]);
+    }
 
-    if (uefi) {
-        snprintf(cmd, sizeof(cmd), "mount %s /mnt 2>> /tmp/tonarchy-install.log", part3);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to mount root: %s", part3);
-            show_message("Failed to mount root partition");
-            return 0;
+    if (!write_file_atomic(JOURNAL_PATH, content)) {
+        LOG_WARN("Failed to write install journal %s", JOURNAL_PATH);
+        return 0;
+    }
+
+    struct stat st;
+    if (journal->phase >= JOURNAL_PARTITIONED && is_mountpoint(CHROOT_PATH)) {
+        if (stat(TARGET_JOURNAL_DIR, &st) != 0) {
+            create_directory(TARGET_JOURNAL_DIR, 0700);
+        }
+        if (!write_file_atomic(TARGET_JOURNAL_DIR "/journal", content)) {
+            LOG_WARN("Failed to mirror install journal to %s", TARGET_JOURNAL_DIR);
         }
-        LOG_INFO("Mounted root partition");
+    }
+    return 1;
+}
 
-        snprintf(cmd, sizeof(cmd), "mkdir -p /mnt/boot 2>> /tmp/tonarchy-install.log");
-        system(cmd);
+static int journal_load(const char *path, Install_Journal *journal) {
+    memset(journal, 0, sizeof(*journal));
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return 0;
+    }
 
-        snprintf(cmd, sizeof(cmd), "mount %s /mnt/boot 2>> /tmp/tonarchy-install.log", part1);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to mount EFI: %s", part1);
-            show_message("Failed to mount EFI partition");
-            return 0;
+    Disk_Layout *layout = &journal->layout;
+    int version = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *value = strchr(line, '=');
+        if (!value) continue;
+        *value++ = '\0';
+
+        if (strcmp(line, "version") == 0) {
+            version = atoi(value);
+        } else if (strcmp(line, "profile") == 0) {
+            snprintf(journal->profile, sizeof(journal->profile), "%s", value);
+        } else if (strcmp(line, "disk") == 0) {
+            snprintf(layout->disk, sizeof(layout->disk), "%s", value);
+        } else if (strcmp(line, "uefi") == 0) {
+            layout->uefi = atoi(value);
+        } else if (strcmp(line, "fs") == 0) {
+            for (size_t i = 0; i < ARRAY_LEN(FILESYSTEMS); i++) {
+                if (strcmp(FILESYSTEMS[i].name, value) == 0) layout->fs = FILESYSTEMS[i].type;
+            }
+        } else if (strcmp(line, "swap") == 0) {
+            int mode = 0;
+            unsigned long long size = 0;
+            sscanf(value, "%d %llu", &mode, &size);
+            layout->swap.mode = (Swap_Mode)mode;
+            layout->swap.size_bytes = size;
+        } else if (strcmp(line, "packages") == 0) {
+            journal->packages_hash = strtoull(value, NULL, 16);
+        } else if (strcmp(line, "config") == 0) {
+            journal->config_hash = strtoull(value, NULL, 16);
+        } else if (strcmp(line, "phase") == 0) {
+            for (size_t i = 0; i < ARRAY_LEN(JOURNAL_PHASE_NAMES); i++) {
+                if (strcmp(JOURNAL_PHASE_NAMES[i], value) == 0) journal->phase = (Journal_Phase)i;
+            }
+        } else if (strcmp(line, "part") == 0 && layout->count < (int)ARRAY_LEN(layout->parts)) {
+            Partition *p = &layout->parts[layout->count];
+            if (sscanf(value, "%d %15s %63s %63s", &p->number, p->name, p->path, journal->uuids[layout->count]) != 4) {
+                continue;
+            }
+            p->role = strcmp(p->name, "EFI") == 0 ? PART_EFI : strcmp(p->name, "swap") == 0 ? PART_SWAP : PART_ROOT;
+            layout->count++;
+        } else if (strcmp(line, "step") == 0 && journal->step_count < STEP_MAX) {
+            snprintf(journal->steps[journal->step_count++], sizeof(journal->steps[0]), "%s", value);
         }
-        LOG_INFO("Mounted EFI partition");
+    }
+    fclose(fp);
 
-        snprintf(cmd, sizeof(cmd), "swapon %s 2>> /tmp/tonarchy-install.log", part2);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to enable swap: %s", part2);
-            show_message("Failed to enable swap");
-            return 0;
+    if (version != 1 || !layout->disk[0] || !layout_part(layout, PART_ROOT)) {
+        LOG_WARN("Ignoring unreadable install journal %s", path);
+        return 0;
+    }
+    return 1;
+}
+
+static const char *recovery_mount_options(const char *part) {
+    char type[32];
+    char *argv[] = { "blkid", "-s", "TYPE", "-o", "value", (char *)part, NULL };
+    Exec_Options opts = { .capture = type, .capture_size = sizeof(type), .quiet = 1 };
+    if (!exec_run(argv, &opts, NULL)) return NULL;
+    type[strcspn(type, "\n")] = '\0';
+
+    if (strcmp(type, "ext4") == 0) return "ro,noload";
+    if (strcmp(type, "xfs") == 0) return "ro,norecovery";
+    if (strcmp(type, "btrfs") == 0) return "ro,nologreplay";
+    if (strcmp(type, "f2fs") == 0) return "ro,norecovery";
+    return NULL;
+}
+
+static int journal_recover(void) {
+    char devices[1024];
+    char *blkid_argv[] = { "blkid", "-t", "LABEL=root", "-o", "device", NULL };
+    Exec_Options opts = { .capture = devices, .capture_size = sizeof(devices), .quiet = 1 };
+    if (!exec_run(blkid_argv, &opts, NULL)) return 0;
+
+    const char *probe = "/tmp/tonarchy-probe";
+    mkdir(probe, 0700);
+
+    char *save = NULL;
+    for (char *part = strtok_r(devices, "\n", &save); part; part = strtok_r(NULL, "\n", &save)) {
+        const char *mount_opts = recovery_mount_options(part);
+        if (!mount_opts) continue;
+
+        Exec_Options quiet = { .quiet = 1 };
+        char *mount_argv[] = { "mount", "-o", (char *)mount_opts, part, (char *)probe, NULL };
+        if (!exec_run(mount_argv, &quiet, NULL)) continue;
+
+        int found = 0;
+        const char *candidates[] = { "/tmp/tonarchy-probe/var/lib/tonarchy/journal",
+                                     "/tmp/tonarchy-probe/@/var/lib/tonarchy/journal" };
+        for (size_t i = 0; i < ARRAY_LEN(candidates) && !found; i++) {
+            found = access(candidates[i], R_OK) == 0 && run_cmd("cp", candidates[i], JOURNAL_PATH, NULL);
         }
-    } else {
-        snprintf(cmd, sizeof(cmd), "mount %s /mnt 2>> /tmp/tonarchy-install.log", part2);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to mount root: %s", part2);
-            show_message("Failed to mount root partition");
-            return 0;
+        char *umount_argv[] = { "umount", (char *)probe, NULL };
+        exec_run(umount_argv, &quiet, NULL);
+        if (found) {
+            LOG_INFO("Recovered install journal from %s", part);
+            return 1;
         }
-        LOG_INFO("Mounted root partition");
+    }
+    return 0;
+}
 
-        snprintf(cmd, sizeof(cmd), "swapon %s 2>> /tmp/tonarchy-install.log", part1);
-        if (system(cmd) != 0) {
-            LOG_ERROR("Failed to enable swap: %s", part1);
-            show_message("Failed to enable swap");
+static int journal_verify(const Install_Journal *journal) {
+    const Disk_Layout *layout = &journal->layout;
+    for (int i = 0; i < layout->count; i++) {
+        char uuid[64];
+        if (!read_partition_uuid(layout->parts[i].path, uuid, sizeof(uuid)) ||
+            strcmp(uuid, journal->uuids[i]) != 0) {
+            LOG_WARN("Partition %s no longer matches the install journal", layout->parts[i].path);
             return 0;
         }
     }
-    LOG_INFO("Enabled swap");
-    LOG_INFO("Disk partitioning completed successfully");
-
-    show_message("Disk prepared successfully!");
     return 1;
 }
 
-static int install_packages_impl(const char *package_list) {
-    int rows, cols;
-    get_terminal_size(&rows, &cols);
-
-    clear_screen();
-    draw_logo(cols);
-
-    int logo_start = get_logo_start(cols);
-    printf("\033[%d;%dH\033[37mInstalling system packages...\033[0m", 10, logo_start);
-    printf("\033[%d;%dH\033[37mThis will take several minutes.\033[0m", 11, logo_start);
-    fflush(stdout);
-
-    LOG_INFO("Starting package installation");
-    LOG_INFO("Packages: %s", package_list);
-
-    char cmd[4096];
-    snprintf(cmd, sizeof(cmd), "pacstrap -K /mnt %s 2>> /tmp/tonarchy-install.log", package_list);
-
-    int result = system(cmd);
-    if (result != 0) {
-        LOG_ERROR("pacstrap failed with exit code %d", result);
-        show_message("Failed to install packages");
-        return 0;
+static void release_target(const Disk_Layout *layout) {
+    chroot_session_stop();
+    Exec_Options quiet = { .quiet = 1 };
+    for (int i = 0; i < layout->count; i++) {
+        if (layout->parts[i].role == PART_SWAP && swap_active(layout->parts[i].path)) {
+            char *argv[] = { "swapoff", (char *)layout->parts[i].path, NULL };
+            exec_run(argv, &quiet, NULL);
+        }
+    }
+    if (swap_active(CHROOT_PATH SWAPFILE_PATH)) {
+        char *argv[] = { "swapoff", CHROOT_PATH SWAPFILE_PATH, NULL };
+        exec_run(argv, &quiet, NULL);
     }
+    if (is_mountpoint(CHROOT_PATH)) {
+        char *argv[] = { "umount", "-R", CHROOT_PATH, NULL };
+        exec_run(argv, &quiet, NULL);
+    }
+}
 
-    LOG_INFO("Package installation completed successfully");
-    show_message("Packages installed successfully!");
-    return 1;
+static int journal_begin(Install_Journal *journal, const char *profile_name, const Disk_Layout *layout) {
+    memset(journal, 0, sizeof(*journal));
+    snprintf(journal->profile, sizeof(journal->profile), "%s", profile_name);
+    journal->layout = *layout;
+    for (int i = 0; i < layout->count; i++) {
+        if (!read_partition_uuid(layout->parts[i].path, journal->uuids[i], sizeof(journal->uuids[i]))) {
+            return 0;
+        }
+    }
+    journal->phase = JOURNAL_PARTITIONED;
+    return journal_save(journal);
 }
 
-static int configure_system_impl(
-        const char *username,
-        const char *password,
-        const char *hostname,
-        const char *keyboard,
-        const char *timezone,
-        const char *disk,
-        int use_dm
-    ) {
-    (void)disk;
-    int rows, cols;
-    get_terminal_size(&rows, &cols);
+static void journal_set_phase(Install_Journal *journal, Journal_Phase phase) {
+    journal->phase = phase;
+    journal_save(journal);
+    LOG_INFO("Install journal: %s", JOURNAL_PHASE_NAMES[phase]);
+}
 
-    clear_screen();
-    draw_logo(cols);
+static int journal_step_done(const Install_Journal *journal, const char *name) {
+    for (int i = 0; i < journal->step_count; i++) {
+        if (strcmp(journal->steps[i], name) == 0) return 1;
+    }
+    return 0;
+}
 
-    int logo_start = get_logo_start(cols);
-    printf("\033[%d;%dH\033[37mConfiguring system...\033[0m", 10, logo_start);
-    printf("\033[%d;%dH\033[90m(Logging to /tmp/tonarchy-install.log)\033[0m", 11, logo_start);
-    fflush(stdout);
+static int journal_offer_resume(Install_Journal *journal, const char *profile_name) {
+    int found = journal_load(JOURNAL_PATH, journal);
+    if (!found && journal_recover()) {
+        found = journal_load(JOURNAL_PATH, journal);
+    }
+    if (!found) {
+        memset(journal, 0, sizeof(*journal));
+        return 0;
+    }
 
-    LOG_INFO("Starting system configuration");
-    LOG_INFO("User: %s, Hostname: %s, Timezone: %s, Keyboard: %s", username, hostname, timezone, keyboard);
+    const Disk_Layout *layout = &journal->layout;
+    LOG_INFO("Found install journal: /dev/%s, profile %s, phase %s, %d steps done",
+             layout->disk, journal->profile, JOURNAL_PHASE_NAMES[journal->phase], journal->step_count);
+
+    if (journal->phase < JOURNAL_COMPLETE && strcmp(journal->profile, profile_name) == 0 &&
+        journal_verify(journal)) {
+        char resume_label[256];
+        snprintf(resume_label, sizeof(resume_label), "Resume installation on /dev/%s (%s done)",
+                 layout->disk, JOURNAL_PHASE_NAMES[journal->phase]);
+        const char *choices[] = { resume_label, "Start a new installation" };
+        if (select_from_menu(choices, 2) == 0) {
+            LOG_INFO("Resuming installation after phase %s", JOURNAL_PHASE_NAMES[journal->phase]);
+            return 1;
+        }
+    }
 
-    CHECK_OR_FAIL(
-        system("genfstab -U /mnt >> /mnt/etc/fstab 2>> /tmp/tonarchy-install.log") == 0,
-        "Failed to generate fstab - check /tmp/tonarchy-install.log"
-    );
+    LOG_INFO("Discarding install journal for /dev/%s", layout->disk);
+    release_target(layout);
+    unlink(JOURNAL_PATH);
+    memset(journal, 0, sizeof(*journal));
+    return 0;
+}
 
-    CHECK_OR_FAIL(
-        chroot_exec_fmt("ln -sf /usr/share/zoneinfo/%s /etc/localtime", timezone),
-        "Failed to configure timezone"
-    );
+typedef struct {
+    const char *username;
+    const char *password;
+    const char *hostname;
+    const char *keyboard;
+    const char *timezone;
+    Disk_Layout *layout;
+    Install_Journal *journal;
+    Progress_Pane *progress;
+    int level;
+    int use_dm;
+} Install_Context;
+
+static int generate_fstab(void) {
+    chroot_session_stop();
+    char *genfstab_argv[] = { "genfstab", "-U", "/mnt", NULL };
+    Exec_Options genfstab_opts = { .stdout_path = "/mnt/etc/fstab" };
+    return exec_run(genfstab_argv, &genfstab_opts, NULL);
+}
 
+static int step_timezone(const void *arg) {
+    const Install_Context *ctx = arg;
+    if (!chroot_exec_fmt("ln -sf /usr/share/zoneinfo/%s /etc/localtime", ctx->timezone)) {
+        return 0;
+    }
     if (!chroot_exec("hwclock --systohc")) {
         LOG_WARN("Failed to set hardware clock");
     }
+    return 1;
+}
 
-    CHECK_OR_FAIL(
-        write_file("/mnt/etc/locale.gen", "en_US.UTF-8 UTF-8\n"),
-        "Failed to write locale.gen"
-    );
-
-    CHECK_OR_FAIL(
-        chroot_exec("locale-gen"),
-        "Failed to generate locales"
-    );
-
-    CHECK_OR_FAIL(
-        write_file("/mnt/etc/locale.conf", "LANG=en_US.UTF-8\n"),
-        "Failed to write locale.conf"
-    );
-
-    CHECK_OR_FAIL(
-        write_file_fmt("/mnt/etc/vconsole.conf", "KEYMAP=%s\n", keyboard),
-        "Failed to write vconsole.conf"
-    );
-
-    CHECK_OR_FAIL(
-        write_file_fmt("/mnt/etc/hostname", "%s\n", hostname),
-        "Failed to write hostname"
-    );
+static int step_locale(const void *arg) {
+    (void)arg;
+    return write_file("/mnt/etc/locale.gen", "en_US.UTF-8 UTF-8\n") &&
+           chroot_exec("locale-gen") &&
+           write_file("/mnt/etc/locale.conf", "LANG=en_US.UTF-8\n");
+}
 
+static int step_host_files(const void *arg) {
+    const Install_Context *ctx = arg;
     char hosts_content[512];
     snprintf(hosts_content, sizeof(hosts_content),
              "127.0.0.1   localhost\n"
              "::1         localhost\n"
              "127.0.1.1   %s.localdomain %s\n",
-             hostname, hostname);
+             ctx->hostname, ctx->hostname);
 
-    CHECK_OR_FAIL(
-        write_file("/mnt/etc/hosts", hosts_content),
-        "Failed to write hosts file"
-    );
-
-    CHECK_OR_FAIL(
-        chroot_exec_fmt("useradd -m -G wheel -s /bin/bash %s", username),
-        "Failed to create user"
-    );
-
-    FILE *chpasswd_pipe = popen("arch-chroot /mnt chpasswd 2>> /tmp/tonarchy-install.log", "w");
-    if (!chpasswd_pipe) {
-        show_message("Failed to open chpasswd");
+    if (!write_file_fmt("/mnt/etc/vconsole.conf", "KEYMAP=%s\n", ctx->keyboard) ||
+        !write_file_fmt("/mnt/etc/hostname", "%s\n", ctx->hostname) ||
+        !write_file("/mnt/etc/hosts", hosts_content)) {
         return 0;
     }
-    fprintf(chpasswd_pipe, "%s:%s\n", username, password);
-    fprintf(chpasswd_pipe, "root:%s\n", password);
-    int chpasswd_status = pclose(chpasswd_pipe);
-    CHECK_OR_FAIL(
-        chpasswd_status == 0,
-        "Failed to set passwords"
-    );
 
     create_directory("/mnt/etc/sudoers.d", 0750);
-    CHECK_OR_FAIL(
-        write_file("/mnt/etc/sudoers.d/wheel", "%wheel ALL=(ALL:ALL) ALL\n"),
-        "Failed to configure sudo"
-    );
+    if (!write_file("/mnt/etc/sudoers.d/wheel", "%wheel ALL=(ALL:ALL) ALL\n")) {
+        return 0;
+    }
     chmod("/mnt/etc/sudoers.d/wheel", 0440);
+    return 1;
+}
+
+static int step_user(const void *arg) {
+    const Install_Context *ctx = arg;
+    return chroot_exec_fmt("id -u %s >/dev/null 2>&1 || useradd -m -G wheel -s /bin/bash %s",
+                           ctx->username, ctx->username);
+}
+
+static int step_passwords(const void *arg) {
+    const Install_Context *ctx = arg;
+    char chpasswd_input[1024];
+    snprintf(chpasswd_input, sizeof(chpasswd_input), "%s:%s\nroot:%s\n", ctx->username, ctx->password, ctx->password);
+    int ok = chroot_exec_input("chpasswd", chpasswd_input);
+    memset(chpasswd_input, 0, sizeof(chpasswd_input));
+    return ok;
+}
+
+static int step_services(const void *arg) {
+    const Install_Context *ctx = arg;
+    return chroot_exec(ctx->use_dm ? "systemctl enable NetworkManager dbus lightdm"
+                                   : "systemctl enable NetworkManager dbus");
+}
+
+static int step_swap(const void *arg) {
+    const Install_Context *ctx = arg;
+    return configure_swap(ctx->layout);
+}
+
+static int get_root_uuid(Disk_Layout *layout, char *uuid_out, size_t uuid_size) {
+    if (!read_partition_uuid(layout_part(layout, PART_ROOT)->path, uuid_out, uuid_size)) {
+        return 0;
+    }
+    LOG_INFO("Root partition UUID: %s", uuid_out);
+    return 1;
+}
+
+static const char *select_initramfs_compression(const char **options) {
+    struct statvfs vfs;
+    if (statvfs(CHROOT_PATH "/boot", &vfs) == 0 &&
+        (unsigned long long)vfs.f_bavail * vfs.f_frsize >= UKI_LZ4_MIN_FREE_BYTES) {
+        *options = "-l";
+        return "lz4";
+    }
+    *options = "-19";
+    return "zstd";
+}
+
+static int install_uki(const char *cmdline) {
+    const char *options;
+    const char *compression = select_initramfs_compression(&options);
 
-    CHECK_OR_FAIL(
-        chroot_exec("systemctl enable NetworkManager"),
-        "Failed to enable NetworkManager"
-    );
+    if (!create_directory("/mnt/etc/kernel", 0755) ||
+        !create_directory("/mnt/etc/mkinitcpio.conf.d", 0755) ||
+        !create_directory("/mnt/boot/EFI/Linux", 0755)) {
+        LOG_ERROR("Failed to create UKI directories");
+        return 0;
+    }
 
-    CHECK_OR_FAIL(
-        chroot_exec("systemctl enable dbus"),
-        "Failed to enable dbus"
-    );
+    if (!write_file_fmt("/mnt/etc/kernel/cmdline", "%s\n", cmdline) ||
+        !write_file_fmt("/mnt/etc/mkinitcpio.conf.d/tonarchy.conf",
+            "COMPRESSION=\"%s\"\n"
+            "COMPRESSION_OPTIONS=(%s)\n",
+            compression, options) ||
+        !write_file("/mnt/etc/mkinitcpio.d/linux.preset",
+            "ALL_kver=\"/boot/vmlinuz-linux\"\n"
+            "PRESETS=('default')\n"
+            "default_uki=\"/boot/EFI/Linux/" UKI_NAME "\"\n")) {
+        LOG_ERROR("Failed to write UKI configuration");
+        return 0;
+    }
 
-    if (use_dm) {
-        CHECK_OR_FAIL(
-            chroot_exec("systemctl enable lightdm"),
-            "Failed to enable display manager"
-        );
+    if (!build_initramfs()) {
+        LOG_ERROR("Failed to build unified kernel image");
+        write_file("/mnt/etc/mkinitcpio.d/linux.preset",
+            "ALL_kver=\"/boot/vmlinuz-linux\"\n"
+            "PRESETS=('default')\n"
+            "default_image=\"/boot/initramfs-linux.img\"\n");
+        return 0;
     }
 
-    LOG_INFO("System configuration completed successfully");
-    show_message("System configured successfully!");
+    unlink("/mnt/boot/initramfs-linux.img");
+    unlink("/mnt/boot/initramfs-linux-fallback.img");
+    if (!write_file_fmt(BOOT_MODE_PATH, "uki %s %s\n", compression, options)) {
+        LOG_WARN("Failed to record boot mode");
+    }
+    LOG_INFO("Built unified kernel image (%s %s)", compression, options);
     return 1;
 }
 
-static int get_root_uuid(const char *disk, char *uuid_out, size_t uuid_size) {
-    char cmd[512];
-    char root_part[64];
-
-    part_path(root_part, sizeof(root_part), disk, 3);
-    snprintf(cmd, sizeof(cmd), "blkid -s UUID -o value %s", root_part);
-
-    FILE *fp = popen(cmd, "r");
-    if (!fp) {
-        LOG_ERROR("Failed to get UUID for %s", root_part);
+static int write_boot_entry(const char *cmdline) {
+    if (!create_directory("/mnt/boot/loader/entries", 0755)) {
+        LOG_ERROR("Failed to create boot entries directory");
         return 0;
     }
 
-    if (fgets(uuid_out, uuid_size, fp) == NULL) {
-        pclose(fp);
-        LOG_ERROR("Failed to read UUID for %s", root_part);
+    char boot_entry[640];
+    snprintf(boot_entry, sizeof(boot_entry),
+        "title   Tonarchy\n"
+        "linux   /vmlinuz-linux\n"
+        "initrd  /initramfs-linux.img\n"
+        "options %s\n",
+        cmdline);
+
+    LOG_INFO("Creating boot entry");
+    if (!write_file("/mnt/boot/loader/entries/arch.conf", boot_entry)) {
+        LOG_ERROR("Failed to write boot entry");
         return 0;
     }
 
-    uuid_out[strcspn(uuid_out, "\n")] = '\0';
-    pclose(fp);
-
-    if (strlen(uuid_out) == 0) {
-        LOG_ERROR("Empty UUID for %s", root_part);
+    struct stat st;
+    if (stat("/mnt/boot/loader/entries/arch.conf", &st) != 0) {
+        LOG_ERROR("Boot entry file missing after creation");
         return 0;
     }
 
-    LOG_INFO("Root partition UUID: %s", uuid_out);
+    if (!write_file(BOOT_MODE_PATH, "classic\n")) {
+        LOG_WARN("Failed to record boot mode");
+    }
     return 1;
 }
 
-static int install_bootloader(const char *disk) {
-    char cmd[2048];
-    int rows, cols;
-    get_terminal_size(&rows, &cols);
-
-    clear_screen();
-    draw_logo(cols);
-
-    int logo_start = get_logo_start(cols);
-    int uefi = is_uefi_system();
+static int install_bootloader(Disk_Layout *layout) {
+    int uefi = layout->uefi;
 
-    printf("\033[%d;%dH\033[37mInstalling bootloader (%s)...\033[0m", 10, logo_start, uefi ? "systemd-boot" : "GRUB");
-    fflush(stdout);
+    char kernel_options[256];
+    build_kernel_options(layout, kernel_options, sizeof(kernel_options));
+    LOG_INFO("Kernel options: %s", kernel_options);
 
     if (uefi) {
         LOG_INFO("Installing systemd-boot");
 
         if (!chroot_exec("bootctl install")) {
             LOG_ERROR("bootctl install failed");
-            show_message("Failed to install bootloader");
             return 0;
         }
 
         char uuid[128];
-        if (!get_root_uuid(disk, uuid, sizeof(uuid))) {
-            show_message("Failed to get root partition UUID");
+        if (!get_root_uuid(layout, uuid, sizeof(uuid))) {
             return 0;
         }
 
+        char cmdline[512];
+        snprintf(cmdline, sizeof(cmdline), "root=UUID=%s rw rootfstype=%s%s%s",
+            uuid, layout_fs(layout)->name, kernel_options[0] ? " " : "", kernel_options);
+
+        int uki = install_uki(cmdline);
+        if (!uki) {
+            LOG_WARN("Falling back to a kernel and initramfs boot entry");
+        }
+
         LOG_INFO("Creating loader.conf");
-        if (!write_file("/mnt/boot/loader/loader.conf",
-            "default arch.conf\n"
+        if (!write_file_fmt("/mnt/boot/loader/loader.conf",
+            "default %s\n"
             "timeout 3\n"
             "console-mode max\n"
-            "editor no\n")) {
+            "editor no\n",
+            uki ? UKI_NAME : "arch.conf")) {
             LOG_ERROR("Failed to write loader.conf");
-            show_message("Failed to create loader config");
-            return 0;
-        }
-
-        if (!create_directory("/mnt/boot/loader/entries", 0755)) {
-            LOG_ERROR("Failed to create boot entries directory");
-            return 0;
-        }
-
-        char boot_entry[512];
-        snprintf(boot_entry, sizeof(boot_entry),
-            "title   Tonarchy\n"
-            "linux   /vmlinuz-linux\n"
-            "initrd  /initramfs-linux.img\n"
-            "options root=UUID=%s rw\n",
-            uuid);
-
-        LOG_INFO("Creating boot entry");
-        if (!write_file("/mnt/boot/loader/entries/arch.conf", boot_entry)) {
-            LOG_ERROR("Failed to write boot entry");
-            show_message("Failed to create boot entry");
             return 0;
         }
 
-        struct stat st;
-        if (stat("/mnt/boot/loader/entries/arch.conf", &st) != 0) {
-            LOG_ERROR("Boot entry file missing after creation");
-            show_message("Boot entry verification failed");
+        if (!uki && (!build_initramfs() || !write_boot_entry(cmdline))) {
             return 0;
         }
 
@@ -1650,60 +6091,235 @@ static int install_bootloader(const char *disk) {
 
         LOG_INFO("systemd-boot installation completed");
     } else {
-        snprintf(cmd, sizeof(cmd),
-            "arch-chroot /mnt pacman -S --noconfirm grub 2>> /tmp/tonarchy-install.log");
-        if (system(cmd) != 0) {
-            show_message("Failed to install GRUB package");
+        if (!chroot_exec_fmt("grub-install --target=i386-pc /dev/%s", layout->disk)) {
             return 0;
         }
 
-        snprintf(cmd, sizeof(cmd),
-            "arch-chroot /mnt grub-install --target=i386-pc /dev/%s 2>> /tmp/tonarchy-install.log",
-            disk);
-        if (system(cmd) != 0) {
-            show_message("Failed to install GRUB");
+        if (kernel_options[0]) {
+            char expr[512];
+            snprintf(expr, sizeof(expr),
+                "s|^GRUB_CMDLINE_LINUX_DEFAULT=\"\\(.*\\)\"|GRUB_CMDLINE_LINUX_DEFAULT=\"\\1 %s\"|", kernel_options);
+            if (!run_cmd("sed", "-i", expr, "/mnt/etc/default/grub", NULL)) {
+                LOG_WARN("Failed to add kernel options to /etc/default/grub");
+            }
+        }
+
+        if (!build_initramfs()) {
             return 0;
         }
 
-        snprintf(cmd, sizeof(cmd),
-            "arch-chroot /mnt grub-mkconfig -o /boot/grub/grub.cfg 2>> /tmp/tonarchy-install.log");
-        if (system(cmd) != 0) {
-            show_message("Failed to generate GRUB config");
+        if (!chroot_exec("grub-mkconfig -o /boot/grub/grub.cfg")) {
             return 0;
         }
+        if (!write_file(BOOT_MODE_PATH, "grub\n")) {
+            LOG_WARN("Failed to record boot mode");
+        }
     }
 
-    show_message("Bootloader installed successfully!");
     return 1;
 }
 
-static int setup_common_configs(const char *username) {
-    char cmd[4096];
+static int step_bootloader(const void *arg) {
+    const Install_Context *ctx = arg;
+    return install_bootloader(ctx->layout);
+}
+
+static int step_boot_timing(const void *arg) {
+    (void)arg;
+    if (!write_file("/mnt/usr/local/bin/tonarchy-boot-timing",
+            "#!/bin/sh\n"
+            "mode=$(cat /etc/tonarchy-boot-mode 2>/dev/null || echo unknown)\n"
+            "printf '%s [%s] %s\\n' \"$(date -Iseconds)\" \"$mode\" \"$(systemd-analyze time | head -n 1)\" \\\n"
+            "    >> /var/log/tonarchy-boot-times.log\n") ||
+        chmod("/mnt/usr/local/bin/tonarchy-boot-timing", 0755) != 0) {
+        LOG_ERROR("Failed to install boot timing script");
+        return 0;
+    }
+
+    if (!write_file("/mnt/etc/systemd/system/tonarchy-boot-timing.service",
+            "[Unit]\n"
+            "Description=Record firmware, loader and initrd boot timings\n"
+            "\n"
+            "[Service]\n"
+            "Type=oneshot\n"
+            "ExecStart=/usr/local/bin/tonarchy-boot-timing\n") ||
+        !write_file("/mnt/etc/systemd/system/tonarchy-boot-timing.timer",
+            "[Unit]\n"
+            "Description=Record boot timings once startup has finished\n"
+            "\n"
+            "[Timer]\n"
+            "OnBootSec=2min\n"
+            "\n"
+            "[Install]\n"
+            "WantedBy=timers.target\n")) {
+        LOG_ERROR("Failed to write boot timing units");
+        return 0;
+    }
+
+    return chroot_exec("systemctl enable tonarchy-boot-timing.timer");
+}
+
+static const Copy_Job SHARED_ASSETS[] = {
+    { "/usr/share/wallpapers/wall1.jpg",     "/mnt/usr/share/wallpapers/wall1.jpg",   "root", 0 },
+    { "/usr/share/tonarchy/favicon.png",     "/mnt/usr/share/tonarchy/favicon.png",   "root", 0 },
+    { "/usr/share/tonarchy/Tokyonight-Dark", "/mnt/usr/share/themes/Tokyonight-Dark", "root", 0 },
+};
+
+static uint32_t get_le(const unsigned char *p, int bytes) {
+    uint32_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+static int lz_decompress(const unsigned char *in, size_t in_len, unsigned char *out, size_t out_len) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < in_len) {
+        unsigned token = in[ip++];
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            unsigned char b;
+            do {
+                if (ip >= in_len) return 0;
+                b = in[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > in_len - ip || lit > out_len - op) return 0;
+        memcpy(out + op, in + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == in_len) break;
+
+        if (in_len - ip < 2) return 0;
+        size_t offset = get_le(in + ip, 2);
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15) {
+            unsigned char b;
+            do {
+                if (ip >= in_len) return 0;
+                b = in[ip++];
+                match += b;
+            } while (b == 255);
+        }
+        match += 4;
+        if (offset == 0 || offset > op || match > out_len - op) return 0;
+        for (size_t i = 0; i < match; i++, op++) {
+            out[op] = out[op - offset];
+        }
+    }
+    return op == out_len;
+}
+
+static int extract_asset_entry(char type, mode_t mode, const char *path, uid_t uid, gid_t gid,
+                               const unsigned char *data, size_t size) {
+    if (type == 'd') {
+        return (mkdir(path, mode) == 0 || errno == EEXIST) &&
+               fchownat(AT_FDCWD, path, uid, gid, 0) == 0 &&
+               fchmodat(AT_FDCWD, path, mode, 0) == 0;
+    }
+    if (type == 'l') {
+        char target[PATH_MAX];
+        snprintf(target, sizeof(target), "%.*s", (int)size, (const char *)data);
+        unlink(path);
+        return symlink(target, path) == 0 && fchownat(AT_FDCWD, path, uid, gid, AT_SYMLINK_NOFOLLOW) == 0;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = write_all(fd, data, size) && fchown(fd, uid, gid) == 0 && fchmod(fd, mode) == 0;
+    close(fd);
+    return ok;
+}
+
+static int extract_asset_bundle(const char *username, const char *desktop, Copy_Stats *stats) {
+    struct timespec begin, now;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
 
-    create_directory("/mnt/usr/share/wallpapers", 0755);
-    system("cp /usr/share/wallpapers/wall1.jpg /mnt/usr/share/wallpapers/wall1.jpg");
+    unsigned char *raw = malloc(ASSET_BUNDLE_RAW_SIZE);
+    if (!raw || !lz_decompress(ASSET_BUNDLE, sizeof(ASSET_BUNDLE), raw, ASSET_BUNDLE_RAW_SIZE) ||
+        memcmp(raw, "TAB1", 4) != 0) {
+        LOG_ERROR("Embedded asset bundle is corrupt");
+        free(raw);
+        return 0;
+    }
 
-    create_directory("/mnt/usr/share/tonarchy", 0755);
-    system("cp /usr/share/tonarchy/favicon.png /mnt/usr/share/tonarchy/favicon.png");
+    memset(stats, 0, sizeof(*stats));
+    size_t pos = 4;
+    while (pos + 12 <= ASSET_BUNDLE_RAW_SIZE) {
+        const unsigned char *rec = raw + pos;
+        char type = (char)rec[0];
+        mode_t mode = (mode_t)get_le(rec + 1, 2);
+        size_t group_len = rec[3];
+        size_t owner_len = rec[4];
+        size_t path_len = get_le(rec + 5, 2);
+        size_t size = get_le(rec + 7, 4);
+        const char *group = (const char *)rec + 11;
+        const char *owner = group + group_len;
+        const char *target = owner + owner_len;
+        const unsigned char *data = (const unsigned char *)target + path_len;
+        pos += 11 + group_len + owner_len + path_len + size;
+        if (pos > ASSET_BUNDLE_RAW_SIZE) {
+            stats->failures++;
+            break;
+        }
 
-    create_directory("/mnt/usr/share/themes", 0755);
-    system("cp -r /usr/share/tonarchy/Tokyonight-Dark /mnt/usr/share/themes/");
+        if (!(group_len == 6 && memcmp(group, "common", 6) == 0) &&
+            !(group_len == strlen(desktop) && memcmp(group, desktop, group_len) == 0)) {
+            continue;
+        }
 
-    LOG_INFO("Setting up Firefox profile");
-    snprintf(cmd, sizeof(cmd), "/mnt/home/%s/.config/firefox", username);
-    create_directory(cmd, 0755);
+        char path[PATH_MAX];
+        char owner_name[64];
+        if (target[0] == '~') {
+            snprintf(path, sizeof(path), "%s/home/%s%.*s", CHROOT_PATH, username, (int)path_len - 1, target + 1);
+        } else {
+            snprintf(path, sizeof(path), "%s%.*s", CHROOT_PATH, (int)path_len, target);
+        }
+        snprintf(owner_name, sizeof(owner_name), "%.*s", (int)owner_len, owner);
+
+        uid_t uid;
+        gid_t gid;
+        const char *account = strcmp(owner_name, "user") == 0 ? username : owner_name;
+        if (!resolve_owner(path, account, account, &uid, &gid) ||
+            !copy_make_parents(path, uid, gid) ||
+            !extract_asset_entry(type, mode, path, uid, gid, data, size)) {
+            LOG_WARN("Failed to extract %s: %s", path, strerror(errno));
+            stats->failures++;
+            continue;
+        }
 
-    snprintf(cmd, sizeof(cmd), "cp -r /usr/share/tonarchy/firefox/default-release/* /mnt/home/%s/.config/firefox/", username);
-    system(cmd);
+        if (type == 'd') {
+            stats->dirs++;
+        } else if (type == 'l') {
+            stats->links++;
+        } else {
+            stats->files++;
+            stats->bytes += size;
+        }
+    }
+    free(raw);
 
-    snprintf(cmd, sizeof(cmd), "arch-chroot /mnt chown -R %s:%s /home/%s/.config/firefox", username, username, username);
-    system(cmd);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    LOG_INFO("Extracted %d files (%.1f MiB), %d directories and %d symlinks from the embedded bundle in %.2fs",
+             stats->files, (double)stats->bytes / (1024.0 * 1024.0), stats->dirs, stats->links,
+             elapsed_ms(&begin, &now) / 1000.0);
+    return stats->failures == 0;
+}
 
-    create_directory("/mnt/usr/lib/firefox/distribution", 0755);
-    system("cp /usr/share/tonarchy/firefox-policies/policies.json /mnt/usr/lib/firefox/distribution/");
+static int step_assets(const void *arg) {
+    const Install_Context *ctx = arg;
+    Copy_Stats stats;
+    if (!extract_asset_bundle(ctx->username, ctx->level == OXIDIZED ? "oxwm" : "xfce", &stats)) {
+        return 0;
+    }
+    copy_trees(SHARED_ASSETS, (int)ARRAY_LEN(SHARED_ASSETS), NULL);
 
     create_directory("/mnt/usr/share/applications", 0755);
-    write_file("/mnt/usr/share/applications/firefox.desktop",
+    return write_file("/mnt/usr/share/applications/firefox.desktop",
         "[Desktop Entry]\n"
         "Name=Firefox\n"
         "GenericName=Web Browser\n"
@@ -1713,32 +6329,15 @@ static int setup_common_configs(const char *username) {
         "Categories=Network;WebBrowser;\n"
         "MimeType=text/html;text/xml;application/xhtml+xml;application/vnd.mozilla.xul+xml;\n"
     );
+}
 
-    snprintf(cmd, sizeof(cmd), "/mnt/home/%s/.config", username);
-    create_directory(cmd, 0755);
-
-    snprintf(cmd, sizeof(cmd), "arch-chroot /mnt chown -R %s:%s /home/%s/.config", username, username, username);
-    system(cmd);
-
-    snprintf(cmd, sizeof(cmd), "cp -r /usr/share/tonarchy/alacritty /mnt/home/%s/.config/alacritty", username);
-    system(cmd);
-
-    snprintf(cmd, sizeof(cmd), "cp -r /usr/share/tonarchy/rofi /mnt/home/%s/.config/rofi", username);
-    system(cmd);
-
-    snprintf(cmd, sizeof(cmd), "cp -r /usr/share/tonarchy/fastfetch /mnt/home/%s/.config/fastfetch", username);
-    system(cmd);
-
-    snprintf(cmd, sizeof(cmd), "cp -r /usr/share/tonarchy/picom /mnt/home/%s/.config/picom", username);
-    system(cmd);
-
+static int step_nvim_config(const void *arg) {
+    const Install_Context *ctx = arg;
     char nvim_path[256];
-    snprintf(nvim_path, sizeof(nvim_path), "/home/%s/.config/nvim", username);
-    git_clone_as_user(username, "https://github.com/tonybanters/nvim", nvim_path);
-
-    snprintf(cmd, sizeof(cmd), "arch-chroot /mnt chown -R %s:%s /home/%s/.config", username, username, username);
-    system(cmd);
-
+    snprintf(nvim_path, sizeof(nvim_path), "/home/%s/.config/nvim", ctx->username);
+    if (!git_clone_as_user(ctx->username, "https://github.com/tonybanters/nvim", nvim_path)) {
+        LOG_WARN("Failed to clone nvim config");
+    }
     return 1;
 }
 
@@ -1790,131 +6389,321 @@ static const char *BASH_PROFILE_CONTENT =
     "  exec startx\n"
     "fi\n";
 
-static int configure_xfce(const char *username) {
-    char cmd[4096];
-    int rows, cols;
-    get_terminal_size(&rows, &cols);
-
-    clear_screen();
-    draw_logo(cols);
-
-    int logo_start = get_logo_start(cols);
-    printf("\033[%d;%dH\033[37mConfiguring XFCE...\033[0m", 10, logo_start);
-    fflush(stdout);
-
-    setup_common_configs(username);
-
-    snprintf(cmd, sizeof(cmd), "cp -r /usr/share/tonarchy/xfce4 /mnt/home/%s/.config/xfce4", username);
-    system(cmd);
-
-    snprintf(cmd, sizeof(cmd), "arch-chroot /mnt chown -R %s:%s /home/%s/.config/xfce4", username, username, username);
-    system(cmd);
+static const char *OXWM_XINITRC_CONTENT =
+    "export GTK_THEME=Adwaita-dark\n"
+    "xset r rate 200 35 &\n"
+    "picom --config ~/.config/picom/picom.conf &\n"
+    "xwallpaper --zoom /usr/share/wallpapers/wall1.jpg &\n"
+    "exec oxwm\n";
 
+static int step_dotfiles(const void *arg) {
+    const Install_Context *ctx = arg;
     Dotfile dotfiles[] = {
-        { ".xinitrc", "exec startxfce4\n", 0755 },
+        { ".xinitrc", ctx->level == OXIDIZED ? OXWM_XINITRC_CONTENT : "exec startxfce4\n", 0755 },
         { ".bash_profile", BASH_PROFILE_CONTENT, 0644 },
         { ".bashrc", BASHRC_CONTENT, 0644 }
     };
 
     for (size_t i = 0; i < ARRAY_LEN(dotfiles); i++) {
-        if (!create_user_dotfile(username, &dotfiles[i])) {
+        if (!create_user_dotfile(ctx->username, &dotfiles[i])) {
             LOG_ERROR("Failed to create dotfile: %s", dotfiles[i].filename);
             return 0;
         }
     }
+    return 1;
+}
+
+static int step_autologin(const void *arg) {
+    const Install_Context *ctx = arg;
+    return setup_autologin(ctx->username);
+}
 
-    if (!setup_autologin(username)) {
+static int read_conf_value(const char *path, const char *key, char *out, size_t size) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
         return 0;
     }
 
-    return 1;
+    size_t key_len = strlen(key);
+    int found = 0;
+    char line[256];
+    while (!found && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, key, key_len) == 0 && line[key_len] == '=') {
+            snprintf(out, size, "%s", line + key_len + 1);
+            found = 1;
+        }
+    }
+    fclose(fp);
+    return found;
 }
 
-static int configure_oxwm(const char *username) {
-    char cmd[4096];
-    int rows, cols;
-    get_terminal_size(&rows, &cols);
-
-    clear_screen();
-    draw_logo(cols);
-
-    int logo_start = get_logo_start(cols);
-    printf("\033[%d;%dH\033[37mConfiguring OXWM...\033[0m", 10, logo_start);
-    printf("\033[%d;%dH\033[37mCloning and building from source...\033[0m", 11, logo_start);
-    fflush(stdout);
+static int oxwm_artifact_current(char *commit, size_t size) {
+    char source_commit[64];
+    if (!read_conf_value(OXWM_ARTIFACT_DIR "/version", "commit", commit, size) ||
+        access(OXWM_ARTIFACT_DIR "/oxwm", X_OK) != 0) {
+        return 0;
+    }
 
-    LOG_INFO("Starting OXWM installation for user: %s", username);
+    FILE *fp = fopen(GIT_BUNDLE_DIR "/oxwm.commit", "r");
+    if (!fp) {
+        return 1;
+    }
+    int matches = fgets(source_commit, sizeof(source_commit), fp) != NULL &&
+                  strncmp(source_commit, commit, strlen(commit)) == 0;
+    fclose(fp);
+    if (!matches) {
+        LOG_WARN("Prebuilt OXWM %s does not match the bundled source", commit);
+    }
+    return matches;
+}
 
+static int build_oxwm_from_source(const Install_Context *ctx) {
     char oxwm_path[256];
-    snprintf(oxwm_path, sizeof(oxwm_path), "/home/%s/oxwm", username);
+    snprintf(oxwm_path, sizeof(oxwm_path), "/home/%s/oxwm", ctx->username);
+
+    int have_zig = access(CHROOT_PATH "/usr/bin/zig", X_OK) == 0;
+    if (!have_zig && !check_internet_connection()) {
+        LOG_ERROR("Building OXWM from source needs zig from the mirrors, but there is no network connection");
+        return 0;
+    }
 
-    if (!git_clone_as_user(username, "https://github.com/tonybanters/oxwm", oxwm_path)) {
+    chroot_exec_fmt("rm -rf %s", oxwm_path);
+    if (!git_clone_as_user(ctx->username, "https://github.com/tonybanters/oxwm", oxwm_path)) {
         LOG_ERROR("Failed to clone oxwm");
-        show_message("Failed to clone OXWM");
+        return 0;
+    }
+
+    if (!have_zig && !chroot_exec("pacman -S --noconfirm --needed zig")) {
+        LOG_ERROR("Failed to install zig");
         return 0;
     }
 
     if (!chroot_exec_fmt("cd %s && zig build -Doptimize=ReleaseSmall", oxwm_path)) {
         LOG_ERROR("Failed to build oxwm");
-        show_message("Failed to build OXWM");
         return 0;
     }
 
-    if (!chroot_exec_fmt("cp %s/zig-out/bin/oxwm /usr/bin/oxwm", oxwm_path)) {
+    if (!chroot_exec_fmt("install -m 755 %s/zig-out/bin/oxwm /usr/bin/oxwm", oxwm_path)) {
         LOG_ERROR("Failed to install oxwm binary");
-        show_message("Failed to install OXWM");
         return 0;
     }
+    return 1;
+}
 
-    chroot_exec("chmod 755 /usr/bin/oxwm");
+static int step_oxwm_install(const void *arg) {
+    const Install_Context *ctx = arg;
+    char commit[64];
+    if (oxwm_artifact_current(commit, sizeof(commit))) {
+        Copy_Job job = { OXWM_ARTIFACT_DIR "/oxwm", "/mnt/usr/bin/oxwm", "root", 1 };
+        if (copy_trees(&job, 1, NULL) && chroot_exec("! ldd /usr/bin/oxwm | grep -q 'not found'")) {
+            LOG_INFO("Installed prebuilt OXWM %s", commit);
+            return 1;
+        }
+        LOG_WARN("Prebuilt OXWM %s does not link against the target libraries", commit);
+    }
 
-    setup_common_configs(username);
+    LOG_INFO("Building OXWM from source");
+    return build_oxwm_from_source(ctx);
+}
 
-    snprintf(cmd, sizeof(cmd), "cp -r /usr/share/tonarchy/gtk-3.0 /mnt/home/%s/.config/gtk-3.0", username);
-    system(cmd);
+static int step_oxwm_config(const void *arg) {
+    const Install_Context *ctx = arg;
+    char template_path[PATH_MAX];
+    char config_path[PATH_MAX];
+    snprintf(template_path, sizeof(template_path), "/mnt/home/%s/oxwm/templates/tonarchy-config.lua", ctx->username);
+    if (access(template_path, R_OK) != 0) {
+        snprintf(template_path, sizeof(template_path), "%s/templates/tonarchy-config.lua", OXWM_ARTIFACT_DIR);
+    }
+    snprintf(config_path, sizeof(config_path), "/mnt/home/%s/.config/oxwm/config.lua", ctx->username);
 
-    snprintf(cmd, sizeof(cmd), "cp -r /usr/share/tonarchy/gtk-4.0 /mnt/home/%s/.config/gtk-4.0", username);
-    system(cmd);
+    Copy_Job job = { template_path, config_path, ctx->username, 1 };
+    return copy_trees(&job, 1, NULL);
+}
 
-    snprintf(cmd, sizeof(cmd), "cp /usr/share/tonarchy/gtkrc-2.0 /mnt/home/%s/.gtkrc-2.0", username);
-    system(cmd);
+static const Step SYSTEM_STEPS[] = {
+    { "timezone",      step_timezone,      STEP_USES_CHROOT,                     {0},                  "Failed to configure timezone" },
+    { "locale",        step_locale,        STEP_USES_CHROOT | STEP_USES_CPU,     {0},                  "Failed to generate locales" },
+    { "host-files",    step_host_files,    0,                                    {0},                  "Failed to write system configuration" },
+    { "user",          step_user,          STEP_USES_CHROOT,                     {0},                  "Failed to create user" },
+    { "passwords",     step_passwords,     STEP_USES_CHROOT | STEP_NO_JOURNAL,   {"user"},             "Failed to set passwords" },
+    { "services",      step_services,      STEP_USES_CHROOT,                     {0},                  "Failed to enable services" },
+    { "swap",          step_swap,          0,                                    {0},                  "Failed to configure swap" },
+    { "bootloader",    step_bootloader,    STEP_USES_CHROOT | STEP_USES_NETWORK, {"host-files"},       "Failed to install bootloader" },
+    { "boot-timing",   step_boot_timing,   STEP_USES_CHROOT,                     {"bootloader"},       "Failed to set up boot timing" },
+    { "assets",        step_assets,        0,                                    {"user"},             "Failed to copy desktop assets" },
+    { "nvim-config",   step_nvim_config,   STEP_USES_CHROOT | STEP_USES_NETWORK, {"assets"},           "Failed to set up nvim configuration" },
+    { "dotfiles",      step_dotfiles,      0,                                    {"user"},             "Failed to create dotfiles" },
+    { "autologin",     step_autologin,     0,                                    {0},                  "Failed to set up autologin" },
+};
 
-    snprintf(cmd, sizeof(cmd), "/mnt/home/%s/.config/oxwm", username);
-    create_directory(cmd, 0755);
+static int step_home_owner(const void *arg) {
+    const Install_Context *ctx = arg;
+    char home[PATH_MAX];
+    snprintf(home, sizeof(home), "%s/home/%s", CHROOT_PATH, ctx->username);
+    return chown_tree(home, ctx->username, ctx->username);
+}
 
-    snprintf(cmd, sizeof(cmd), "cp /mnt%s/templates/tonarchy-config.lua /mnt/home/%s/.config/oxwm/config.lua", oxwm_path, username);
-    system(cmd);
+static const Step HOME_OWNER_STEP =
+    { "home-owner",    step_home_owner,    0,                                    {"assets", "dotfiles", "nvim-config"}, "Failed to set home directory ownership" };
 
-    snprintf(cmd, sizeof(cmd), "arch-chroot /mnt chown -R %s:%s /home/%s/.config", username, username, username);
-    system(cmd);
+static const Step OXWM_STEPS[] = {
+    { "oxwm-install",  step_oxwm_install,  STEP_USES_CHROOT | STEP_USES_NETWORK | STEP_USES_CPU, {"user"}, "Failed to install OXWM" },
+    { "oxwm-config",   step_oxwm_config,   0,                                    {"oxwm-install", "assets"}, "Failed to configure OXWM" },
+};
 
-    Dotfile dotfiles[] = {
-        { ".xinitrc", "export GTK_THEME=Adwaita-dark\nxset r rate 200 35 &\npicom --config ~/.config/picom/picom.conf &\nxwallpaper --zoom /usr/share/wallpapers/wall1.jpg &\nexec oxwm\n", 0755 },
-        { ".bash_profile", BASH_PROFILE_CONTENT, 0644 },
-        { ".bashrc", BASHRC_CONTENT, 0644 }
-    };
+static int step_journaled(const void *arg) {
+    (void)arg;
+    return 1;
+}
 
-    for (size_t i = 0; i < ARRAY_LEN(dotfiles); i++) {
-        if (!create_user_dotfile(username, &dotfiles[i])) {
-            LOG_ERROR("Failed to create dotfile: %s", dotfiles[i].filename);
-            return 0;
+static void step_progress(const void *arg, int done, int total, const Step *step, int ok) {
+    const Install_Context *ctx = arg;
+    if (!step) {
+        progress_tick(ctx->progress);
+        return;
+    }
+
+    Install_Journal *journal = ctx->journal;
+    if (ok && !(step->resources & STEP_NO_JOURNAL) && !journal_step_done(journal, step->name) &&
+        journal->step_count < STEP_MAX) {
+        snprintf(journal->steps[journal->step_count++], sizeof(journal->steps[0]), "%s", step->name);
+        journal_save(journal);
+    }
+
+    Progress_Pane *pane = ctx->progress;
+    pane->item = done;
+    pane->items = total;
+    snprintf(pane->current, sizeof(pane->current), "%s %s", step->name, ok ? "done" : "failed");
+    clock_gettime(CLOCK_MONOTONIC, &pane->last_activity);
+    progress_draw(pane);
+}
+
+static int configure_target(const Install_Context *ctx) {
+    int rows, cols;
+    get_terminal_size(&rows, &cols);
+
+    clear_screen();
+    draw_logo(cols);
+
+    int logo_start = get_logo_start(cols);
+    screen_put(10, logo_start, STYLE_WHITE, "Configuring system...");
+    screen_put(11, logo_start, STYLE_GRAY, "(Logging to /tmp/tonarchy-install.log)");
+    screen_present();
+
+    LOG_INFO("Starting system configuration");
+    LOG_INFO("User: %s, Hostname: %s, Timezone: %s, Keyboard: %s",
+             ctx->username, ctx->hostname, ctx->timezone, ctx->keyboard);
+
+    if (!generate_fstab()) {
+        show_message("Failed to generate fstab - check /tmp/tonarchy-install.log");
+        return 0;
+    }
+    if (!chroot_session_start()) {
+        show_message("Failed to enter the installed system");
+        return 0;
+    }
+
+    Step steps[STEP_MAX];
+    int count = 0;
+    for (size_t i = 0; i < ARRAY_LEN(SYSTEM_STEPS); i++) steps[count++] = SYSTEM_STEPS[i];
+    if (ctx->level == OXIDIZED) {
+        for (size_t i = 0; i < ARRAY_LEN(OXWM_STEPS); i++) steps[count++] = OXWM_STEPS[i];
+    }
+    steps[count] = HOME_OWNER_STEP;
+    if (ctx->level == OXIDIZED) steps[count].deps[3] = "oxwm-config";
+    count++;
+
+    Install_Journal *journal = ctx->journal;
+    uint64_t config_hash = 14695981039346656037ULL;
+    const char *inputs[] = { ctx->username, ctx->hostname, ctx->keyboard, ctx->timezone };
+    for (size_t i = 0; i < ARRAY_LEN(inputs); i++) config_hash = fnv1a_update(config_hash, inputs[i]);
+    if (journal->config_hash != config_hash) {
+        journal->config_hash = config_hash;
+        journal->step_count = 0;
+        journal_save(journal);
+    }
+    for (int i = 0; i < count; i++) {
+        if (!(steps[i].resources & STEP_NO_JOURNAL) && journal_step_done(journal, steps[i].name)) {
+            LOG_INFO("Step %s already completed, skipping", steps[i].name);
+            steps[i].run = step_journaled;
         }
     }
 
-    if (!setup_autologin(username)) {
+    progress_begin(ctx->progress, "Configuring system", NULL, CHROOT_PATH);
+    int failed = -1;
+    int steps_ok = run_steps(steps, count, ctx, step_progress, &failed);
+    progress_end(ctx->progress);
+    if (!steps_ok) {
+        show_message(failed >= 0 ? steps[failed].error : "System configuration failed");
         return 0;
     }
 
-    LOG_INFO("OXWM installation completed successfully");
-    show_message("OXWM installed successfully!");
+    LOG_INFO("System configuration completed successfully");
+    show_message("System configured successfully!");
     return 1;
 }
 
-int main(void) {
-    logger_init("/tmp/tonarchy-install.log");
+static int print_profile_packages(void) {
+    char resolved_packages[MAX_CMD_SIZE];
+
+    for (size_t i = 0; i < ARRAY_LEN(INSTALL_PROFILES); i++) {
+        const Install_Profile *profile = &INSTALL_PROFILES[i];
+        if (!resolve_profile_packages(
+                profile->name,
+                profile->groups,
+                profile->group_count,
+                resolved_packages,
+                sizeof(resolved_packages))) {
+            fprintf(stderr, "Failed to resolve profile '%s'\n", profile->name);
+            return 1;
+        }
+        printf("%s %s\n", profile->name, resolved_packages);
+    }
+
+    return 0;
+}
+
+static int write_image_partition_table(const char *path, const char *scheme) {
+    if (strcmp(scheme, "gpt") != 0 && strcmp(scheme, "mbr") != 0) {
+        fprintf(stderr, "Unknown partition scheme: %s\n", scheme);
+        return 1;
+    }
+
+    Disk_Layout layout = {0};
+    const char *base = strrchr(path, '/');
+    snprintf(layout.disk, sizeof(layout.disk), "%s", base ? base + 1 : path);
+    layout.uefi = strcmp(scheme, "gpt") == 0;
+    log_file = stderr;
+    return write_partition_table(path, &layout) ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        if (strcmp(argv[1], "--profile-packages") == 0) {
+            return print_profile_packages();
+        }
+        if (strcmp(argv[1], "--rank-mirrors") == 0 && argc == 3) {
+            log_file = stderr;
+            return rank_mirrors(argv[2], argv[2], MIRROR_RANK_BUDGET_MS) ? 0 : 1;
+        }
+        if (strcmp(argv[1], "--write-partition-table") == 0 && (argc == 3 || argc == 4)) {
+            return write_image_partition_table(argv[2], argc == 4 ? argv[3] : "gpt");
+        }
+        fprintf(stderr,
+                "Usage: %s [--profile-packages | --rank-mirrors MIRRORLIST |\n"
+                "          --write-partition-table IMAGE [gpt|mbr]]\n", argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    logger_init(EXEC_LOG_PATH);
     LOG_INFO("Tonarchy installer started");
 
-    if (!setup_wifi_if_needed()) {
+    int offline = offline_repo_available() || rootfs_images_available();
+    if (offline) {
+        LOG_INFO("Local install media found, skipping network setup");
+    } else if (!setup_wifi_if_needed()) {
         logger_close();
         return 1;
     }
@@ -1946,61 +6735,138 @@ int main(void) {
 
     LOG_INFO("Installation level selected: %d", level);
 
-    char disk[64] = "";
-    if (!select_disk(disk)) {
-        LOG_INFO("Installation cancelled by user at disk selection");
+    const Install_Profile *profile = find_install_profile(level);
+    if (!profile) {
+        LOG_ERROR("Unknown installation level selected: %d", level);
+        show_message("Unknown installation mode");
         logger_close();
         return 1;
     }
 
-    LOG_INFO("Selected disk: %s", disk);
+    static Install_Journal journal;
+    int resume = journal_offer_resume(&journal, profile->name);
 
-    const char *beginner_groups[] = { "base", "display_xorg", "de_xfce" };
-    const char *oxidized_groups[] = { "base", "display_xorg", "de_oxwm" };
-    const char *electrified_groups[] = {
-        "base",
-        "display_xorg",
-        "de_xfce",
-        "ham_core",
-        "ham_audio_serial_tools",
-        "ham_sdr"
-    };
-    const char **selected_groups = NULL;
-    size_t selected_group_count = 0;
-    const char *profile_name = NULL;
+    int use_image = rootfs_image_available(profile->name);
+    int use_repo = !use_image && offline_repo_covers(profile->name);
 
-    if (level == BEGINNER) {
-        profile_name = "beginner_xfce";
-        selected_groups = beginner_groups;
-        selected_group_count = ARRAY_LEN(beginner_groups);
-    } else if (level == OXIDIZED) {
-        profile_name = "oxidized_oxwm";
-        selected_groups = oxidized_groups;
-        selected_group_count = ARRAY_LEN(oxidized_groups);
-    } else if (level == ELECTRIFIED) {
-        profile_name = "electrified";
-        selected_groups = electrified_groups;
-        selected_group_count = ARRAY_LEN(electrified_groups);
+    if (offline) {
+        char oxwm_commit[64];
+        int needs_network = (!use_image && !use_repo) ||
+                            (level == OXIDIZED && !oxwm_artifact_current(oxwm_commit, sizeof(oxwm_commit)));
+        if (needs_network && !check_internet_connection()) {
+            LOG_INFO("Profile '%s' needs network access beyond the local install media", profile->name);
+            if (!setup_wifi_if_needed()) {
+                logger_close();
+                return 1;
+            }
+        }
+        if (!use_image && !use_repo) {
+            LOG_WARN("Local install media does not cover profile '%s', using mirrors", profile->name);
+        }
+    }
+
+    if (use_image) {
+        LOG_INFO("Installing profile '%s' from rootfs image", profile->name);
+    } else if (use_repo) {
+        CHECK_OR_FAIL(prepare_offline_repo(), "Failed to prepare offline repository");
     } else {
-        LOG_ERROR("Unknown installation level selected: %d", level);
-        show_message("Unknown installation mode");
-        logger_close();
-        return 1;
+        if (!rank_live_mirrors()) {
+            LOG_WARN("Mirror ranking failed, keeping static mirrorlist order");
+        }
+
+        char prefetch_packages[MAX_CMD_SIZE];
+        if (resolve_profile_packages(
+                profile->name,
+                profile->groups,
+                profile->group_count,
+                prefetch_packages,
+                sizeof(prefetch_packages)) &&
+            journal.phase < JOURNAL_PACKAGES) {
+            start_package_prefetch(prefetch_packages);
+        }
     }
 
-    CHECK_OR_FAIL(partition_disk(disk), "Failed to partition disk");
-    CHECK_OR_FAIL(
-        install_profile_packages(profile_name, level, selected_groups, selected_group_count),
-        "Failed to install profile packages"
-    );
-    CHECK_OR_FAIL(configure_system_impl(username, password, hostname, keyboard, timezone, disk, 0), "Failed to configure system");
-    CHECK_OR_FAIL(install_bootloader(disk), "Failed to install bootloader");
+    Disk_Layout layout = {0};
+    if (resume) {
+        layout = journal.layout;
+        read_device_class(&layout);
+    } else {
+        char disk[64] = "";
+        if (!select_disk(disk)) {
+            LOG_INFO("Installation cancelled by user at disk selection");
+            logger_close();
+            return 1;
+        }
+
+        LOG_INFO("Selected disk: %s", disk);
+
+        layout.uefi = is_uefi_system();
+        snprintf(layout.disk, sizeof(layout.disk), "%s", disk);
+        read_device_class(&layout);
+
+        if (!select_filesystem(&layout)) {
+            LOG_INFO("Installation cancelled by user at filesystem selection");
+            logger_close();
+            return 1;
+        }
+        plan_swap(&layout);
+    }
+
+    char package_plan[MAX_CMD_SIZE];
     CHECK_OR_FAIL(
-        configure_desktop_for_mode(level, username),
-        "Failed to configure desktop environment"
+        build_package_plan(profile, &layout, use_image, package_plan, sizeof(package_plan)),
+        "Failed to resolve package plan"
     );
+    CHECK_OR_FAIL(validate_package_plan(profile, &layout, package_plan), "Package plan validation failed");
+    uint64_t packages_hash = package_plan_hash(use_image, package_plan);
+
+    if (journal.phase < JOURNAL_PARTITIONED) {
+        CHECK_OR_FAIL(partition_disk(&layout), "Failed to partition disk");
+        if (!journal_begin(&journal, profile->name, &layout)) {
+            LOG_WARN("Install journal unavailable, this run cannot be resumed");
+        }
+    } else if (journal.phase < JOURNAL_PACKAGES) {
+        LOG_INFO("Package installation was interrupted, re-formatting the target partitions");
+        release_target(&layout);
+        CHECK_OR_FAIL(format_partitions(&layout) && mount_target(&layout), "Failed to re-format target partitions");
+        if (!journal_begin(&journal, profile->name, &layout)) {
+            LOG_WARN("Install journal unavailable, this run cannot be resumed");
+        }
+    } else {
+        CHECK_OR_FAIL(mount_target(&layout), "Failed to mount target partitions");
+    }
+
+    if (journal.phase >= JOURNAL_PACKAGES && journal.packages_hash == packages_hash) {
+        LOG_INFO("Packages already installed for this package plan, skipping");
+    } else {
+        if (use_image) {
+            CHECK_OR_FAIL(install_profile_image(profile), "Failed to install system image");
+        } else {
+            LOG_INFO("Installing profile '%s' via pacstrap", profile->name);
+            CHECK_OR_FAIL(install_packages_impl(package_plan), "Failed to install profile packages");
+        }
+        journal.packages_hash = packages_hash;
+        journal_set_phase(&journal, JOURNAL_PACKAGES);
+    }
 
-    system("cp /tmp/tonarchy-install.log /mnt/var/log/tonarchy-install.log");
+    Progress_Pane progress;
+    Install_Context ctx = {
+        .username = username,
+        .password = password,
+        .hostname = hostname,
+        .keyboard = keyboard,
+        .timezone = timezone,
+        .layout = &layout,
+        .journal = &journal,
+        .progress = &progress,
+        .level = level,
+    };
+    CHECK_OR_FAIL(configure_target(&ctx), "Installation failed - check /tmp/tonarchy-install.log");
+    journal_set_phase(&journal, JOURNAL_CONFIGURED);
+
+    chroot_session_stop();
+    journal_set_phase(&journal, JOURNAL_COMPLETE);
+    run_cmd("cp", EXEC_LOG_PATH, "/mnt/var/log/tonarchy-install.log", NULL);
 
     clear_screen();
     int rows, cols;
@@ -2008,9 +6874,9 @@ int main(void) {
     draw_logo(cols);
 
     int logo_start = get_logo_start(cols);
-    printf("\033[%d;%dH\033[1;32mInstallation complete!\033[0m\n", 10, logo_start);
-    printf("\033[%d;%dH\033[37mPress Enter to reboot...\033[0m\n", 12, logo_start);
-    fflush(stdout);
+    screen_put(10, logo_start, STYLE_LOGO, "Installation complete!");
+    screen_put(12, logo_start, STYLE_WHITE, "Press Enter to reboot...");
+    screen_present();
 
     char c;
     enable_raw_mode();
@@ -2025,7 +6891,9 @@ int main(void) {
     logger_close();
 
     sync();
-    system("sleep 2 && reboot &");
+    sleep(2);
+    char *reboot_argv[] = { "reboot", NULL };
+    exec_spawn_detached(reboot_argv);
 
     exit(0);
 }
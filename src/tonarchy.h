@@ -3,6 +3,7 @@
 
 #define _POSIX_C_SOURCE 200809L
 #define _XOPEN_SOURCE 500
+#define _DEFAULT_SOURCE
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -21,6 +22,13 @@
 #include <fcntl.h>
 
 #define CHROOT_PATH "/mnt"
+#define OFFLINE_REPO_DIR "/usr/share/tonarchy/repo"
+#define OFFLINE_REPO_NAME "tonarchy-offline"
+#define OFFLINE_PACMAN_CONF "/tmp/tonarchy-offline-pacman.conf"
+#define ROOTFS_IMAGE_DIR "/usr/share/tonarchy/images"
+#define ROOTFS_DIRS_CHUNK "dirs.tar.zst"
+#define GIT_BUNDLE_DIR "/usr/share/tonarchy/git"
+#define OXWM_ARTIFACT_DIR "/usr/share/tonarchy/oxwm"
 #define MAX_CMD_SIZE 4096
 #define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
 
@@ -77,8 +85,8 @@ typedef struct {
 typedef enum {
     INPUT_TEXT,
     INPUT_PASSWORD,
-    INPUT_FZF_KEYMAP,
-    INPUT_FZF_TIMEZONE
+    INPUT_KEYMAP,
+    INPUT_TIMEZONE
 } Input_Type;
 
 typedef struct {
@@ -89,6 +97,106 @@ typedef struct {
     const char *error_msg;
 } Form_Field;
 
+#define EXEC_LOG_PATH "/tmp/tonarchy-install.log"
+#define EXEC_MAX_ARGS 64
+#define EXEC_MAX_PARALLEL 32
+#define EXEC_LINE_MAX 512
+#define EXEC_POLL_MS 50
+#define EXEC_REAP_POLL_NS 1000000L
+#define EXEC_KILL_GRACE_MS 2000
+#define CHROOT_WORKERS 4
+#define CHROOT_DRAIN_MS 200
+#define STEP_MAX 32
+#define STEP_MAX_DEPS 4
+#define STEP_MAX_WORKERS 4
+#define STEP_NETWORK_SLOTS 2
+#define STEP_TICK_MS 1000
+#define COPY_WORKERS 4
+#define COPY_PARALLEL_BYTES (1 << 20)
+#define JOURNAL_PATH "/tmp/tonarchy-journal"
+#define TARGET_JOURNAL_DIR CHROOT_PATH "/var/lib/tonarchy"
+
+typedef struct {
+    const char *input;
+    const char *stdout_path;
+    const char *log_name;
+    char *capture;
+    size_t capture_size;
+    int timeout_ms;
+    int quiet;
+    int detached;
+    void (*on_line)(void *observer, const char *line);
+    void (*on_tick)(void *observer);
+    void *observer;
+} Exec_Options;
+
+typedef struct {
+    int status;
+    int timed_out;
+    double wall_ms;
+    double cpu_ms;
+} Exec_Result;
+
+typedef struct {
+    pid_t pid;
+    int out_fd;
+    int err_fd;
+    int in_fd;
+    const char *input;
+    size_t input_len;
+    size_t input_off;
+    char *capture;
+    size_t capture_size;
+    size_t capture_len;
+    int timeout_ms;
+    int timed_out;
+    double kill_at_ms;
+    int quiet;
+    void (*on_line)(void *observer, const char *line);
+    void (*on_tick)(void *observer);
+    void *observer;
+    struct timespec started;
+    char label[32];
+    char command[256];
+    char out_line[EXEC_LINE_MAX];
+    size_t out_len;
+    char err_line[EXEC_LINE_MAX];
+    size_t err_len;
+} Exec_Process;
+
+typedef enum {
+    STEP_USES_CHROOT  = 1 << 0,
+    STEP_USES_NETWORK = 1 << 1,
+    STEP_USES_CPU     = 1 << 2,
+    STEP_NO_JOURNAL   = 1 << 3,
+} Step_Resource;
+
+typedef struct {
+    const char *name;
+    int (*run)(const void *ctx);
+    unsigned int resources;
+    const char *deps[STEP_MAX_DEPS];
+    const char *error;
+} Step;
+
+typedef struct {
+    const char *source;
+    const char *dest;
+    const char *owner;
+    int required;
+} Copy_Job;
+
+typedef struct {
+    unsigned long long bytes;
+    int files;
+    int dirs;
+    int links;
+    int reflinked;
+    int failures;
+} Copy_Stats;
+
+typedef void (*Step_Progress)(const void *ctx, int done, int total, const Step *step, int ok);
+
 void logger_init(const char *log_path);
 void logger_close(void);
 void log_msg(Log_Level level, const char *fmt, ...);
@@ -98,10 +206,23 @@ void log_msg(Log_Level level, const char *fmt, ...);
 #define LOG_WARN(...)  log_msg(LOG_LEVEL_WARN, __VA_ARGS__)
 #define LOG_ERROR(...) log_msg(LOG_LEVEL_ERROR, __VA_ARGS__)
 
+int exec_start(char *const argv[], const Exec_Options *opts, Exec_Process *proc);
+int exec_wait(Exec_Process *proc, Exec_Result *res);
+int exec_wait_any(Exec_Process *procs, int count, Exec_Result *res);
+int exec_run(char *const argv[], const Exec_Options *opts, Exec_Result *res);
+pid_t exec_spawn_detached(char *const argv[]);
+int run_cmd(const char *arg0, ...);
+int run_steps(const Step *steps, int count, const void *ctx, Step_Progress progress, int *failed);
+
 int write_file(const char *path, const char *content);
 int write_file_fmt(const char *path, const char *fmt, ...);
 int set_file_perms(const char *path, mode_t mode, const char *owner, const char *group);
+int chown_tree(const char *path, const char *owner, const char *group);
 int create_directory(const char *path, mode_t mode);
+int copy_trees(const Copy_Job *jobs, int count, Copy_Stats *stats);
+int chroot_session_start(void);
+void chroot_session_stop(void);
+int chroot_exec_input(const char *cmd, const char *input);
 int chroot_exec(const char *cmd);
 int chroot_exec_fmt(const char *fmt, ...);
 int chroot_exec_as_user(const char *username, const char *cmd);
@@ -0,0 +1,92 @@
+#!/bin/sh
+# Ranks a mirrorlist of local HTTP servers with `tonarchy --rank-mirrors` and
+# checks that the fast server comes first and the dead one is commented out.
+set -eu
+
+TONARCHY=${1:-./tonarchy}
+WORK=$(mktemp -d)
+PIDS=""
+
+cleanup() {
+    [ -z "$PIDS" ] || kill $PIDS 2>/dev/null || true
+    rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+fail() {
+    echo "check-mirrors: $*" >&2
+    exit 1
+}
+
+command -v python3 >/dev/null || fail "python3 is required for the local mirrors"
+
+# serve NAME DELAY: serves 512 KiB per request, sleeping DELAY seconds per 16 KiB.
+serve() {
+    python3 - "$WORK/$1.port" "$2" <<'PY' &
+import http.server, os, sys, time
+
+port_file, delay = sys.argv[1], float(sys.argv[2])
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    def do_GET(self):
+        self.send_response(200)
+        self.send_header("Content-Length", str(32 * 16384))
+        self.end_headers()
+        try:
+            for _ in range(32):
+                self.wfile.write(b"\0" * 16384)
+                self.wfile.flush()
+                time.sleep(delay)
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+
+    def log_message(self, *args):
+        pass
+
+server = http.server.HTTPServer(("127.0.0.1", 0), Handler)
+with open(port_file + ".tmp", "w") as f:
+    f.write(str(server.server_address[1]))
+os.rename(port_file + ".tmp", port_file)
+server.serve_forever()
+PY
+    PIDS="$PIDS $!"
+}
+
+wait_port() {
+    tries=0
+    while [ ! -s "$WORK/$1.port" ]; do
+        tries=$((tries + 1))
+        [ "$tries" -le 50 ] || fail "mirror $1 did not start"
+        sleep 0.1
+    done
+    cat "$WORK/$1.port"
+}
+
+serve fast 0
+serve slow 0.02
+FAST=$(wait_port fast)
+SLOW=$(wait_port slow)
+
+cat > "$WORK/mirrorlist" <<EOF
+Server = http://127.0.0.1:$SLOW/\$repo/os/\$arch
+Server = http://127.0.0.1:1/\$repo/os/\$arch
+#Server = http://127.0.0.1:$FAST/\$repo/os/\$arch
+EOF
+
+"$TONARCHY" --rank-mirrors "$WORK/mirrorlist" 2>"$WORK/log" || {
+    cat "$WORK/log" >&2
+    fail "--rank-mirrors failed"
+}
+
+cat > "$WORK/expected" <<EOF
+Server = http://127.0.0.1:$FAST/\$repo/os/\$arch
+Server = http://127.0.0.1:$SLOW/\$repo/os/\$arch
+#Server = http://127.0.0.1:1/\$repo/os/\$arch
+EOF
+
+grep '^#\{0,1\}Server' "$WORK/mirrorlist" > "$WORK/ranked"
+if ! cmp -s "$WORK/expected" "$WORK/ranked"; then
+    diff "$WORK/expected" "$WORK/ranked" >&2 || true
+    fail "unexpected mirror order"
+fi
+echo "check-mirrors: ok"
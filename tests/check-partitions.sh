@@ -0,0 +1,64 @@
+#!/bin/sh
+# Writes GPT and MBR tables to sparse images with `tonarchy
+# --write-partition-table` and checks them with sfdisk (and sgdisk when
+# installed).
+set -eu
+
+TONARCHY=${1:-./tonarchy}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT INT TERM
+
+fail() {
+    echo "check-partitions: $*" >&2
+    exit 1
+}
+
+command -v sfdisk >/dev/null || fail "sfdisk (util-linux) is required"
+
+# write_table NAME SIZE SCHEME: writes the table and dumps it to NAME.dump.
+write_table() {
+    truncate -s "$2" "$WORK/$1.img"
+    "$TONARCHY" --write-partition-table "$WORK/$1.img" "$3" 2>"$WORK/$1.log" || {
+        cat "$WORK/$1.log" >&2
+        fail "$1: --write-partition-table failed"
+    }
+    sfdisk --dump "$WORK/$1.img" >"$WORK/$1.dump" 2>"$WORK/$1.err" || fail "$1: sfdisk --dump failed"
+    if [ -s "$WORK/$1.err" ]; then
+        cat "$WORK/$1.err" >&2
+        fail "$1: sfdisk reported problems"
+    fi
+}
+
+# expect NAME PATTERN: the dump of NAME must contain an ERE match.
+expect() {
+    grep -Eq "$2" "$WORK/$1.dump" || {
+        cat "$WORK/$1.dump" >&2
+        fail "$1: no line matching '$2'"
+    }
+}
+
+expect_parts() {
+    count=$(grep -c ' : start=' "$WORK/$1.dump" || true)
+    [ "$count" -eq "$2" ] || fail "$1: expected $2 partitions, found $count"
+}
+
+write_table gpt 16G gpt
+expect gpt '^label: gpt$'
+expect gpt '^sector-size: 512$'
+expect_parts gpt 2
+expect gpt 'gpt\.img1 : start= *2048, size= *2097152, type=C12A7328-F81F-11D2-BA4B-00A0C93EC93B, .*name="EFI"'
+expect gpt 'gpt\.img2 : start= *2099200, .*type=0FC63DAF-8483-4772-8E79-3D69D8477DE4, .*name="root"'
+if command -v sgdisk >/dev/null; then
+    sgdisk -v "$WORK/gpt.img" | grep -q 'No problems found' || fail "gpt: sgdisk -v found problems"
+fi
+
+write_table mbr 16G mbr
+expect mbr '^label: dos$'
+expect_parts mbr 1
+expect mbr 'mbr\.img1 : start= *2048, size= *33552384, type=83, bootable'
+
+write_table mbr-large 3T mbr
+expect_parts mbr-large 1
+expect mbr-large 'mbr-large\.img1 : start= *2048, size= *4294963200, type=83, bootable'
+
+echo "check-partitions: ok"